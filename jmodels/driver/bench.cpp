@@ -0,0 +1,291 @@
+// Load-path benchmark and regression gate for the Yopi joint model.
+//
+// Drives JModelYopi through the canonical load paths below and reports, for
+// each, the cost per contact-step and a checksum of the final contact state:
+//   tension-gi     monotonic opening, exponential softening from G_I
+//   tension-table  monotonic opening, softening from table-dt
+//   tension-lut    the same, from the local copy of table-dt
+//                  (table-tolerance 1e-3, see jmodelyopitable.h)
+//   cyclic-comp    compression cycles: envelope, Xeta unloading, beta reloading
+//   shear-dilation direct shear with dilation decay (dilation-zero, delta)
+//   shear-cap      shear under high closure, driving the cap (compCorrection)
+//   tension-open   opening well past complete tensile failure, reclosing into
+//                  compression and reopening (dormant contacts, see law())
+//   elastic        small normal and shear cycles under a preload, inside the
+//                  elastic range (screened contacts, see law())
+//
+// With --baseline the run fails (exit code 2) if a checksum differs from the
+// recorded one, or if a case is slower than recorded by more than --threshold
+// (fractional, 0.10 by default; 0 turns the throughput gate off). --update
+// rewrites the baseline from this run. A baseline holds for the number of
+// contacts it was recorded with, and its checksums for the compiler and math
+// library: bench-baseline.txt is that of the reference configuration (g++ 12,
+// x86-64 Linux, CMake Release build, 20000 contacts), which ctest gates on
+// with the throughput gate off. Record one per other configuration.
+//
+// The bench measures the current law, jmodelyopi.cpp, and is built with the
+// driver (CMakeLists.txt). --variant KEY runs the same cases on one of the
+// older copies of the law instead (variants.h: tud1006027, tud1006027-2 or
+// yoktiovan), skipping those that set a property the copy does not have
+// (tension-lut); each copy has its own baseline, bench-baseline-KEY.txt for
+// the reference configuration.
+//
+// --batch runs the cases through JModelYopi::runBatch(), for the current law
+// only; the checksums must match those of the scalar run() baseline. --simd
+// (with --batch) uses the vectorised compression branch: each case is then
+// also run through run() and the gate is on the largest force difference,
+// which must stay within kYopiSimdUlpBound (jmodelyopisimd.h), instead of on
+// the checksum.
+//
+// Usage:
+//   yopibench [--contacts N] [--repeat R] [--case NAME]... [--threshold F]
+//             [--baseline FILE] [--update FILE] [--variant KEY] [--batch BLOCK]
+//             [--simd auto|none|avx2|avx512]
+
+#include "contactset.h"
+#include "jmodelyopi.h"
+#include "variants.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+    struct BenchCase {
+        string                                        name_;
+        driver::LoadPath                              path_;
+        std::vector<std::pair<string, base::Property>> props_;
+    };
+
+    struct BenchResult {
+        uint64 checksum_ = 0;
+        double nsPerStep_ = 0.0;
+        uint64 ulp_ = 0;        // against run(), with --simd only
+        string missing_;        // the property the variant does not have, if any
+    };
+
+    struct Destroy {
+        void operator()(jmodels::JointModel* m) const { m->destroy(); }
+    };
+    typedef std::unique_ptr<jmodels::JointModel, Destroy> ModelPtr;
+
+    std::vector<BenchCase> canonicalCases()
+    {
+        std::vector<BenchCase> cases;
+        cases.push_back({ "tension-gi", driver::LoadPath::monotonicTension(3e-4, 600), {} });
+        cases.push_back({ "tension-table", driver::LoadPath::monotonicTension(3e-4, 600),
+                          { { "G_I", 0.0 }, { "table-dt", "dt" } } });
+        cases.push_back({ "tension-lut", driver::LoadPath::monotonicTension(3e-4, 600),
+                          { { "G_I", 0.0 }, { "table-dt", "dt" }, { "table-tolerance", 1e-3 } } });
+        cases.push_back({ "cyclic-comp", driver::LoadPath::cyclicCompression(5e-4, 5, 200, 0.0), {} });
+        cases.push_back({ "shear-dilation", driver::LoadPath::directShear(2e-5, 100, 2e-3, 1000),
+                          { { "dilation", 5.0 }, { "dilation-zero", 1e-3 } } });
+        cases.push_back({ "shear-cap", driver::LoadPath::directShear(2.6e-4, 400, 1e-3, 600), {} });
+        driver::LoadPath open("open");
+        open.ramp(-2e-3, DVect3(0.0), 1000);
+        open.ramp(2.2e-3, DVect3(0.0), 300);
+        open.ramp(-2.2e-3, DVect3(0.0), 300);
+        cases.push_back({ "tension-open", open, {} });
+        driver::LoadPath elastic("elastic");
+        elastic.ramp(2e-5, DVect3(0.0), 200);
+        for (uint32 i = 0; i < 10; ++i) {
+            elastic.ramp(5e-6, DVect3(1e-5, 0.0, 0.0), 100);
+            elastic.ramp(-5e-6, DVect3(-1e-5, 0.0, 0.0), 100);
+        }
+        cases.push_back({ "elastic", elastic, {} });
+        return cases;
+    }
+
+    BenchResult runCase(const BenchCase& bc, const driver::Variant& variant, const driver::TableStore& tables,
+                        size_t contacts, uint32 repeat, size_t batch, jmodels::YopiSimd simd)
+    {
+        BenchResult r;
+        ModelPtr proto(variant.create_());
+        driver::setDefaultMaterial(proto.get());
+        for (auto& p : bc.props_)
+            if (!driver::setPropertyByName(proto.get(), p.first, p.second)) {
+                if (&variant == &driver::variants().front())
+                    throw std::runtime_error("Unknown property " + p.first);
+                r.missing_ = p.first;
+                return r;
+            }
+
+        double best = 0.0;
+        for (uint32 i = 0; i < repeat; ++i) {
+            driver::ContactSet set(proto.get(), contacts, &tables, false, 1.0);
+            auto t0 = std::chrono::steady_clock::now();
+            if (batch) set.replayBatch(bc.path_, batch, simd);
+            else set.replay(bc.path_);
+            auto t1 = std::chrono::steady_clock::now();
+            if (!i && simd != jmodels::YopiSimd::None) {
+                driver::ContactSet ref(proto.get(), contacts, &tables, false, 1.0);
+                ref.replay(bc.path_);
+                r.ulp_ = set.maxUlp(ref);
+            }
+            double ns = std::chrono::duration<double, std::nano>(t1 - t0).count()
+                / (static_cast<double>(contacts) * bc.path_.size());
+            uint64 sum = set.checksum();
+            if (i && sum != r.checksum_)
+                throw std::runtime_error("Case " + bc.name_ + " is not deterministic between repeats.");
+            r.checksum_ = sum;
+            if (!i || ns < best) best = ns;
+        }
+        r.nsPerStep_ = best;
+        return r;
+    }
+
+    const char* const contactsTag = "# contacts ";
+
+    std::map<string, BenchResult> readBaseline(const string& file, size_t contacts)
+    {
+        std::ifstream in(file);
+        if (!in) throw std::runtime_error("Unable to open baseline " + file);
+        std::map<string, BenchResult> base;
+        string line;
+        while (std::getline(in, line)) {
+            if (!line.compare(0, std::strlen(contactsTag), contactsTag)) {
+                const size_t n = std::strtoull(line.c_str() + std::strlen(contactsTag), nullptr, 10);
+                if (n != contacts)
+                    throw std::runtime_error("Baseline " + file + " is for --contacts " + std::to_string(n));
+            }
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream is(line);
+            string name, hex;
+            BenchResult r;
+            if (!(is >> name >> hex >> r.nsPerStep_)) continue;
+            r.checksum_ = std::strtoull(hex.c_str(), nullptr, 16);
+            base[name] = r;
+        }
+        return base;
+    }
+
+    void writeBaseline(const string& file, size_t contacts,
+                       const std::vector<std::pair<string, BenchResult>>& results)
+    {
+        std::ofstream out(file);
+        if (!out) throw std::runtime_error("Unable to write baseline " + file);
+#if defined(__clang__)
+        out << "# compiler " << __VERSION__ << "\n";
+#elif defined(__GNUC__)
+        out << "# compiler GCC " << __VERSION__ << "\n";
+#elif defined(_MSC_FULL_VER)
+        out << "# compiler MSVC " << _MSC_FULL_VER << "\n";
+#endif
+        out << contactsTag << contacts << "\n";
+        out << "# case checksum ns/contact-step\n";
+        for (auto& r : results) {
+            char buf[128];
+            std::snprintf(buf, sizeof(buf), "%s %016llx %.3f\n", r.first.c_str(),
+                          static_cast<unsigned long long>(r.second.checksum_), r.second.nsPerStep_);
+            out << buf;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        size_t contacts = 20000;
+        uint32 repeat = 3;
+        double threshold = 0.10;
+        string baseline, update;
+        std::vector<string> only;
+        string variant = "current";
+        size_t batch = 0;
+        jmodels::YopiSimd simd = jmodels::YopiSimd::None;
+
+        for (int i = 1; i < argc; ++i) {
+            string a = argv[i];
+            auto next = [&]() -> const char* {
+                if (i + 1 >= argc) throw std::runtime_error("Missing value for " + a);
+                return argv[++i];
+            };
+            if (a == "--contacts") contacts = std::strtoull(next(), nullptr, 10);
+            else if (a == "--repeat") repeat = std::max(1, std::atoi(next()));
+            else if (a == "--case") only.push_back(next());
+            else if (a == "--threshold") threshold = std::atof(next());
+            else if (a == "--baseline") baseline = next();
+            else if (a == "--update") update = next();
+            else if (a == "--variant") variant = next();
+            else if (a == "--batch") batch = std::strtoull(next(), nullptr, 10);
+            else if (a == "--simd") simd = jmodels::yopiSimdFromName(next());
+            else {
+                std::printf("usage: yopibench [--contacts N] [--repeat R] [--case NAME]... [--threshold F]\n"
+                            "                 [--baseline FILE] [--update FILE] [--variant KEY] [--batch BLOCK]\n"
+                            "                 [--simd auto|none|avx2|avx512]\n");
+                return a == "--help" ? 0 : 1;
+            }
+        }
+
+        if (simd != jmodels::YopiSimd::None && !batch)
+            throw std::runtime_error("--simd needs --batch.");
+        const driver::Variant& law = driver::findVariant(variant);
+        if (batch && &law != &driver::variants().front())
+            throw std::runtime_error("--batch runs the current law only, not --variant " + variant + ".");
+
+        driver::TableStore tables;
+        tables.add("dt", { 1.0, 1.05, 1.2, 1.5 }, { 0.0, 0.5, 0.9, 1.0 });
+
+        std::map<string, BenchResult> base;
+        if (baseline.size()) base = readBaseline(baseline, contacts);
+
+        bool failed = false;
+        std::vector<std::pair<string, BenchResult>> results;
+        std::printf("%-16s %-16s %15s %10s  %s\n", "case", "checksum", "ns/contact-step", "Mstep/s", "gate");
+        for (auto& bc : canonicalCases()) {
+            if (only.size() && std::find(only.begin(), only.end(), bc.name_) == only.end()) continue;
+            BenchResult r = runCase(bc, law, tables, contacts, repeat, batch, simd);
+            if (r.missing_.size()) {
+                std::printf("%-16s %-16s %15s %10s  skipped, no %s\n", bc.name_.c_str(), "-", "-", "-",
+                            r.missing_.c_str());
+                continue;
+            }
+            results.push_back({ bc.name_, r });
+
+            string gate = "-";
+            auto it = base.find(bc.name_);
+            if (simd != jmodels::YopiSimd::None && r.ulp_ > jmodels::kYopiSimdUlpBound) {
+                gate = "FAIL " + std::to_string(r.ulp_) + " ulp";
+                failed = true;
+            }
+            else if (baseline.size()) {
+                if (it == base.end())
+                    gate = "no baseline";
+                else if (simd == jmodels::YopiSimd::None && it->second.checksum_ != r.checksum_) {
+                    gate = "FAIL checksum";
+                    failed = true;
+                }
+                else if (threshold > 0.0 && r.nsPerStep_ > it->second.nsPerStep_ * (1.0 + threshold)) {
+                    char buf[64];
+                    std::snprintf(buf, sizeof(buf), "FAIL slower by %.1f%%",
+                                  100.0 * (r.nsPerStep_ / it->second.nsPerStep_ - 1.0));
+                    gate = buf;
+                    failed = true;
+                }
+                else
+                    gate = "ok";
+            }
+            if (simd != jmodels::YopiSimd::None && gate.compare(0, 4, "FAIL"))
+                gate = (gate == "-" ? string("ok") : gate) + " (" + std::to_string(r.ulp_) + " ulp)";
+            std::printf("%-16s %016llx %15.2f %10.2f  %s\n", bc.name_.c_str(),
+                        static_cast<unsigned long long>(r.checksum_), r.nsPerStep_,
+                        r.nsPerStep_ > 0.0 ? 1e3 / r.nsPerStep_ : 0.0, gate.c_str());
+        }
+
+        if (update.size()) writeBaseline(update, contacts, results);
+        return failed ? 2 : 0;
+    }
+    catch (std::exception& e) {
+        std::fprintf(stderr, "yopibench: %s\n", e.what());
+        return 1;
+    }
+}
+
+// EOF
@@ -0,0 +1,457 @@
+#include "contactset.h"
+#include "jmodelyopibatch.h"
+#include "jmodelyopisnapshot.h"
+#include "jmodelyopitrace.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+namespace driver
+{
+    static string lower(string s)
+    {
+        for (auto& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return s;
+    }
+
+    // Base 1 index of \a name in the getProperties() list, 0 if not found.
+    static uint32 propertyIndex(const jmodels::JointModel* m, const string& name)
+    {
+        std::istringstream list(m->getProperties());
+        string entry;
+        string key = lower(name);
+        for (uint32 index = 1; std::getline(list, entry, ','); ++index) {
+            std::istringstream syn(entry);
+            string word;
+            while (syn >> word)
+                if (lower(word) == key) return index;
+        }
+        return 0;
+    }
+
+    // Number of properties in the getProperties() list.
+    static uint32 propertyCount(const jmodels::JointModel* m)
+    {
+        const string list = m->getProperties();
+        return list.empty() ? 0 : static_cast<uint32>(std::count(list.begin(), list.end(), ',')) + 1;
+    }
+
+    bool setPropertyByName(jmodels::JointModel* m, const string& name, const base::Property& p)
+    {
+        uint32 index = propertyIndex(m, name);
+        if (!index) return false;
+        m->setProperty(index, p);
+        return true;
+    }
+
+    double getPropertyByName(const jmodels::JointModel* m, const string& name)
+    {
+        uint32 index = propertyIndex(m, name);
+        return index ? m->getProperty(index).to<double>() : 0.0;
+    }
+
+    void setDefaultMaterial(jmodels::JointModel* m)
+    {
+        setPropertyByName(m, "stiffness-normal", 5e10);
+        setPropertyByName(m, "stiffness-initial", 5e10);
+        setPropertyByName(m, "stiffness-shear", 2e10);
+        setPropertyByName(m, "cohesion", 0.3e6);
+        setPropertyByName(m, "compression", 10e6);
+        setPropertyByName(m, "friction", 35.0);
+        setPropertyByName(m, "tension", 0.2e6);
+        setPropertyByName(m, "cohesion-residual", 0.0);
+        setPropertyByName(m, "friction-residual", 30.0);
+        setPropertyByName(m, "comp-residual", 1e6);
+        setPropertyByName(m, "tension-residual", 0.0);
+        setPropertyByName(m, "G_I", 10.0);
+        setPropertyByName(m, "G_II", 50.0);
+        setPropertyByName(m, "G_c", 5000.0);
+        setPropertyByName(m, "peak_ratio", 1.0);
+    }
+
+    ContactSet::ContactSet(const jmodels::JointModel* proto, size_t count, const TableStore* tables,
+                           bool trackEnergy, double area) :
+        tables_(tables),
+        trackEnergy_(trackEnergy)
+    {
+        models_.reserve(count);
+        states_.reserve(count);
+        scale_.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            jmodels::JointModel* m = proto->clone();
+            m->copy(proto);
+            models_.push_back(m);
+            states_.emplace_back(tables, trackEnergy);
+            states_.back().reset(area);
+            // Golden-ratio sequence: deterministic, evenly spread in [0.75,1.25).
+            double f = std::fmod(i * 0.6180339887498949, 1.0);
+            scale_.push_back(0.75 + 0.5 * f);
+        }
+    }
+
+    ContactSet::~ContactSet()
+    {
+        for (auto m : models_)
+            m->destroy();
+    }
+
+    void ContactSet::step(const LoadStep& st, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i) {
+            MockState& s = states_[i];
+            double f = scale_[i];
+            s.normal_disp_inc_ = st.normal_disp_inc_ * f;
+            s.shear_disp_inc_ = st.shear_disp_inc_ * f;
+            s.normal_disp_ += s.normal_disp_inc_;
+            s.shear_disp_ += s.shear_disp_inc_;
+            models_[i]->run(3, &s);
+        }
+    }
+
+    void ContactSet::replay(const LoadPath& path)
+    {
+        for (const auto& st : path.steps())
+            step(st, 0, size());
+    }
+
+    void ContactSet::replayThreaded(const LoadPath& path, uint32 threads, size_t block)
+    {
+        if (threads < 2) {
+            replay(path);
+            return;
+        }
+        if (!block) block = 1;
+        std::vector<std::exception_ptr> failed(threads);
+        auto work = [&](uint32 t) {
+            try {
+                for (const auto& st : path.steps())
+                    for (size_t begin = t * block; begin < size(); begin += threads * block)
+                        step(st, begin, std::min(size(), begin + block));
+            }
+            catch (...) {
+                failed[t] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> pool;
+        for (uint32 t = 1; t < threads; ++t)
+            pool.emplace_back(work, t);
+        work(0);
+        for (auto& th : pool)
+            th.join();
+        for (auto& e : failed)
+            if (e) std::rethrow_exception(e);
+    }
+
+    void ContactSet::reinitialize()
+    {
+        for (size_t i = 0; i < size(); ++i)
+            models_[i]->initialize(3, &states_[i]);
+    }
+
+    void ContactSet::save(std::ostream& o) const
+    {
+        for (auto m : models_)
+            m->save(o);
+    }
+
+    std::vector<string> ContactSet::saveBlocks() const
+    {
+        std::vector<string> blocks;
+        blocks.reserve(size());
+        for (auto m : models_) {
+            std::ostringstream o;
+            m->save(o);
+            blocks.push_back(o.str());
+        }
+        return blocks;
+    }
+
+    size_t ContactSet::blockDifferences(const std::vector<string>& blocks) const
+    {
+        if (blocks.size() != size())
+            throw std::runtime_error("blockDifferences() needs a block per contact.");
+        size_t n = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            std::ostringstream o;
+            models_[i]->save(o);
+            if (o.str() != blocks[i]) ++n;
+        }
+        return n;
+    }
+
+    void ContactSet::restore(std::istream& i, uint32 restoreVersion)
+    {
+        for (auto& m : models_) {
+            jmodels::JointModel* fresh = m->clone();
+            fresh->restore(i, restoreVersion);
+            // 3DEC saves the properties too, and sets them back after
+            // restore() with the same version.
+            const uint32 n = propertyCount(m);
+            for (uint32 index = 1; index <= n; ++index)
+                fresh->setProperty(index, m->getProperty(index), restoreVersion);
+            m->destroy();
+            m = fresh;
+        }
+    }
+
+    void ContactSet::replayBatch(const LoadPath& path, size_t block, jmodels::YopiSimd simd)
+    {
+        if (models_.empty()) return;
+        std::vector<jmodels::JModelYopi*> yopi(size());
+        for (size_t i = 0; i < size(); ++i) {
+            yopi[i] = dynamic_cast<jmodels::JModelYopi*>(models_[i]);
+            if (!yopi[i]) throw std::runtime_error("replayBatch() needs JModelYopi contacts.");
+        }
+        if (!block) block = size();
+
+        jmodels::YopiBatch b;
+        b.resize(size());
+        b.simd_ = simd;
+        for (size_t i = 0; i < size(); ++i)
+            b.gather(i, *yopi[i], states_[i]);
+
+        // Every contact was cloned from the same prototype, so any of them is the
+        // material. Its own history is in the batch already.
+        jmodels::JModelYopi* material = yopi[0];
+        MockState host(tables_, trackEnergy_);
+        host.reset(0.0);
+        material->initialize(3, &host);
+        for (const auto& st : path.steps()) {
+            for (size_t begin = 0; begin < size(); begin += block) {
+                size_t end = std::min(size(), begin + block);
+                for (size_t i = begin; i < end; ++i) {
+                    double f = scale_[i];
+                    b.normal_disp_inc_[i] = st.normal_disp_inc_ * f;
+                    b.shear_disp_inc_[i] = st.shear_disp_inc_ * f;
+                    b.normal_disp_[i] += b.normal_disp_inc_[i];
+                    b.shear_disp_[i] += b.shear_disp_inc_[i];
+                }
+                material->runBatch(3, b, &host, begin, end);
+            }
+        }
+
+        for (size_t i = 0; i < size(); ++i)
+            b.scatter(i, *yopi[i], states_[i]);
+    }
+
+    uint64 ContactSet::checksum() const
+    {
+        uint64 h = 14695981039346656037ULL;
+        auto mix = [&h](const void* p, size_t n) {
+            const unsigned char* b = static_cast<const unsigned char*>(p);
+            for (size_t i = 0; i < n; ++i) {
+                h ^= b[i];
+                h *= 1099511628211ULL;
+            }
+        };
+        if (models_.empty()) return h;
+        uint32 idt = propertyIndex(models_[0], "dt");
+        uint32 ids = propertyIndex(models_[0], "ds");
+        uint32 idc = propertyIndex(models_[0], "dc");
+        for (size_t i = 0; i < models_.size(); ++i) {
+            const MockState& s = states_[i];
+            double v[7] = { s.normal_force_, s.shear_force_.x(), s.shear_force_.y(), s.shear_force_.z(),
+                            idt ? models_[i]->getProperty(idt).to<double>() : 0.0,
+                            ids ? models_[i]->getProperty(ids).to<double>() : 0.0,
+                            idc ? models_[i]->getProperty(idc).to<double>() : 0.0 };
+            for (auto& d : v)
+                if (d == 0.0) d = 0.0; // fold -0.0 into +0.0
+            mix(v, sizeof(v));
+            mix(&s.state_, sizeof(s.state_));
+        }
+        return h;
+    }
+
+    size_t ContactSet::differences(const ContactSet& other) const
+    {
+        if (other.size() != size())
+            throw std::runtime_error("differences() needs two sets of the same size.");
+        auto same = [](const auto& a, const auto& b) { return std::memcmp(&a, &b, sizeof(a)) == 0; };
+        size_t n = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            const MockState& a = states_[i];
+            const MockState& b = other.states_[i];
+            bool equal = same(a.state_, b.state_) && same(a.normal_force_, b.normal_force_)
+                && same(a.shear_force_, b.shear_force_) && same(a.normal_disp_, b.normal_disp_)
+                && same(a.shear_disp_, b.shear_disp_) && same(a.normal_force_inc_, b.normal_force_inc_)
+                && same(a.shear_force_inc_, b.shear_force_inc_) && same(a.dnop_, b.dnop_)
+                && same(a.working_, b.working_) && same(a.iworking_, b.iworking_);
+            if (equal) {
+                std::ostringstream sa, sb;
+                models_[i]->save(sa);
+                other.models_[i]->save(sb);
+                equal = sa.str() == sb.str();
+            }
+            if (!equal) ++n;
+        }
+        return n;
+    }
+
+    // Distance between two doubles in representable values, +0 and -0 being one.
+    static uint64 ulpDistance(double a, double b)
+    {
+        auto ordered = [](double d) {
+            int64 i;
+            std::memcpy(&i, &d, sizeof(i));
+            return i < 0 ? std::numeric_limits<int64>::min() - i : i;
+        };
+        if (std::isnan(a) || std::isnan(b))
+            return std::isnan(a) && std::isnan(b) ? 0 : std::numeric_limits<uint64>::max();
+        int64 ia = ordered(a), ib = ordered(b);
+        return ia > ib ? static_cast<uint64>(ia) - static_cast<uint64>(ib)
+                       : static_cast<uint64>(ib) - static_cast<uint64>(ia);
+    }
+
+    uint64 ContactSet::maxUlp(const ContactSet& other) const
+    {
+        if (other.size() != size())
+            throw std::runtime_error("maxUlp() needs two sets of the same size.");
+        uint64 worst = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            const MockState& a = states_[i];
+            const MockState& b = other.states_[i];
+            worst = std::max(worst, ulpDistance(a.normal_force_, b.normal_force_));
+            for (uint32 d = 0; d < 3; ++d)
+                worst = std::max(worst, ulpDistance(a.shear_force_[d], b.shear_force_[d]));
+        }
+        return worst;
+    }
+
+    // Mean, rms, median, 99th percentile and largest of \a v (sorted on return).
+    static Divergence::Stat summarize(std::vector<std::pair<double, size_t>>& v)
+    {
+        Divergence::Stat r;
+        if (v.empty()) return r;
+        double sum = 0.0, sq = 0.0;
+        for (const auto& d : v) {
+            sum += d.first;
+            sq += d.first * d.first;
+        }
+        std::sort(v.begin(), v.end());
+        const double n = static_cast<double>(v.size());
+        r.mean_ = sum / n;
+        r.rms_ = std::sqrt(sq / n);
+        r.p50_ = v[(v.size() - 1) / 2].first;
+        r.p99_ = v[static_cast<size_t>(0.99 * (v.size() - 1))].first;
+        r.max_ = v.back().first;
+        r.worst_ = v.back().second;
+        return r;
+    }
+
+    Divergence ContactSet::divergence(const ContactSet& other) const
+    {
+        if (other.size() != size())
+            throw std::runtime_error("divergence() needs two sets of the same size.");
+        Divergence r;
+        if (!size()) return r;
+        const char* names[3] = { "dt", "ds", "dc" };
+        uint32 mine[3], theirs[3];
+        for (uint32 k = 0; k < 3; ++k) {
+            mine[k] = propertyIndex(models_[0], names[k]);
+            theirs[k] = propertyIndex(other.models_[0], names[k]);
+        }
+        auto damage = [](const jmodels::JointModel* m, uint32 index) {
+            return index ? m->getProperty(index).to<double>() : 0.0;
+        };
+        std::vector<std::pair<double, size_t>> force, dmg[3];
+        force.reserve(size());
+        for (auto& d : dmg)
+            d.reserve(size());
+        for (size_t i = 0; i < size(); ++i) {
+            const MockState& a = states_[i];
+            const MockState& b = other.states_[i];
+            const double fa = std::sqrt(a.normal_force_ * a.normal_force_ + a.shear_force_.mag2());
+            const double fb = std::sqrt(b.normal_force_ * b.normal_force_ + b.shear_force_.mag2());
+            const double dn = a.normal_force_ - b.normal_force_;
+            const double df = std::sqrt(dn * dn + (a.shear_force_ - b.shear_force_).mag2());
+            const double scale = std::max(fa, fb);
+            force.emplace_back(scale > 0.0 ? df / scale : 0.0, i);
+            bool same = a.state_ == b.state_ && a.normal_force_ == b.normal_force_ && a.shear_force_ == b.shear_force_;
+            for (uint32 k = 0; k < 3; ++k) {
+                const double da = damage(models_[i], mine[k]);
+                const double db = damage(other.models_[i], theirs[k]);
+                dmg[k].emplace_back(std::abs(da - db), i);
+                same = same && da == db;
+            }
+            if (same) ++r.identical_;
+        }
+        r.force_ = summarize(force);
+        r.dt_ = summarize(dmg[0]);
+        r.ds_ = summarize(dmg[1]);
+        r.dc_ = summarize(dmg[2]);
+        return r;
+    }
+
+    size_t ContactSet::traceMismatches(const string& path, size_t records) const
+    {
+        using jmodels::YopiTraceColumn;
+        jmodels::YopiTraceFile f(path);
+        if (!size()) return 0;
+        const std::pair<YopiTraceColumn, const char*> props[] = {
+            { YopiTraceColumn::Dt, "dt" },
+            { YopiTraceColumn::Ds, "ds" },
+            { YopiTraceColumn::Dc, "dc" },
+            { YopiTraceColumn::Dts, "d_ts" },
+            { YopiTraceColumn::PeakNormal, "peak_normal" },
+            { YopiTraceColumn::ReloadFlag, "reloadFlag" },
+        };
+        uint32 index[6];
+        for (uint32 k = 0; k < 6; ++k)
+            index[k] = propertyIndex(models_[0], props[k].second);
+        size_t bad = 0;
+        for (uint64 j = 0; j < f.slots(); ++j) {
+            const double tag = f.tag(j);
+            const size_t i = static_cast<size_t>(tag) - 1;
+            const uint64 n = f.records(j);
+            if (tag < 1.0 || i >= size() || n != records || !n) {
+                ++bad;
+                continue;
+            }
+            const MockState& s = states_[i];
+            auto at = [&](YopiTraceColumn c) { return f.value(j, n - 1, c); };
+            bool same = at(YopiTraceColumn::Un) == s.normal_disp_ && at(YopiTraceColumn::Us) == s.shear_disp_.mag()
+                        && at(YopiTraceColumn::Fn) == s.normal_force_ && at(YopiTraceColumn::Fs) == s.shear_force_.mag()
+                        && f.state(j, n - 1) == s.state_;
+            for (uint32 k = 0; k < 6; ++k)
+                same = same && index[k] && at(props[k].first) == models_[i]->getProperty(index[k]).to<double>();
+            if (!same) ++bad;
+        }
+        return bad;
+    }
+
+    size_t ContactSet::snapshotMismatches(const string& path) const
+    {
+        using jmodels::YopiSnapshotField;
+        jmodels::YopiSnapshotFile f(path);
+        if (!size()) return 0;
+        if (!f.frames()) return size();
+        const jmodels::YopiSnapshotFile::Field last = f.load(f.frames() - 1);
+        uint32 index[jmodels::kYopiSnapshotFields];
+        for (uint32 k = 0; k < jmodels::kYopiSnapshotFields; ++k)
+            index[k] = propertyIndex(models_[0], jmodels::yopiSnapshotFieldName(static_cast<YopiSnapshotField>(k)));
+        size_t bad = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            auto it = last.find(i + 1);
+            if (it == last.end()) {
+                ++bad;
+                continue;
+            }
+            for (uint32 k = 0; k < jmodels::kYopiSnapshotFields; ++k) {
+                const double tol = k < static_cast<uint32>(YopiSnapshotField::TP) ? f.options().damageTolerance_
+                                                                                   : f.options().displacementTolerance_;
+                if (!index[k] || !(std::abs(it->second[k] - models_[i]->getProperty(index[k]).to<double>()) <= tol)) {
+                    ++bad;
+                    break;
+                }
+            }
+        }
+        return bad;
+    }
+} // namespace driver
+
+// EOF
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "jointmodel.h"
+#include "jmodelyopisimd.h"
+#include "loadpath.h"
+#include "mockstate.h"
+
+/**
+* \file
+* \brief A population of subcontacts, each with its own model instance and State,
+*        cycled the way 3DEC cycles them.
+*/
+
+namespace driver
+{
+    // Sets a property by any of the names/synonyms reported by getProperties().
+    // Returns false if the name is unknown to the model.
+    bool   setPropertyByName(jmodels::JointModel* m, const string& name, const base::Property& p);
+    // The property of that name as a number, 0 if the name is unknown.
+    double getPropertyByName(const jmodels::JointModel* m, const string& name);
+    // Masonry joint defaults (N, m): kn 5e10, fc 10 MPa, ft 0.2 MPa, c 0.3 MPa, phi 35.
+    void   setDefaultMaterial(jmodels::JointModel* m);
+
+    // Spread of the differences between the contacts of two sets, over the
+    // contacts, see ContactSet::divergence().
+    struct Divergence {
+        struct Stat {
+            double mean_ = 0.0;
+            double rms_ = 0.0;
+            double p50_ = 0.0;
+            double p99_ = 0.0;
+            double max_ = 0.0;
+            size_t worst_ = 0; // contact of max_
+        };
+        Stat   force_;        // |F - F'| / max(|F|, |F'|), F the normal and shear force (0 if both are 0)
+        Stat   dt_, ds_, dc_; // |d - d'| of the damages
+        size_t identical_ = 0; // contacts with equal forces, state bits and damages
+    };
+
+    class ContactSet {
+    public:
+        // Every contact is a clone of \a proto, the way 3DEC installs a model in a
+        // new subcontact. Contact i replays the path scaled by scale(i), so the
+        // population spreads across the branches of the law.
+        ContactSet(const jmodels::JointModel* proto, size_t count, const TableStore* tables,
+                   bool trackEnergy, double area);
+        ~ContactSet();
+        ContactSet(const ContactSet&) = delete;
+        ContactSet& operator=(const ContactSet&) = delete;
+
+        size_t                size() const { return models_.size(); }
+        jmodels::JointModel*  model(size_t i) { return models_[i]; }
+        MockState&            state(size_t i) { return states_[i]; }
+        double                scale(size_t i) const { return scale_[i]; }
+
+        // One cycle: accumulate the displacement increment, then call run().
+        void                  step(const LoadStep& st, size_t begin, size_t end);
+        // Replays the whole path, cycle by cycle over all contacts.
+        void                  replay(const LoadPath& path);
+        // Same as replay(), on \a threads threads. Blocks of \a block contacts are
+        // dealt to the threads in turn, and each thread runs its blocks through
+        // the whole path; contacts do not interact, so the result must be the
+        // same as replay() bit for bit.
+        void                  replayThreaded(const LoadPath& path, uint32 threads, size_t block = 16);
+        // Same as replay(), through JModelYopi::runBatch() on a structure-of-arrays
+        // copy of the contacts, \a block contacts at a time. The models and States
+        // are brought up to date at the end. All contacts must be JModelYopi.
+        // \a simd selects the vectorised compression branch (non-strict mode).
+        void                  replayBatch(const LoadPath& path, size_t block = 4096,
+                                          jmodels::YopiSimd simd = jmodels::YopiSimd::None);
+        // Calls initialize() on every contact, as 3DEC does after a large-strain
+        // update or a property change.
+        void                  reinitialize();
+        // Saves every model (JointModel::save()) to \a o, in contact order.
+        void                  save(std::ostream& o) const;
+        // The save() block of every model, in contact order.
+        std::vector<string>   saveBlocks() const;
+        // Number of contacts whose save() block is not the one of \a blocks.
+        size_t                blockDifferences(const std::vector<string>& blocks) const;
+        // Replaces every model by a fresh clone restored from \a i, the way 3DEC
+        // restores a save file written by a model of minor version \a restoreVersion:
+        // the properties are then set back with that version, from the models
+        // replaced (3DEC has them in the file).
+        void                  restore(std::istream& i, uint32 restoreVersion);
+        // FNV-1a hash over final forces, state bits and damage of every contact.
+        uint64                checksum() const;
+        // Number of contacts whose State or save() block differs in any bit from
+        // that of the same contact of \a other.
+        size_t                differences(const ContactSet& other) const;
+        // Largest difference in ulp between the forces of this set and \a other.
+        uint64                maxUlp(const ContactSet& other) const;
+        // How far the forces and damages (dt, ds, dc, read by name from each
+        // set's own models) of \a other are from those of this set, contact by
+        // contact. The models may be of different variants (variants.h).
+        Divergence            divergence(const ContactSet& other) const;
+        // Number of contacts traced into the closed trace file \a path
+        // (jmodelyopitrace.h, the trace tag the contact index + 1) that do
+        // not have \a records records, or whose last record is not the State and
+        // history they end with.
+        size_t                traceMismatches(const string& path, size_t records) const;
+        // Number of contacts (contact-id the contact index + 1) whose values in
+        // the last frame of the snapshot file \a path (jmodelyopisnapshot.h)
+        // are further than its tolerance from the history they end with.
+        size_t                snapshotMismatches(const string& path) const;
+    private:
+        std::vector<jmodels::JointModel*> models_;
+        std::vector<MockState>            states_;
+        std::vector<double>               scale_;
+        const TableStore*                 tables_;
+        bool                              trackEnergy_;
+    };
+} // namespace driver
+
+// EOF
@@ -0,0 +1,621 @@
+// Headless driver for the Yopi joint model.
+//
+// Runs JModelYopi::run() outside of 3DEC: every contact gets its own model
+// instance and an in-memory State (mockstate.h), and a prescribed displacement
+// history is replayed through all of them, one cycle at a time, the way 3DEC
+// cycles subcontacts. Reports the cost per contact-step and a checksum of the
+// final state.
+//
+// Built with yopibench by CMakeLists.txt, against the PluginFiles folder of the
+// 3DEC installation; ctest runs the self-checks below.
+//
+// Usage:
+//   yopidriver [--contacts N] [--path cyclic|FILE] [--unmax U] [--cycles C]
+//              [--steps-per-cycle S] [--usmax U] [--area A] [--energy] [--stiffness]
+//              [--closing N] [--checkpoint] [--alloc] [--reinit N] [--threads T]
+//              [--variant KEY] [--shadow KEY] [--batch BLOCK] [--simd auto|none|avx2|avx512]
+//              [--profile FILE] [--profile-time] [--sample N] [--trace FILE] [--trace-every K]
+//              [--snapshot FILE] [--snapshot-every C] [--snapshot-tol D] [--crack DT,DS,DC]
+//              [--prop name=value]... [--table id=FILE]...
+//
+// --batch runs the contacts through JModelYopi::runBatch() in blocks of BLOCK
+// contacts instead of one run() call per contact; the checksum is the same.
+// --simd (with --batch) evaluates the compression branch with the vectorised
+// kernel of jmodelyopisimd.h; the forces may then differ from run() within
+// kYopiSimdUlpBound ulp per step.
+// --energy turns energy tracking on, and reports the energies summed over all
+// contacts (YopiEnergyPool::total()) and the time of the sum; with --threads
+// the sum is split over T threads too, and checked bit for bit against the
+// sum on one thread.
+// --stiffness reports the smallest and the mean stiffnesses the contacts give
+// 3DEC for mass and timestep scaling (getMaxNormalStiffness() and
+// getMaxShearStiffness()), see the stiffness-damaged property.
+// --closing N opens every contact of a fresh set by U (--unmax) in N steps, so
+// that it fails in tension, and closes it by 2 U in 2 N steps, shearing it by
+// twice the normal step each step. Every
+// step is checked against the stiffnesses the contact reported before it: with
+// masses scaled on those, the explicit step stays stable as long as the step
+// is no stiffer than 4 times them (normal, and shear where the shear force
+// followed the shear displacement). It reports the largest ratio, and fails
+// (exit code 2) past 4.
+// --checkpoint saves every contact at the end of the replay (JointModel::save())
+// and restores it into a fresh model, reporting size and time of both; the
+// checksum is then taken on the restored contacts. It fails (exit code 2) if
+// a restored contact does not save the block it was restored from.
+// --threads T replays the path on T threads (ContactSet::replayThreaded()) and
+// checks the result against a replay on one thread, bit for bit: the State and
+// the save() block of every contact. It fails (exit code 2) on any difference.
+// --reinit N calls initialize() on every contact N times after the replay, as
+// a large-strain update does, and reports the mean time of one pass; the
+// first pass follows a JModelYopi::tablesChanged() notice. It fails (exit
+// code 2) if the passes change the save() block of a contact. It then runs
+// two cycles of no displacement, every other contact made invalid before the
+// second, so those initialize lazily in run() between valid ones as after a
+// property change on a subset; it fails (exit code 2) if that does the
+// material part of initialize() more than once per material.
+// --variant runs the copy of the law of key KEY (variants.h): current (the
+// default), tud1006027, tud1006027-2 or yoktiovan.
+// --shadow KEY runs a second variant alongside, on its own copy of every
+// contact: both see the same displacement stream, cycle by cycle. It reports
+// the time per contact-step of each, and how far the forces and the damages of
+// the two sets are apart at the end (mean, rms, median, 99th percentile and
+// largest over the contacts). The checksum is that of --variant.
+// --alloc reports the model allocations of jmodelyopislab.h at the end: how
+// many, the share served from the cache of the thread, and the slabs behind them.
+// --profile writes the branch counters of jmodelyopiprofile.h for the replay to
+// FILE; --profile-time adds the time per call to them, --sample N the latency
+// histograms of one call in N.
+// --trace records the time history of every K-th contact (--trace-every, 1 by
+// default) into the trace file FILE of jmodelyopitrace.h, tagged with the
+// contact index + 1. It reports the file and the time to close it, then reads
+// the file back and checks that every traced contact has a record per step
+// and that the last one is the state the contact ends with (exit code 2 if
+// not). Not with --batch, whose runBatch() records no trace.
+// --snapshot gives every contact its index + 1 as contact-id and writes damage
+// snapshots of jmodelyopisnapshot.h to FILE, one every C steps (--snapshot-every,
+// 50 by default; the last at the last step), with D the damage tolerance
+// (--snapshot-tol). It reports the frames, the bytes written against a full
+// dump each time, and checks the last frame against the contacts (exit code
+// 2 if one is off by more than the tolerance). Scalar mode, one thread.
+// --crack builds the crack network of jmodelyopicrack.h with those thresholds.
+// Contact i gets contact-id i + 1, host-id i / 4 + 1 and vertex-id (i + 2) / 4 + 1:
+// four subcontacts per contact, in a chain of contacts that share a vertex
+// pairwise. The network is queried after every step, and its time reported;
+// at the end it is checked against clusters built from scratch from the
+// final damages (exit code 2 on a difference). Scalar mode, one thread.
+
+#include "contactset.h"
+#include "jmodelyopicrack.h"
+#include "jmodelyopi.h"
+#include "jmodelyopiprofile.h"
+#include "jmodelyopisnapshot.h"
+#include "jmodelyopitrace.h"
+#include "variants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <utility>
+
+namespace
+{
+    void usage()
+    {
+        std::printf("usage: yopidriver [--contacts N] [--path cyclic|FILE] [--unmax U] [--cycles C]\n"
+                    "                  [--steps-per-cycle S] [--usmax U] [--area A] [--energy] [--stiffness]\n"
+                    "                  [--closing N] [--checkpoint] [--alloc] [--reinit N] [--threads T]\n"
+                    "                  [--variant KEY] [--shadow KEY] [--batch BLOCK] [--simd auto|none|avx2|avx512]\n"
+                    "                  [--profile FILE] [--profile-time] [--sample N] [--trace FILE] [--trace-every K]\n"
+                    "                  [--snapshot FILE] [--snapshot-every C] [--snapshot-tol D] [--crack DT,DS,DC]\n"
+                    "                  [--prop name=value]... [--table id=FILE]...\n");
+    }
+
+    std::pair<string, string> splitAssign(const char* arg)
+    {
+        const char* eq = std::strchr(arg, '=');
+        if (!eq) throw std::runtime_error(string("Expected name=value, got ") + arg);
+        return { string(arg, eq), string(eq + 1) };
+    }
+
+    base::Property parseValue(const string& v)
+    {
+        char* end = nullptr;
+        double d = std::strtod(v.c_str(), &end);
+        if (end && *end == 0 && end != v.c_str()) return d;
+        return v;
+    }
+
+    struct Destroy {
+        void operator()(jmodels::JointModel* m) const { m->destroy(); }
+    };
+    typedef std::unique_ptr<jmodels::JointModel, Destroy> ModelPtr;
+
+    // Builds the clusters of --crack again from the final damages, and
+    // compares them with \a stats and the cluster of every contact
+    // (jmodels::yopiCrackCluster()).
+    // Damages only grow, so a contact past a threshold now crossed it in the
+    // run. Number of differences.
+    size_t crackMismatches(driver::ContactSet& set, const jmodels::YopiCrackThresholds& t,
+                           const jmodels::YopiCrackStats& stats)
+    {
+        const size_t n = set.size();
+        std::vector<size_t> parent(n);
+        std::vector<bool> in(n);
+        for (size_t i = 0; i < n; ++i) {
+            parent[i] = i;
+            const jmodels::JointModel* m = set.model(i);
+            in[i] = driver::getPropertyByName(m, "dt") >= t.dt_ || driver::getPropertyByName(m, "ds") >= t.ds_
+                    || driver::getPropertyByName(m, "dc") >= t.dc_;
+        }
+        auto find = [&](size_t i) {
+            while (parent[i] != i) i = parent[i] = parent[parent[i]];
+            return i;
+        };
+        // Links of the ids of --crack: same host (i / 4), same vertex ((i + 2) / 4).
+        std::vector<size_t> host(n / 4 + 1, n), vertex(n / 4 + 2, n);
+        for (size_t i = 0; i < n; ++i) {
+            if (!in[i]) continue;
+            for (size_t* first : { &host[i / 4], &vertex[(i + 2) / 4] }) {
+                if (*first == n) *first = i;
+                else {
+                    size_t a = find(i), b = find(*first);
+                    if (a != b) parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+        std::vector<uint64> count(n);
+        uint64 contacts = 0, clusters = 0, largest = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (in[i]) {
+                ++contacts;
+                if (find(i) == i) ++clusters;
+                largest = std::max(largest, ++count[find(i)]);
+            }
+        size_t bad = (contacts != stats.contacts_) + (clusters != stats.clusters_) + (largest != stats.largest_);
+        for (size_t i = 0; i < n; ++i) {
+            const uint64 cluster = jmodels::yopiCrackCluster(i + 1);
+            if (cluster != (in[i] ? find(i) + 1 : 0)) ++bad;
+        }
+        return bad;
+    }
+
+    // Largest ratio of the stiffness of a step to the one reported before it.
+    struct ClosingRatio {
+        double normal_ = 0.0;
+        double shear_ = 0.0;
+        size_t contact_ = 0; // of the largest of both
+    };
+
+    // The steps of --closing, one contact at a time.
+    ClosingRatio closingCheck(driver::ContactSet& set, double open, uint32 n)
+    {
+        driver::LoadPath path("closing");
+        path.ramp(-open, DVect3(open, 0.0, 0.0), n);
+        path.ramp(2.0 * open, DVect3(0.5 * open, 0.0, 0.0), 2 * n);
+        ClosingRatio r;
+        for (size_t i = 0; i < set.size(); ++i) {
+            const jmodels::JointModel* m = set.model(i);
+            const driver::MockState& s = set.state(i);
+            for (const auto& st : path.steps()) {
+                const double kn = m->getMaxNormalStiffness(), ks = m->getMaxShearStiffness();
+                const double fn = s.normal_force_;
+                const DVect3 fs = s.shear_force_;
+                set.step(st, i, i + 1);
+                double rn = 0.0, rs = 0.0;
+                if (s.normal_disp_inc_ != 0.0)
+                    rn = std::abs(s.normal_force_ - fn) / (s.area_ * std::abs(s.normal_disp_inc_) * kn);
+                // Sliding, the shear force follows the normal force instead.
+                const DVect3 dfs = s.shear_force_ - fs;
+                if (!(s.state_ & 0x01) && s.shear_disp_inc_.mag() > 0.0)
+                    rs = dfs.mag() / (s.area_ * s.shear_disp_inc_.mag() * ks);
+                if (std::max(rn, rs) > std::max(r.normal_, r.shear_)) r.contact_ = i;
+                r.normal_ = std::max(r.normal_, rn);
+                r.shear_ = std::max(r.shear_, rs);
+            }
+        }
+        return r;
+    }
+
+    void printStat(const char* name, const driver::Divergence::Stat& d)
+    {
+        std::printf("%-15s mean %.3e rms %.3e p50 %.3e p99 %.3e max %.3e (contact %zu)\n", name, d.mean_, d.rms_,
+                    d.p50_, d.p99_, d.max_, d.worst_);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        size_t contacts = 100000;
+        string pathName = "cyclic";
+        double unmax = 5e-4;
+        double usmax = 2e-4;
+        uint32 cycles = 5;
+        uint32 stepsPerCycle = 200;
+        double area = 1.0;
+        bool energy = false;
+        bool stiffness = false;
+        uint32 closing = 0;
+        bool checkpoint = false;
+        bool alloc = false;
+        uint32 reinit = 0;
+        uint32 threads = 1;
+        string variant = "current";
+        string shadow;
+        size_t batch = 0;
+        jmodels::YopiSimd simd = jmodels::YopiSimd::None;
+        string profile;
+        bool profileTime = false;
+        uint32 sample = 0;
+        string trace;
+        size_t traceEvery = 1;
+        string snapshot;
+        size_t snapshotEvery = 50;
+        jmodels::YopiSnapshotOptions snapshotOptions;
+        bool crack = false;
+        jmodels::YopiCrackThresholds crackLimits;
+        std::vector<std::pair<string, string>> props;
+        driver::TableStore tables;
+
+        for (int i = 1; i < argc; ++i) {
+            string a = argv[i];
+            auto next = [&]() -> const char* {
+                if (i + 1 >= argc) throw std::runtime_error("Missing value for " + a);
+                return argv[++i];
+            };
+            if (a == "--contacts") contacts = std::strtoull(next(), nullptr, 10);
+            else if (a == "--path") pathName = next();
+            else if (a == "--unmax") unmax = std::atof(next());
+            else if (a == "--usmax") usmax = std::atof(next());
+            else if (a == "--cycles") cycles = static_cast<uint32>(std::atoi(next()));
+            else if (a == "--steps-per-cycle") stepsPerCycle = static_cast<uint32>(std::atoi(next()));
+            else if (a == "--area") area = std::atof(next());
+            else if (a == "--energy") energy = true;
+            else if (a == "--stiffness") stiffness = true;
+            else if (a == "--closing") closing = static_cast<uint32>(std::atoi(next()));
+            else if (a == "--checkpoint") checkpoint = true;
+            else if (a == "--alloc") alloc = true;
+            else if (a == "--threads") threads = static_cast<uint32>(std::atoi(next()));
+            else if (a == "--variant") variant = next();
+            else if (a == "--shadow") shadow = next();
+            else if (a == "--reinit") reinit = static_cast<uint32>(std::atoi(next()));
+            else if (a == "--batch") batch = std::strtoull(next(), nullptr, 10);
+            else if (a == "--simd") simd = jmodels::yopiSimdFromName(next());
+            else if (a == "--profile") profile = next();
+            else if (a == "--profile-time") profileTime = true;
+            else if (a == "--sample") sample = static_cast<uint32>(std::atoi(next()));
+            else if (a == "--trace") trace = next();
+            else if (a == "--trace-every") traceEvery = std::strtoull(next(), nullptr, 10);
+            else if (a == "--snapshot") snapshot = next();
+            else if (a == "--snapshot-every") snapshotEvery = std::strtoull(next(), nullptr, 10);
+            else if (a == "--snapshot-tol") snapshotOptions.damageTolerance_ = std::atof(next());
+            else if (a == "--crack") {
+                const char* v = next();
+                if (std::sscanf(v, "%lf,%lf,%lf", &crackLimits.dt_, &crackLimits.ds_, &crackLimits.dc_) != 3)
+                    throw std::runtime_error(string("Expected --crack DT,DS,DC, got ") + v);
+                crack = true;
+            }
+            else if (a == "--prop") props.push_back(splitAssign(next()));
+            else if (a == "--table") {
+                auto t = splitAssign(next());
+                if (!tables.load(t.first, t.second))
+                    throw std::runtime_error("Unable to read table " + t.second);
+            }
+            else {
+                usage();
+                return a == "--help" ? 0 : 1;
+            }
+        }
+
+        driver::LoadPath path = pathName == "cyclic"
+            ? driver::LoadPath::cyclicCompression(unmax, cycles, stepsPerCycle, usmax)
+            : driver::LoadPath::fromFile(pathName);
+
+        auto makeProto = [&](const string& key) {
+            ModelPtr m(driver::findVariant(key).create_());
+            driver::setDefaultMaterial(m.get());
+            for (auto& p : props)
+                if (!driver::setPropertyByName(m.get(), p.first, parseValue(p.second)))
+                    throw std::runtime_error("Unknown property " + p.first + " of variant " + key);
+            return m;
+        };
+        ModelPtr proto = makeProto(variant);
+        ModelPtr shadowProto = shadow.empty() ? ModelPtr() : makeProto(shadow);
+
+        if (threads > 1 && batch)
+            throw std::runtime_error("--threads runs run(), not --batch.");
+        if (shadowProto && (batch || threads > 1))
+            throw std::runtime_error("--shadow runs run() on one thread, not --batch nor --threads.");
+        if (!trace.empty() && (batch || !traceEvery))
+            throw std::runtime_error("--trace runs run(), not --batch, on every K >= 1 contacts.");
+        if (!snapshot.empty() && (batch || threads > 1 || shadowProto || !snapshotEvery))
+            throw std::runtime_error("--snapshot runs run() on one thread, every C >= 1 steps.");
+        if (crack && (batch || threads > 1 || shadowProto))
+            throw std::runtime_error("--crack runs run() on one thread.");
+        // The one-thread reference, before counting starts.
+        std::unique_ptr<driver::ContactSet> reference;
+        if (threads > 1) {
+            reference.reset(new driver::ContactSet(proto.get(), contacts, &tables, energy, area));
+            reference->replay(path);
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        driver::ContactSet set(proto.get(), contacts, &tables, energy, area);
+        std::unique_ptr<driver::ContactSet> shadowSet;
+        if (shadowProto)
+            shadowSet.reset(new driver::ContactSet(shadowProto.get(), contacts, &tables, energy, area));
+        jmodels::yopiProfileReset();
+        if ((profileTime || sample) && profile.empty())
+            throw std::runtime_error("--profile-time and --sample need --profile.");
+        jmodels::yopiProfileCounting(!profile.empty());
+        jmodels::yopiProfileTiming(profileTime);
+        jmodels::yopiProfileSampling(sample);
+        if (!trace.empty()) {
+            jmodels::yopiTraceOpen(trace, (set.size() + traceEvery - 1) / traceEvery);
+            for (size_t i = 0; i < set.size(); i += traceEvery)
+                if (yopiSetTraceTag(set.model(i), static_cast<double>(i + 1)))
+                    throw std::runtime_error("Variant " + variant + " has no trace tag.");
+        }
+        if (!snapshot.empty()) {
+            jmodels::yopiSnapshotOpen(snapshot, snapshotOptions);
+            for (size_t i = 0; i < set.size(); ++i)
+                if (yopiSetContactId(set.model(i), i + 1))
+                    throw std::runtime_error("Variant " + variant + " has no contact-id.");
+        }
+        if (crack) {
+            jmodels::yopiCrackEnable(crackLimits);
+            for (size_t i = 0; i < set.size(); ++i)
+                if (yopiSetContactId(set.model(i), i + 1) || yopiSetCrackLinks(set.model(i), i / 4 + 1, 0, (i + 2) / 4 + 1))
+                    throw std::runtime_error("Variant " + variant + " has no crack links.");
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        if (simd != jmodels::YopiSimd::None && !batch)
+            throw std::runtime_error("--simd needs --batch.");
+        double shadowElapsed = 0.0;
+        jmodels::YopiCrackStats crackStats;
+        double crackQuery = 0.0;
+        uint64 crackTakenMax = 0;
+        if (batch) set.replayBatch(path, batch, simd);
+        else if (shadowSet) {
+            for (const auto& st : path.steps()) {
+                auto s0 = std::chrono::steady_clock::now();
+                shadowSet->step(st, 0, shadowSet->size());
+                shadowElapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - s0).count();
+                set.step(st, 0, set.size());
+            }
+        }
+        else if (!snapshot.empty() || crack) {
+            const auto& steps = path.steps();
+            for (size_t k = 0; k < steps.size(); ++k) {
+                if (!snapshot.empty() && (steps.size() - 1 - k) % snapshotEvery == 0)
+                    jmodels::yopiSnapshotTake(static_cast<double>(k));
+                set.step(steps[k], 0, set.size());
+                if (crack) {
+                    auto q0 = std::chrono::steady_clock::now();
+                    crackStats = jmodels::yopiCrackStats();
+                    crackQuery += std::chrono::duration<double>(std::chrono::steady_clock::now() - q0).count();
+                    crackTakenMax = std::max(crackTakenMax, crackStats.taken_);
+                }
+            }
+        }
+        else set.replayThreaded(path, threads);
+        auto t2 = std::chrono::steady_clock::now();
+        size_t differ = 0;
+        if (reference) {
+            differ = set.differences(*reference);
+            reference.reset(); // its energies would count in the totals
+        }
+        jmodels::YopiTraceStats traceStats;
+        double traceClose = 0.0;
+        size_t traceBad = 0;
+        if (!trace.empty()) {
+            traceStats = jmodels::yopiTraceStats();
+            auto c0 = std::chrono::steady_clock::now();
+            jmodels::yopiTraceClose();
+            traceClose = std::chrono::duration<double>(std::chrono::steady_clock::now() - c0).count();
+            traceBad = set.traceMismatches(trace, path.size());
+            differ += traceBad;
+        }
+        jmodels::YopiSnapshotStats snapshotStats;
+        size_t snapshotBad = 0;
+        if (!snapshot.empty()) {
+            jmodels::yopiSnapshotClose();
+            snapshotStats = jmodels::yopiSnapshotStats();
+            snapshotBad = set.snapshotMismatches(snapshot);
+            differ += snapshotBad;
+        }
+        size_t crackBad = 0;
+        if (crack) {
+            jmodels::yopiCrackDisable();
+            crackBad = crackMismatches(set, crackLimits, crackStats);
+            differ += crackBad;
+        }
+        driver::Divergence divergence;
+        if (shadowSet) {
+            divergence = set.divergence(*shadowSet);
+            shadowSet.reset();
+        }
+
+        double setup = std::chrono::duration<double>(t1 - t0).count();
+        double elapsed = std::chrono::duration<double>(t2 - t1).count() - shadowElapsed;
+        double contactSteps = static_cast<double>(set.size()) * path.size();
+        auto nsPerStep = [&](double t) { return contactSteps > 0.0 ? t * 1e9 / contactSteps : 0.0; };
+        std::printf("path            %s\n", path.name().c_str());
+        std::printf("variant         %s (%s)\n", variant.c_str(), driver::findVariant(variant).source_);
+        std::printf("mode            %s\n", !batch ? "scalar" : simd == jmodels::YopiSimd::None ? "batch" : "batch-simd");
+        if (simd != jmodels::YopiSimd::None)
+            std::printf("simd            %s\n", jmodels::yopiSimdName(simd));
+        if (threads > 1)
+            std::printf("threads         %u, %zu contacts differ from one thread\n", threads, differ);
+        std::printf("contacts        %zu\n", set.size());
+        std::printf("materials       %zu\n", jmodels::YopiMaterial::internedCount());
+        std::printf("steps           %zu\n", path.size());
+        std::printf("setup (s)       %.3f\n", setup);
+        std::printf("elapsed (s)     %.3f\n", elapsed);
+        std::printf("ns/contact-step %.2f\n", nsPerStep(elapsed));
+        if (shadowProto) {
+            std::printf("shadow          %s (%s)\n", shadow.c_str(), driver::findVariant(shadow).source_);
+            std::printf("shadow ns/c-s   %.2f, %.2fx the variant\n", nsPerStep(shadowElapsed),
+                        elapsed > 0.0 ? shadowElapsed / elapsed : 0.0);
+            printStat("force diff", divergence.force_);
+            printStat("dt diff", divergence.dt_);
+            printStat("ds diff", divergence.ds_);
+            printStat("dc diff", divergence.dc_);
+            std::printf("identical       %zu/%zu contacts\n", divergence.identical_, set.size());
+        }
+        if (!trace.empty()) {
+            std::printf("trace           %s, %llu contacts, %llu records, %.3f MB\n", trace.c_str(),
+                        static_cast<unsigned long long>(traceStats.slots_),
+                        static_cast<unsigned long long>(traceStats.records_),
+                        static_cast<double>(traceStats.bytes_) / (1 << 20));
+            std::printf("trace windows   %llu (%llu flushed ahead, %llu stalls, %llu dropped)\n",
+                        static_cast<unsigned long long>(traceStats.windows_),
+                        static_cast<unsigned long long>(traceStats.flushes_),
+                        static_cast<unsigned long long>(traceStats.stalls_),
+                        static_cast<unsigned long long>(traceStats.dropped_ + traceStats.refused_));
+            std::printf("trace close (s) %.3f\n", traceClose);
+            std::printf("trace check     %zu/%llu contacts match\n",
+                        static_cast<size_t>(traceStats.slots_) - traceBad,
+                        static_cast<unsigned long long>(traceStats.slots_));
+        }
+        if (!snapshot.empty()) {
+            auto mb = [](uint64 b) { return static_cast<double>(b) / (1 << 20); };
+            std::printf("snapshots       %s, %llu frames (%llu keyframes), %llu contacts\n", snapshot.c_str(),
+                        static_cast<unsigned long long>(snapshotStats.frames_),
+                        static_cast<unsigned long long>(snapshotStats.keyframes_),
+                        static_cast<unsigned long long>(snapshotStats.contacts_));
+            std::printf("snapshot data   %.3f MB, %.1fx less than full dumps (%.3f MB), %llu of %llu records\n",
+                        mb(snapshotStats.bytes_),
+                        snapshotStats.bytes_ ? static_cast<double>(snapshotStats.fullBytes_) / snapshotStats.bytes_ : 0.0,
+                        mb(snapshotStats.fullBytes_), static_cast<unsigned long long>(snapshotStats.records_),
+                        static_cast<unsigned long long>(snapshotStats.submitted_));
+            std::printf("snapshot check  %zu/%zu contacts within tolerance\n", set.size() - snapshotBad, set.size());
+        }
+        if (crack) {
+            std::printf("crack           %llu contacts (%llu t, %llu s, %llu c), area %.6e\n",
+                        static_cast<unsigned long long>(crackStats.contacts_),
+                        static_cast<unsigned long long>(crackStats.tension_),
+                        static_cast<unsigned long long>(crackStats.shear_),
+                        static_cast<unsigned long long>(crackStats.compression_), crackStats.area_);
+            std::printf("crack clusters  %llu, largest %llu contacts, largest area %.6e\n",
+                        static_cast<unsigned long long>(crackStats.clusters_),
+                        static_cast<unsigned long long>(crackStats.largest_), crackStats.largestArea_);
+            std::printf("crack query     %.3f us per step, at most %llu crossings taken in one\n",
+                        path.size() ? crackQuery * 1e6 / path.size() : 0.0,
+                        static_cast<unsigned long long>(crackTakenMax));
+            std::printf("crack check     %s\n", crackBad ? "differs from clusters built from scratch"
+                                                          : "same as clusters built from scratch");
+        }
+        if (energy) {
+            const jmodels::YopiEnergyPool& pool = jmodels::YopiEnergyPool::instance();
+            auto e0 = std::chrono::steady_clock::now();
+            jmodels::YopiEnergies e = pool.total(threads);
+            auto e1 = std::chrono::steady_clock::now();
+            if (threads > 1) {
+                jmodels::YopiEnergies one = pool.total();
+                if (std::memcmp(&e, &one, sizeof(e))) {
+                    std::printf("energy          sum on %u threads differs from one thread\n", threads);
+                    ++differ;
+                }
+            }
+            std::printf("energy slots    %zu/%zu\n", pool.live(), pool.capacity());
+            std::printf("energy t/c/s    %.6e %.6e %.6e\n", e.etension_, e.ecompression_, e.eshear_);
+            std::printf("energy sum (ms) %.3f\n", std::chrono::duration<double, std::milli>(e1 - e0).count());
+        }
+        if (checkpoint) {
+            const std::vector<string> saved = set.saveBlocks();
+            std::stringstream data;
+            auto c0 = std::chrono::steady_clock::now();
+            set.save(data);
+            auto c1 = std::chrono::steady_clock::now();
+            set.restore(data, proto->getMinorVersion());
+            auto c2 = std::chrono::steady_clock::now();
+            const size_t bad = set.blockDifferences(saved);
+            differ += bad;
+            std::printf("checkpoint (MB) %.3f\n", static_cast<double>(data.str().size()) / (1 << 20));
+            std::printf("save (s)        %.3f\n", std::chrono::duration<double>(c1 - c0).count());
+            std::printf("restore (s)     %.3f\n", std::chrono::duration<double>(c2 - c1).count());
+            std::printf("restore check   %zu/%zu contacts save the block they were restored from\n",
+                        set.size() - bad, set.size());
+        }
+        if (reinit) {
+            const std::vector<string> saved = set.saveBlocks();
+            jmodels::JModelYopi::tablesChanged();
+            auto r0 = std::chrono::steady_clock::now();
+            for (uint32 i = 0; i < reinit; ++i)
+                set.reinitialize();
+            auto r1 = std::chrono::steady_clock::now();
+            const size_t bad = set.blockDifferences(saved);
+            differ += bad;
+            std::printf("reinit (s)      %.4f\n", std::chrono::duration<double>(r1 - r0).count() / reinit);
+            std::printf("reinit check    %zu/%zu contacts unchanged\n", set.size() - bad, set.size());
+
+            const driver::LoadStep still = { 0.0, DVect3(0.0, 0.0, 0.0) };
+            set.step(still, 0, set.size());
+            for (size_t i = 1; i < set.size(); i += 2)
+                set.model(i)->setValid(0);
+            const uint64 m0 = jmodels::JModelYopi::materialInitializations();
+            set.step(still, 0, set.size());
+            const uint64 lazy = jmodels::JModelYopi::materialInitializations() - m0;
+            const size_t materials = jmodels::YopiMaterial::internedCount();
+            if (lazy > materials) ++differ;
+            std::printf("reinit lazy     %llu material initializations for %zu contacts, %zu materials\n",
+                        static_cast<unsigned long long>(lazy), set.size() / 2, materials);
+        }
+        if (stiffness && set.size()) {
+            double knMin = 0.0, ksMin = 0.0, knSum = 0.0, ksSum = 0.0;
+            for (size_t i = 0; i < set.size(); ++i) {
+                double kn = set.model(i)->getMaxNormalStiffness();
+                double ks = set.model(i)->getMaxShearStiffness();
+                knMin = i ? std::min(knMin, kn) : kn;
+                ksMin = i ? std::min(ksMin, ks) : ks;
+                knSum += kn;
+                ksSum += ks;
+            }
+            double n = static_cast<double>(set.size());
+            std::printf("stiffness n     %.6e min %.6e mean\n", knMin, knSum / n);
+            std::printf("stiffness s     %.6e min %.6e mean\n", ksMin, ksSum / n);
+        }
+        if (closing && set.size()) {
+            driver::ContactSet fresh(proto.get(), set.size(), &tables, energy, area);
+            const ClosingRatio r = closingCheck(fresh, unmax, closing);
+            const bool stable = r.normal_ <= 4.0 && r.shear_ <= 4.0;
+            if (!stable) ++differ;
+            std::printf("closing check   step/reported stiffness at most %.3f n, %.3f s (contact %zu): %s\n",
+                        r.normal_, r.shear_, r.contact_, stable ? "stable" : "unstable");
+        }
+        if (alloc) {
+            if (!jmodels::yopiSlabEnabled())
+                std::fprintf(stderr, "yopidriver: built without YOPI_SLAB, no slab statistics\n");
+            jmodels::YopiSlabStats a = jmodels::yopiSlabStats();
+            double cached = a.allocations_ ? 100.0 * a.cached_ / a.allocations_ : 0.0;
+            std::printf("models live     %llu\n", static_cast<unsigned long long>(a.live()));
+            std::printf("models new/del  %llu %llu\n", static_cast<unsigned long long>(a.allocations_),
+                        static_cast<unsigned long long>(a.frees_));
+            std::printf("slab cached     %.2f%% (%llu refills, %llu spills)\n", cached,
+                        static_cast<unsigned long long>(a.refills_), static_cast<unsigned long long>(a.spills_));
+            std::printf("slabs           %llu (%llu models)\n", static_cast<unsigned long long>(a.slabs_),
+                        static_cast<unsigned long long>(a.blocks_));
+        }
+        std::printf("checksum        %016llx\n", static_cast<unsigned long long>(set.checksum()));
+        if (!profile.empty()) {
+            if (!jmodels::yopiProfileEnabled())
+                std::fprintf(stderr, "yopidriver: built with YOPI_NO_PROFILE, no branch counters\n");
+            if (!jmodels::yopiProfileDump(profile))
+                throw std::runtime_error("Unable to write " + profile);
+        }
+        if (differ) return 2;
+    }
+    catch (std::exception& e) {
+        std::fprintf(stderr, "yopidriver: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+// EOF
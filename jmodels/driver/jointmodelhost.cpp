@@ -0,0 +1,60 @@
+#include "jointmodel.h"
+#include "state.h"
+
+// Headless replacement for the parts of the jmodels library that 3DEC normally
+// provides: the JointModel base class and the State constructor. Link this
+// instead of jmodels###.lib when running a model outside of the host.
+
+namespace jmodels
+{
+    JointModel::JointModel() : valid_(0), can_fail_(true), plugin_(false)
+    {
+    }
+
+    JointModel::~JointModel()
+    {
+    }
+
+    uint32 JointModel::getMajorVersion() { return 9; }
+    uint32 JointModel::getLibraryMinorVersion() { return 0; }
+    uint32 JointModel::getMinorVersion() const { return 0; }
+
+    void JointModel::setProperty(uint32, const base::Property&, uint32) { setValid(0); }
+    void JointModel::save(std::ostream&) const {}
+    void JointModel::restore(std::istream&, uint32) {}
+
+    void JointModel::copy(const JointModel* mod)
+    {
+        setIfCanFail(mod->canFail());
+        setValid(0);
+    }
+
+    void JointModel::run(uint32 dim, State* s)
+    {
+        if (!isValid(dim)) initialize(dim, s);
+    }
+
+    void JointModel::initialize(uint32 dim, State*)
+    {
+        setValid(dim);
+    }
+
+    State::State() :
+        state_(0),
+        area_(0.0),
+        normal_force_(0.0),
+        shear_force_(0.0),
+        normal_disp_(0.0),
+        shear_disp_(0.0),
+        normal_disp_inc_(0.0),
+        shear_disp_inc_(0.0),
+        normal_force_inc_(0.0),
+        shear_force_inc_(0.0),
+        dnop_(0.0)
+    {
+        for (uint32 i = 0; i < max_working_; ++i) working_[i] = 0.0;
+        for (uint32 i = 0; i < max_iworking_; ++i) iworking_[i] = 0;
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,67 @@
+#include "loadpath.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace driver
+{
+    LoadPath LoadPath::fromFile(const string& file)
+    {
+        std::ifstream in(file);
+        if (!in) throw std::runtime_error("Unable to open load path " + file);
+        LoadPath p(file);
+        string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream is(line);
+            LoadStep st{ 0.0, DVect3(0.0, 0.0, 0.0) };
+            if (!(is >> st.normal_disp_inc_)) continue;
+            double v;
+            for (uint32 i = 0; i < 3 && is >> v; ++i) st.shear_disp_inc_[i] = v;
+            p.steps_.push_back(st);
+        }
+        if (p.empty()) throw std::runtime_error("Load path " + file + " has no steps.");
+        return p;
+    }
+
+    void LoadPath::ramp(double dun, const DVect3& dus, uint32 n)
+    {
+        if (!n) return;
+        // Closing is positive in the model (dn_ = -normal_disp_inc_).
+        LoadStep st{ -dun / n, dus / static_cast<double>(n) };
+        steps_.insert(steps_.end(), n, st);
+    }
+
+    LoadPath LoadPath::cyclicCompression(double unmax, uint32 cycles, uint32 stepsPerCycle, double usmax)
+    {
+        LoadPath p("cyclic");
+        if (!cycles || stepsPerCycle < 2) return p;
+        uint32 half = stepsPerCycle / 2;
+        double ds = usmax / (2.0 * half * cycles);
+        double un = 0.0;
+        for (uint32 c = 1; c <= cycles; ++c) {
+            double peak = unmax * c / cycles;
+            p.ramp(peak - un, DVect3(ds * half, 0.0, 0.0), half);
+            un = 0.3 * peak;
+            p.ramp(un - peak, DVect3(ds * half, 0.0, 0.0), half);
+        }
+        return p;
+    }
+
+    LoadPath LoadPath::monotonicTension(double unmax, uint32 n)
+    {
+        LoadPath p("tension");
+        p.ramp(-unmax, DVect3(0.0, 0.0, 0.0), n);
+        return p;
+    }
+
+    LoadPath LoadPath::directShear(double unpre, uint32 npre, double usmax, uint32 n)
+    {
+        LoadPath p("shear");
+        p.ramp(unpre, DVect3(0.0, 0.0, 0.0), npre);
+        p.ramp(0.0, DVect3(usmax, 0.0, 0.0), n);
+        return p;
+    }
+} // namespace driver
+
+// EOF
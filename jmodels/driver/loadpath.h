@@ -0,0 +1,50 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <vector>
+
+/**
+* \file
+* \brief Prescribed displacement histories replayed through the contacts by the driver.
+*/
+
+namespace driver
+{
+    // One cycle worth of kinematics, in the State sign convention
+    // (normal_disp_inc_ < 0 closes the joint).
+    struct LoadStep {
+        double normal_disp_inc_;
+        DVect3 shear_disp_inc_;
+    };
+
+    class LoadPath {
+    public:
+        LoadPath() {}
+        explicit LoadPath(const string& name) : name_(name) {}
+
+        // Whitespace separated columns: normal_disp_inc [shear_x [shear_y [shear_z]]].
+        // Lines starting with '#' are skipped.
+        static LoadPath fromFile(const string& file);
+        // Compression cycles of growing amplitude up to \a unmax (closing positive),
+        // each unloading to 30% of its peak, with a monotonic shear ramp to \a usmax.
+        static LoadPath cyclicCompression(double unmax, uint32 cycles, uint32 stepsPerCycle, double usmax);
+        // Monotonic opening to \a unmax (a positive opening) in \a n steps.
+        static LoadPath monotonicTension(double unmax, uint32 n);
+        // Closure to \a unpre in \a npre steps, then shear to \a usmax in \a n steps
+        // at constant normal displacement.
+        static LoadPath directShear(double unpre, uint32 npre, double usmax, uint32 n);
+
+        const string&                 name() const { return name_; }
+        const std::vector<LoadStep>&  steps() const { return steps_; }
+        size_t                        size() const { return steps_.size(); }
+        bool                          empty() const { return steps_.empty(); }
+
+        // Appends \a n equal steps moving the closure by \a dun and the shear by \a dus.
+        void                          ramp(double dun, const DVect3& dus, uint32 n);
+    private:
+        string                name_;
+        std::vector<LoadStep> steps_;
+    };
+} // namespace driver
+
+// EOF
@@ -0,0 +1,103 @@
+#include "mockstate.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace driver
+{
+    double Table::yFromX(double x) const
+    {
+        if (x_.empty()) return 0.0;
+        if (x <= x_.front()) return y_.front();
+        if (x >= x_.back()) return y_.back();
+        size_t i = std::upper_bound(x_.begin(), x_.end(), x) - x_.begin();
+        double dx = x_[i] - x_[i - 1];
+        if (dx <= 0.0) return y_[i];
+        return y_[i - 1] + (y_[i] - y_[i - 1]) * (x - x_[i - 1]) / dx;
+    }
+
+    double Table::slopeFromX(double x) const
+    {
+        if (x_.size() < 2) return 0.0;
+        if (x <= x_.front() || x >= x_.back()) return 0.0;
+        size_t i = std::upper_bound(x_.begin(), x_.end(), x) - x_.begin();
+        double dx = x_[i] - x_[i - 1];
+        if (dx <= 0.0) return 0.0;
+        return (y_[i] - y_[i - 1]) / dx;
+    }
+
+    void TableStore::add(const string& id, const std::vector<double>& x, const std::vector<double>& y)
+    {
+        if (x.size() != y.size())
+            throw std::runtime_error("Table " + id + ": x and y sizes differ.");
+        if (!std::is_sorted(x.begin(), x.end()))
+            throw std::runtime_error("Table " + id + ": x values must be ascending.");
+        Table& t = tables_[id];
+        t.x_ = x;
+        t.y_ = y;
+    }
+
+    bool TableStore::load(const string& id, const string& file)
+    {
+        std::ifstream in(file);
+        if (!in) return false;
+        std::vector<double> x, y;
+        double a, b;
+        while (in >> a >> b) {
+            x.push_back(a);
+            y.push_back(b);
+        }
+        if (x.empty()) return false;
+        add(id, x, y);
+        return true;
+    }
+
+    const Table* TableStore::find(const string& id) const
+    {
+        auto it = tables_.find(id);
+        return it == tables_.end() ? nullptr : &it->second;
+    }
+
+    MockState::MockState(const TableStore* tables, bool trackEnergy, double timestep) :
+        tables_(tables),
+        trackEnergy_(trackEnergy),
+        timestep_(timestep)
+    {
+    }
+
+    void* MockState::getTableIndexFromID(const string& s) const
+    {
+        const Table* t = tables_ ? tables_->find(s) : nullptr;
+        if (!t) throw std::runtime_error("Table " + s + " not found.");
+        return const_cast<Table*>(t);
+    }
+
+    double MockState::getYFromX(void* index, const double& x) const
+    {
+        return static_cast<const Table*>(index)->yFromX(x);
+    }
+
+    double MockState::getSlopeFromX(void* index, const double& x) const
+    {
+        return static_cast<const Table*>(index)->slopeFromX(x);
+    }
+
+    void MockState::reset(double area)
+    {
+        state_ = 0;
+        area_ = area;
+        normal_force_ = 0.0;
+        shear_force_ = DVect3(0.0, 0.0, 0.0);
+        normal_disp_ = 0.0;
+        shear_disp_ = DVect3(0.0, 0.0, 0.0);
+        normal_disp_inc_ = 0.0;
+        shear_disp_inc_ = DVect3(0.0, 0.0, 0.0);
+        normal_force_inc_ = 0.0;
+        shear_force_inc_ = DVect3(0.0, 0.0, 0.0);
+        dnop_ = 0.0;
+        std::fill(working_, working_ + max_working_, 0.0);
+        std::fill(iworking_, iworking_ + max_iworking_, 0);
+    }
+} // namespace driver
+
+// EOF
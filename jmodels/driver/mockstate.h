@@ -0,0 +1,59 @@
+#pragma once
+
+#include "state.h"
+#include <map>
+#include <vector>
+
+/**
+* \file
+* \brief In-memory stand-in for the 3DEC side of the jmodels::State interface,
+*        used by the headless driver to run joint models without the host.
+*/
+
+namespace driver
+{
+    // A piecewise-linear table, evaluated the same way as the host tables:
+    // linear interpolation between points, held constant past either end.
+    struct Table {
+        std::vector<double> x_;
+        std::vector<double> y_;
+        double yFromX(double x) const;
+        double slopeFromX(double x) const;
+    };
+
+    // Owns every table the driver knows about, keyed by the table ID used in
+    // the table-dt / table-ds properties.
+    class TableStore {
+    public:
+        void         add(const string& id, const std::vector<double>& x, const std::vector<double>& y);
+        // Reads a two-column (x y) text file, returns false if nothing was read.
+        bool         load(const string& id, const string& file);
+        const Table* find(const string& id) const;
+    private:
+        std::map<string, Table> tables_;
+    };
+
+    // One State per contact. The table pointer handed to the model is the
+    // address of the Table itself, so getYFromX() is a direct evaluation.
+    class MockState : public jmodels::State {
+    public:
+        MockState(const TableStore* tables = nullptr, bool trackEnergy = false, double timestep = 1.0);
+        double getTimeStep() const override { return timestep_; }
+        bool   isThermal() const override { return false; }
+        bool   isCreep() const override { return false; }
+        bool   isFluid() const override { return false; }
+        bool   trackEnergy() const override { return trackEnergy_; }
+        void*  getTableIndexFromID(const string& s) const override;
+        double getYFromX(void* index, const double& x) const override;
+        double getSlopeFromX(void* index, const double& x) const override;
+
+        // Back to a fresh, untouched subcontact with area \a area.
+        void   reset(double area);
+    private:
+        const TableStore* tables_;
+        bool              trackEnergy_;
+        double            timestep_;
+    };
+} // namespace driver
+
+// EOF
@@ -0,0 +1,18 @@
+// jmodelyopi-TUD1006027.cpp of jmodelYopiNew, built into yopidriver as
+// jmodels::tud1006027::JModelYopi, see variants.h.
+
+// The current header first: the #include "jmodelyopi.h" of the copy is then a
+// no-op, and the copy gets the declaration of yopilegacy.h instead.
+#include "jmodelyopi.h"
+#define YOPI_VARIANT tud1006027
+#include "yopilegacy.h"
+
+// The copy opens namespace YOPI_VARIANT inside jmodels itself.
+#include "../jmodelYopiNew/jmodelyopi-TUD1006027.cpp"
+
+namespace driver
+{
+    jmodels::JointModel* createTud1006027() { return new jmodels::tud1006027::JModelYopi(); }
+} // namespace driver
+
+// EOF
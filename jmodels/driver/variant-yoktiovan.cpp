@@ -0,0 +1,18 @@
+// jmodelyopi-yoktiovan.cpp of jmodelYopiNew, built into yopidriver as
+// jmodels::yoktiovan::JModelYopi, see variants.h.
+
+// The current header first: the #include "jmodelyopi.h" of the copy is then a
+// no-op, and the copy gets the declaration of yopilegacy.h instead.
+#include "jmodelyopi.h"
+#define YOPI_VARIANT yoktiovan
+#include "yopilegacy.h"
+
+// The copy opens namespace YOPI_VARIANT inside jmodels itself.
+#include "../jmodelYopiNew/jmodelyopi-yoktiovan.cpp"
+
+namespace driver
+{
+    jmodels::JointModel* createYoktiovan() { return new jmodels::yoktiovan::JModelYopi(); }
+} // namespace driver
+
+// EOF
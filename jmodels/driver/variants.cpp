@@ -0,0 +1,37 @@
+#include "variants.h"
+#include "jmodelyopi.h"
+#include <stdexcept>
+
+namespace driver
+{
+    // In variant-*.cpp.
+    jmodels::JointModel* createTud1006027();
+    jmodels::JointModel* createTud1006027_2();
+    jmodels::JointModel* createYoktiovan();
+
+    static jmodels::JointModel* createCurrent() { return new jmodels::JModelYopi(); }
+
+    const std::vector<Variant>& variants()
+    {
+        static const std::vector<Variant> list = {
+            { "current", "jmodelyopi.cpp", &createCurrent },
+            { "tud1006027", "jmodelyopi-TUD1006027.cpp", &createTud1006027 },
+            { "tud1006027-2", "jmodelyopi-TUD1006027-2.cpp", &createTud1006027_2 },
+            { "yoktiovan", "jmodelyopi-yoktiovan.cpp", &createYoktiovan },
+        };
+        return list;
+    }
+
+    const Variant& findVariant(const string& key)
+    {
+        string keys;
+        for (const auto& v : variants()) {
+            if (key == v.key_) return v;
+            keys += keys.empty() ? "" : ", ";
+            keys += v.key_;
+        }
+        throw std::runtime_error("Unknown variant " + key + " (one of " + keys + ")");
+    }
+} // namespace driver
+
+// EOF
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "jointmodel.h"
+#include <vector>
+
+/**
+* \file
+* \brief The copies of the Yopi law built into yopidriver, by key: the current
+*        model of jmodelYopiNew and the older copies kept next to it, each in its
+*        own namespace (yopilegacy.h, variant-*.cpp).
+*/
+
+namespace driver
+{
+    struct Variant {
+        const char*          key_;
+        const char*          source_;      // the file of jmodelYopiNew it is built from
+        jmodels::JointModel* (*create_)(); // a default constructed model, to be destroy()ed
+    };
+
+    // All of them, the current model first.
+    const std::vector<Variant>& variants();
+    // The variant of \a key; throws listing the keys if there is none.
+    const Variant&              findVariant(const string& key);
+} // namespace driver
+
+// EOF
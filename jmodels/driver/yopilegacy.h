@@ -0,0 +1,124 @@
+#pragma once
+
+#include "jointmodel.h"
+#include "state.h"
+
+/**
+* \file
+* \brief The JModelYopi declaration the older copies of the law in jmodelYopiNew
+*        (jmodelyopi-TUD1006027.cpp, jmodelyopi-TUD1006027-2.cpp,
+*        jmodelyopi-yoktiovan.cpp) were written against, for yopidriver to build
+*        them next to the current model, see variants.h.
+*
+* The class goes into namespace jmodels::YOPI_VARIANT, so every copy has its own.
+* It is the union of what the copies need: the fields of the current model
+* before the material was split out, plus kn_tab_, ks_tab_ and zero_dilation_,
+* and the correction functions with the signatures of the copies (the copy
+* defines the shearCorrection() it calls). The copies keep no energies.
+* The fields are declared in the order of the constructors of the copies; the
+* ones a copy's constructor leaves out start at 0, so that its runs repeat
+* (jmodelyopi-TUD1006027.cpp and jmodelyopi-yoktiovan.cpp read reloadFlag
+* before they set it).
+*/
+
+#ifndef YOPI_VARIANT
+#error Define YOPI_VARIANT to the namespace of the copy.
+#endif
+
+namespace jmodels
+{
+    namespace YOPI_VARIANT
+    {
+        using namespace ::jmodels;
+
+        class JModelYopi : public JointModel {
+        public:
+            JModelYopi();
+            virtual ~JModelYopi() {}
+            virtual string         getName() const;
+            virtual string         getPluginName() const { return getName(); }
+            virtual string         getFullName() const;
+            virtual uint32         getMinorVersion() const;
+            virtual string         getProperties() const;
+            virtual string         getStates() const;
+            virtual base::Property getProperty(uint32 index) const;
+            virtual void           setProperty(uint32 index, const base::Property& p, uint32 restoreVersion = 0);
+            virtual JModelYopi*    clone() const { return new JModelYopi(); }
+            virtual double         getMaxNormalStiffness() const { return std::max(kn_, kn_initial_); }
+            virtual double         getMaxShearStiffness() const { return ks_; }
+            virtual void           copy(const JointModel* mod);
+            virtual void           run(uint32 dim, State* s);
+            virtual void           initialize(uint32 dim, State* s);
+            double                 solveQuadratic(double, double, double);
+            void                   compCorrection(State* s, uint32* IPlasticity, double& comp);
+            void                   shearCorrection(State* s, uint32* IPlasticity, double& fsm, double& fsmax);
+            void                   shearCorrection(State* s, uint32* IPlasticity, double& fsm, double& fsmax, double& usel);
+            void                   tensionCorrection(State* s, uint32* IPlasticity, double& ten);
+
+        private:
+            // In the order the constructors of the copies initialize them.
+            double kn_;
+            double kn_initial_;
+            double ks_;
+            double kn_tab_;
+            double ks_tab_;
+            double cohesion_;
+            double compression_;
+            double friction_;
+            double dilation_;
+            double tension_;
+            double zero_dilation_ = 0.0;
+            double s_zero_dilation_ = 0.0;
+            double res_cohesion_;
+            double res_friction_;
+            double res_tension_;
+            double res_comp_;
+            double tan_friction_;
+            double tan_dilation_;
+            double tan_res_friction_;
+            double G_I;
+            double G_II;
+            double G_c;
+            double dt;
+            double ds;
+            double dc;
+            double d_ts;
+            double cc;
+            double tP_;
+            double sP_;
+            double Cnn;
+            double Css;
+            double Cn;
+            double fc_current;
+            double friction_current_;
+            double m_;
+            double n_;
+            double R_violates;
+            double R_yield;
+            double uel_;
+            double un_hist_comp;
+            double peak_normal;
+            double ds_hist;
+            double un_ro;
+            double fm_ro;
+            double un_hist_ten;
+            double dt_hist;
+            double dc_hist;
+            uint32 pertFlag;
+            uint32 plasFlag;
+            // Only jmodelyopi-TUD1006027-2.cpp initializes these.
+            double reloadFlag = 0.0;
+            double delta = 0.0;
+            double dilation_current = 0.0;
+            double un_dilatant = 0.0;
+            double dil_hist = 0.0;
+            double ddil = 0.0;
+            string dtTable_, dsTable_;
+            void*  iTension_d_ = nullptr;
+            void*  iShear_d_ = nullptr;
+            void*  iHard_d_ = nullptr;
+        };
+    } // namespace YOPI_VARIANT
+} // namespace jmodels
+
+// EOF
@@ -5,6 +5,8 @@
 #include <limits>
 
 
+// Plugin entry points; left out when yopidriver builds this copy (driver/variants.h).
+#ifndef YOPI_VARIANT
 int __stdcall DllMain(void *,unsigned, void *)
 {
   return 1;
@@ -34,9 +36,13 @@ extern "C" __declspec(dllexport) void *createInstance()
   jmodels::JModelYopi*m = new jmodels::JModelYopi();
   return (void *)m;
 }
+#endif
 
 namespace jmodels
 {
+#ifdef YOPI_VARIANT
+    namespace YOPI_VARIANT { // the copy of yopidriver, see driver/variants.h
+#endif
   static const double dPi  = 3.141592653589793238462643383279502884197169399;
   static const double dDegRad = dPi / 180.0;
 
@@ -750,6 +756,9 @@ namespace jmodels
     s->normal_force_inc_ = 0.0;
     s->shear_force_inc_ = DVect3(0, 0, 0);
   }
+#ifdef YOPI_VARIANT
+    } // namespace YOPI_VARIANT
+#endif
 } // namespace models
 
 
@@ -1,16 +1,28 @@
 #include "jmodelyopi.h"
+#include "jmodelyopiprofile.h"
 #include "state.h"
 #include "version.txt"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <istream>
 #include <limits>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 
+#ifdef _WIN32
 int __stdcall DllMain(void*, unsigned, void*)
 {
     return 1;
 }
+#endif
 
-extern "C" __declspec(dllexport) const char* getName()
+extern "C" EXPORT_TAG const char* getName()
 {
 #ifdef JMODELDEBUG
     return "jmodelyopid";
@@ -19,22 +31,80 @@ extern "C" __declspec(dllexport) const char* getName()
 #endif
 }
 
-extern "C" __declspec(dllexport) unsigned getMajorVersion()
+extern "C" EXPORT_TAG unsigned getMajorVersion()
 {
     return MAJOR_VERSION;
 }
 
-extern "C" __declspec(dllexport) unsigned getMinorVersion()
+extern "C" EXPORT_TAG unsigned getMinorVersion()
 {
     return UPDATE_VERSION;
 }
 
-extern "C" __declspec(dllexport) void* createInstance()
+extern "C" EXPORT_TAG void* createInstance()
 {
     jmodels::JModelYopi* m = new jmodels::JModelYopi();
     return (void*)m;
 }
 
+// The snapshots of jmodelyopisnapshot.h, for a host hook between cycles (a
+// script of the host that loads the plugin, say). 0 on success, 1 if the
+// snapshot file could not be written.
+extern "C" EXPORT_TAG int yopiSnapshotTakeLabel(double label)
+{
+    try {
+        jmodels::yopiSnapshotTake(label);
+    }
+    catch (std::exception&) {
+        return 1;
+    }
+    return 0;
+}
+
+extern "C" EXPORT_TAG int yopiSnapshotCloseFile()
+{
+    try {
+        jmodels::yopiSnapshotClose();
+    }
+    catch (std::exception&) {
+        return 1;
+    }
+    return 0;
+}
+
+// The tags of one contact (see JModelYopi::setTraceTag()), for the same
+// hooks. \a model is the model of the contact, as createInstance() returned
+// it. 0 on success, 1 if it is not a Yopi model.
+static jmodels::JModelYopi* yopiModel(void* model)
+{
+    return model ? dynamic_cast<jmodels::JModelYopi*>(static_cast<jmodels::JointModel*>(model)) : nullptr;
+}
+
+extern "C" EXPORT_TAG int yopiSetTraceTag(void* model, double tag)
+{
+    jmodels::JModelYopi* m = yopiModel(model);
+    if (!m) return 1;
+    m->setTraceTag(tag);
+    return 0;
+}
+
+extern "C" EXPORT_TAG int yopiSetContactId(void* model, unsigned long long id)
+{
+    jmodels::JModelYopi* m = yopiModel(model);
+    if (!m) return 1;
+    m->setContactId(id);
+    return 0;
+}
+
+extern "C" EXPORT_TAG int yopiSetCrackLinks(void* model, unsigned long long host, unsigned long long face,
+                                            unsigned long long vertex)
+{
+    jmodels::JModelYopi* m = yopiModel(model);
+    if (!m) return 1;
+    m->setCrackLinks(host, face, vertex);
+    return 0;
+}
+
 namespace jmodels
 {
     static const double dPi = 3.141592653589793238462643383279502884197169399;
@@ -64,67 +134,257 @@ namespace jmodels
     static const uint32 comp_now = 0x10;
     static const uint32 comp_past = 0x20;
 
+    // Energy accumulation (normal tension / compression + shear) of one step,
+    // from the forces at its start and the State at its end.
+    static void accumulateEnergies(YopiEnergies* e, double fn_old, const DVect3& fs_old, const State* s)
+    {
+        if (!e) return;
+        // New forces at end of the step
+        const double fn_new_x = s->normal_force_;
+        const DVect3 fs_new = s->shear_force_;
+
+        // Displacement increments for this step
+        // In your convention: normal_disp < 0 in compression.
+        // We define du_n > 0 for compression by flipping the sign.
+        const double du_n = -s->normal_disp_inc_;   // + = compression increment
+        const DVect3 du_s = s->shear_disp_inc_;     // shear slip increment
+
+        // Mean forces over the step
+        const double fn_mean = 0.5 * (fn_old + fn_new_x);
+        const DVect3 fs_mean(
+            0.5 * (fs_old.x() + fs_new.x()),
+            0.5 * (fs_old.y() + fs_new.y()),
+            0.5 * (fs_old.z() + fs_new.z())
+        );
+        // Incremental normal work (positive = storing elastic energy,
+        // negative = releasing it during unloading / damage).
+        const double dWn = fn_mean * du_n;
+
+        // Split normal energy into tension vs compression based on sign of mean force:
+        //   fn_mean >= 0  -> compression branch
+        //   fn_mean < 0   -> tension branch
+        if (fn_mean >= 0.0) {
+            e->ecompression_ += dWn;
+        }
+        else {
+            e->etension_ += dWn;
+        }
+
+        // Incremental shear work: fs  du_s
+        const double dWs =
+            fs_mean.x() * du_s.x() +
+            fs_mean.y() * du_s.y() +
+            fs_mean.z() * du_s.z();
+
+        e->eshear_ += dWs;
+    }
+
+    // A damage table value: from the local copy where there is one (see
+    // table-tolerance), else from the host.
+    static inline double tableY(const YopiTable* t, const State* s, void* index, double x)
+    {
+        return t && x >= 0.0 ? t->y(x) : s->getYFromX(index, x);
+    }
+
+    // The compressive cap function at the forces of \a s; the terms of the
+    // default cap (Cnn = Css = 1, Cn = 0) drop out of it for finite forces.
+    template <class P>
+    static inline double capF3(const YopiMaterial& mat, const State* s, double comp)
+    {
+        if constexpr (P::defaultCap_)
+            return pow(s->normal_force_, 2) + pow(s->shear_force_.mag(), 2) - pow(comp, 2);
+        else
+            return mat.Cnn * pow(s->normal_force_, 2) + mat.Css * pow(s->shear_force_.mag(), 2) + mat.Cn * s->normal_force_ - pow(comp, 2);
+    }
+
+    inline bool isZero(const DVect3& v) { return v.x() == 0.0 && v.y() == 0.0 && v.z() == 0.0; }
+
+    static void checkForces(const State* s)
+    {
+        // At end of run()
+        if (std::isnan(s->normal_force_)) {
+            throw std::runtime_error("NaN detected in JModelYopi::run normal side");
+        }
+        if (std::isnan(s->normal_force_) || std::isnan(s->shear_force_.x())
+            || std::isnan(s->shear_force_.y()) || std::isnan(s->shear_force_.z())) {
+            throw std::runtime_error("NaN detected in JModelYopi::run shear side");
+        }
+    }
+
+    // Every double of YopiMaterial, for comparison and hashing.
+    static std::array<const double*, 37> materialDoubles(const YopiMaterial& m)
+    {
+        return { { &m.kn_initial_, &m.ks_, &m.cohesion_, &m.compression_, &m.friction_, &m.dilation_,
+                   &m.tension_, &m.s_zero_dilation_, &m.res_cohesion_, &m.res_friction_, &m.res_tension_,
+                   &m.tan_friction_, &m.tan_dilation_, &m.tan_res_friction_, &m.G_I, &m.G_II, &m.G_c,
+                   &m.Cnn, &m.Css, &m.Cn, &m.R_yield, &m.R_violates, &m.res_comp_, &m.n_,
+                   &m.substep_tol_, &m.substep_max_, &m.stiffness_damaged_, &m.stiffness_floor_, &m.table_tol_,
+                   &m.k_.ucel_, &m.k_.uel_limit_, &m.k_.fel_limit_, &m.k_.mid_comp_, &m.k_.m_,
+                   &m.k_.ucul_, &m.k_.uel_, &m.k_.tan_friction_dil_ } };
+    }
+
+    static uint64 tableStamp(const std::shared_ptr<const YopiTable>& t)
+    {
+        return t ? t->stamp() : 0;
+    }
+
+    bool YopiMaterial::operator==(const YopiMaterial& m) const
+    {
+        if (dtTable_ != m.dtTable_ || dsTable_ != m.dsTable_ || iTension_d_ != m.iTension_d_
+            || iShear_d_ != m.iShear_d_ || iHard_d_ != m.iHard_d_ || tableStamp(dtSample_) != tableStamp(m.dtSample_)
+            || tableStamp(dsSample_) != tableStamp(m.dsSample_))
+            return false;
+        auto a = materialDoubles(*this), b = materialDoubles(m);
+        for (size_t i = 0; i < a.size(); ++i)
+            if (std::memcmp(a[i], b[i], sizeof(double))) return false;
+        return true;
+    }
+
+    size_t YopiMaterial::hash() const
+    {
+        uint64 h = 14695981039346656037ULL;
+        auto mix = [&h](const void* p, size_t n) {
+            const unsigned char* b = static_cast<const unsigned char*>(p);
+            for (size_t i = 0; i < n; ++i) {
+                h ^= b[i];
+                h *= 1099511628211ULL;
+            }
+        };
+        for (auto d : materialDoubles(*this))
+            mix(d, sizeof(double));
+        mix(dtTable_.data(), dtTable_.size());
+        mix(dsTable_.data(), dsTable_.size());
+        mix(&iTension_d_, sizeof(iTension_d_));
+        mix(&iShear_d_, sizeof(iShear_d_));
+        const uint64 stamps[2] = { tableStamp(dtSample_), tableStamp(dsSample_) };
+        mix(stamps, sizeof(stamps));
+        return static_cast<size_t>(h);
+    }
+
+    namespace
+    {
+        struct MaterialRegistry {
+            std::mutex                                                         mutex_;
+            std::unordered_multimap<size_t, std::weak_ptr<const YopiMaterial>> records_;
+            size_t                                                             sweepAt_ = 64;
+        };
+
+        MaterialRegistry& registry()
+        {
+            static MaterialRegistry* r = new MaterialRegistry; // outlives every contact
+            return *r;
+        }
+    }
+
+    std::shared_ptr<const YopiMaterial> YopiMaterial::intern(const YopiMaterial& m)
+    {
+        size_t key = m.hash();
+        MaterialRegistry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex_);
+        auto range = r.records_.equal_range(key);
+        for (auto it = range.first; it != range.second;) {
+            std::shared_ptr<const YopiMaterial> p = it->second.lock();
+            if (!p) {
+                it = r.records_.erase(it);
+                continue;
+            }
+            if (*p == m) return p;
+            ++it;
+        }
+        // Drop the records released since the last sweep once they pile up.
+        if (r.records_.size() >= r.sweepAt_) {
+            for (auto it = r.records_.begin(); it != r.records_.end();)
+                it = it->second.expired() ? r.records_.erase(it) : std::next(it);
+            r.sweepAt_ = std::max<size_t>(64, 2 * r.records_.size());
+        }
+        std::shared_ptr<YopiMaterial> rec = std::make_shared<YopiMaterial>(m);
+        JModelYopi::selectLaw(*rec);
+        std::shared_ptr<const YopiMaterial> p = rec;
+        r.records_.emplace(key, p);
+        return p;
+    }
+
+    size_t YopiMaterial::internedCount()
+    {
+        MaterialRegistry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex_);
+        size_t n = 0;
+        for (auto& e : r.records_)
+            if (!e.second.expired()) ++n;
+        return n;
+    }
+
+    bool YopiMaterial::initialized(uint64 pass, std::shared_ptr<const YopiMaterial>& result) const
+    {
+        const InitOutcome* o = init_.last_.load(std::memory_order_acquire);
+        if (!o || o->pass_.load(std::memory_order_relaxed) != pass)
+            return false;
+        if (o->result_) result = o->result_;
+        return true;
+    }
+
+    void YopiMaterial::setInitialized(uint64 pass, std::shared_ptr<const YopiMaterial> result) const
+    {
+        std::lock_guard<std::mutex> lock(init_.mutex_);
+        InitOutcome* o = nullptr;
+        for (auto& e : init_.outcomes_)
+            if (e->result_ == result) o = e.get();
+        if (!o) {
+            init_.outcomes_.emplace_back(new InitOutcome);
+            o = init_.outcomes_.back().get();
+            o->result_ = std::move(result);
+        }
+        o->pass_.store(pass, std::memory_order_relaxed);
+        init_.last_.store(o, std::memory_order_release);
+    }
+
+    // The initialize pass. Starts at 1, as 0 marks an outcome not yet
+    // recorded and a contact that has not run yet.
+    static std::atomic<uint64> initializePassCount{ 1 };
+    static std::atomic<uint64> materialInitializationCount{ 0 };
+
+    // The local copy of table \a index: \a held if it still matches it, else
+    // a new one (null if the table is not sampled).
+    static std::shared_ptr<const YopiTable> localTable(const State& s, void* index, double tolerance,
+                                                       const std::shared_ptr<const YopiTable>& held)
+    {
+        if (held && held->matches(s, index, tolerance)) return held;
+        return YopiTable::resample(s, index, tolerance);
+    }
+
+    uint64 JModelYopi::initializePass()
+    {
+        return initializePassCount.load(std::memory_order_acquire);
+    }
+
+    void JModelYopi::tablesChanged()
+    {
+        initializePassCount.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    uint64 JModelYopi::materialInitializations()
+    {
+        return materialInitializationCount.load(std::memory_order_relaxed);
+    }
+
+    // The record of a default constructed model, interned once: every clone()
+    // starts from it, and only takes a reference.
+    static const std::shared_ptr<const YopiMaterial>& defaultMaterial()
+    {
+        static const std::shared_ptr<const YopiMaterial>* m =
+            new std::shared_ptr<const YopiMaterial>(YopiMaterial::intern(YopiMaterial())); // outlives every contact
+        return *m;
+    }
+
     JModelYopi::JModelYopi() :
-        kn_(0),
-        kn_initial_(0),
-        ks_(0),
-        cohesion_(0),
-        compression_(0),
-        friction_(0),
-        dilation_(0),
-        tension_(0),
-        s_zero_dilation_(0),
-        res_cohesion_(0),
-        res_friction_(0),
-        res_tension_(0),
-        res_comp_(0),
-        tan_friction_(0),
-        tan_dilation_(0),
-        tan_res_friction_(0),
-        G_I(0),
-        G_II(0),
-        G_c(0),
-        dt(0),
-        ds(0),
-        dc(0),
-        d_ts(0),
-        cc(0),
-        tP_(0),
-        sP_(0),
-        Cnn(0),
-        Css(0),
-        Cn(0),
-        fc_current(0),
-        friction_current_(0),
-        m_(0),
-        n_(0),
-        R_violates(0),
-        R_yield(0),
-        uel_(0),
-        un_hist_comp(0),
-        peak_normal(0),
-        ds_hist(0),
-        un_ro(0),
-        fm_ro(0),
-        un_hist_ten(0),
-        dt_hist(0),
-        dc_hist(0),
-        pertFlag(0),
-        plasFlag(0),
-        reloadFlag(0),
-        delta(0),
-        dilation_current(0),
-        un_dilatant(0),
-        dil_hist(0),
-        ddil(0)
+        mat_(defaultMaterial())
     {
     }
 
     JModelYopi::~JModelYopi()
     {
         // Clean up any allocated resources here
-        if (energies_)
-            delete energies_;
+        YopiEnergyPool::instance().release(energies_);
     }
 
     string JModelYopi::getName() const
@@ -158,7 +418,8 @@ namespace jmodels
             "table-dt    ,table-ds ,"
             "tensile-disp-plastic    ,shear-disp-plastic ,"
             "G_c, Cn, Cnn, Css, fc_current,  fric_current,   peak_ratio, ult_ratio,uel,un_hist_comp,peak_normal,ds_hist,"
-            "un_reloading,fm_reloading,un_hist_ten, dt_hist,dc_hist,delta,dilation_current,un_dilatant,dil_hist,ddil,reloadFlag,ksechist");
+            "un_reloading,fm_reloading,un_hist_ten, dt_hist,dc_hist,delta,dilation_current,un_dilatant,dil_hist,ddil,reloadFlag,ksechist,"
+            "substep-tolerance,substep-max,stiffness-damaged,stiffness-floor,table-tolerance");
     }
 
     string JModelYopi::getStates() const
@@ -170,109 +431,142 @@ namespace jmodels
     {
         switch (index)
         {
-        case 1:  return kn_;
-        case 2:  return kn_initial_;
-        case 3:  return ks_;
-        case 4:  return cohesion_;
-        case 5:  return compression_;
-        case 6:  return friction_;
-        case 7:  return dilation_;
-        case 8:  return tension_;
-        case 9:  return s_zero_dilation_;
-        case 10:  return res_cohesion_;
-        case 11:  return res_friction_;
-        case 12: return res_comp_;
-        case 13: return res_tension_;
-        case 14: return G_I;
-        case 15: return G_II;
-        case 16: return dt;
-        case 17: return ds;
-        case 18: return dc;
-        case 19: return d_ts;
-        case 20: return cc;
-        case 21: return dtTable_;
-        case 22: return dsTable_;
-        case 23: return tP_;
-        case 24: return sP_;
-        case 25: return G_c;
-        case 26: return Cn;
-        case 27: return Cnn;
-        case 28: return Css;
-        case 29: return fc_current;
-        case 30: return friction_current_;
-        case 31: return n_;
-        case 32: return m_;
-        case 33: return uel_;
-        case 34: return un_hist_comp;
-        case 35: return peak_normal;
-        case 36: return ds_hist;
-        case 37: return un_ro;
-        case 38: return fm_ro;
-        case 39: return un_hist_ten;
-        case 40: return dt_hist;
-        case 41: return dc_hist;
-        case 42: return delta;
-        case 43: return dilation_current;
-        case 44: return un_dilatant;
-        case 45: return dil_hist;
-        case 46: return ddil;
-        case 47: return reloadFlag;
+        case 1:  return hist_.kn_;
+        case 2:  return mat_->kn_initial_;
+        case 3:  return mat_->ks_;
+        case 4:  return mat_->cohesion_;
+        case 5:  return mat_->compression_;
+        case 6:  return mat_->friction_;
+        case 7:  return mat_->dilation_;
+        case 8:  return mat_->tension_;
+        case 9:  return mat_->s_zero_dilation_;
+        case 10:  return mat_->res_cohesion_;
+        case 11:  return mat_->res_friction_;
+        case 12: return mat_->res_comp_;
+        case 13: return mat_->res_tension_;
+        case 14: return mat_->G_I;
+        case 15: return mat_->G_II;
+        case 16: return hist_.dt;
+        case 17: return hist_.ds;
+        case 18: return hist_.dc;
+        case 19: return hist_.d_ts;
+        case 20: return hist_.cc;
+        case 21: return mat_->dtTable_;
+        case 22: return mat_->dsTable_;
+        case 23: return hist_.tP_;
+        case 24: return hist_.sP_;
+        case 25: return mat_->G_c;
+        case 26: return mat_->Cn;
+        case 27: return mat_->Cnn;
+        case 28: return mat_->Css;
+        case 29: return hist_.fc_current;
+        case 30: return hist_.friction_current_;
+        case 31: return mat_->n_;
+        case 32: return hist_.m_;
+        case 33: return hist_.uel_;
+        case 34: return hist_.un_hist_comp;
+        case 35: return hist_.peak_normal;
+        case 36: return hist_.ds_hist;
+        case 37: return hist_.un_ro;
+        case 38: return hist_.fm_ro;
+        case 39: return hist_.un_hist_ten;
+        case 40: return hist_.dt_hist;
+        case 41: return hist_.dc_hist;
+        case 42: return hist_.delta;
+        case 43: return hist_.dilation_current;
+        case 44: return hist_.un_dilatant;
+        case 45: return hist_.dil_hist;
+        case 46: return hist_.ddil;
+        case 47: return hist_.reloadFlag;
+        case 49: return mat_->substep_tol_;
+        case 50: return mat_->substep_max_;
+        case 51: return mat_->stiffness_damaged_;
+        case 52: return mat_->stiffness_floor_;
+        case 53: return mat_->table_tol_;
         }
         return 0.0;
     }
 
-    void JModelYopi::setProperty(uint32 index, const base::Property& prop, uint32)
+    // save() block: a header, the material properties, the history, the
+    // extras of the history, the energies if tracked and the two table names.
+    // The lists below only ever grow at the end; restore() reads as many
+    // values as the file has and leaves the rest at their defaults, so older
+    // blocks still restore.
+    static const uint32 kSaveMagic = 0x49504f59; // "YOPI"
+    static const uint32 kSaveFormat = 1;
+    // Minor version of the first plugin that writes the block; files of an
+    // earlier one only have the properties.
+    static const uint32 kFirstSaveVersion = 4;
+
+    void JModelYopi::setProperty(uint32 index, const base::Property& prop, uint32 restoreVersion)
     {
+        // 3DEC sets every property back after restore(): the block restored
+        // them already, unless the file is older than it.
+        if (restoreVersion >= kFirstSaveVersion) return;
         JointModel::setProperty(index, prop);
+        // History first: those leave the material record alone.
+        switch (index)
+        {
+        case 1: hist_.kn_ = prop.to<double>();  return;
+        case 16: hist_.dt = prop.to<double>(); return;
+        case 17: hist_.ds = prop.to<double>(); return;
+        case 18: hist_.dc = prop.to<double>(); return;
+        case 19: hist_.d_ts = prop.to<double>(); return;
+        case 20: hist_.cc = prop.to<double>(); return;
+        case 23: hist_.tP_ = prop.to<double>(); return;
+        case 24: hist_.sP_ = prop.to<double>(); return;
+        case 29: hist_.fc_current = prop.to<double>(); return;
+        case 30: hist_.friction_current_ = prop.to<double>(); return;
+        case 32: hist_.m_ = prop.to<double>(); return;
+        case 33: hist_.uel_ = prop.to<double>(); return;
+        case 34: hist_.un_hist_comp = prop.to<double>(); return;
+        case 35: hist_.peak_normal = prop.to<double>(); return;
+        case 36: hist_.ds_hist = prop.to<double>(); return;
+        case 37: hist_.un_ro = prop.to<double>(); return;
+        case 38: hist_.fm_ro = prop.to<double>(); return;
+        case 39: hist_.un_hist_ten = prop.to<double>(); return;
+        case 40: hist_.dt_hist = prop.to<double>(); return;
+        case 41: hist_.dc_hist = prop.to<double>(); return;
+        case 42: hist_.delta = prop.to<double>(); return;
+        case 43: hist_.dilation_current = prop.to<double>(); return;
+        case 44: hist_.un_dilatant = prop.to<double>(); return;
+        case 45: hist_.dil_hist = prop.to<double>(); return;
+        case 46: hist_.ddil = prop.to<double>(); return;
+        case 47: hist_.reloadFlag = prop.to<double>(); return;
+        }
+        YopiMaterial mat = *mat_;
         switch (index)
         {
-        case 1: kn_ = prop.to<double>();  break;
-        case 2: kn_initial_ = prop.to<double>(); break;
-        case 3: ks_ = prop.to<double>();  break;
-        case 4: cohesion_ = prop.to<double>();  break;
-        case 5: compression_ = prop.to<double>(); break;
-        case 6: friction_ = prop.to<double>();  break;
-        case 7: dilation_ = prop.to<double>();  break;
-        case 8: tension_ = prop.to<double>();  break;
-        case 9: s_zero_dilation_ = prop.to<double>();  break;
-        case 10: res_cohesion_ = prop.to<double>();  break;
-        case 11: res_friction_ = prop.to<double>();  break;
-        case 12: res_comp_ = prop.to<double>(); break;
-        case 13: res_tension_ = prop.to<double>();  break;
-        case 14: G_I = prop.to<double>(); break;
-        case 15: G_II = prop.to<double>(); break;
-        case 16: dt = prop.to<double>(); break;
-        case 17: ds = prop.to<double>(); break;
-        case 18: dc = prop.to<double>(); break;
-        case 19: d_ts = prop.to<double>(); break;
-        case 20: cc = prop.to<double>(); break;
-        case 21: dtTable_ = prop.to<string>();  break;
-        case 22: dsTable_ = prop.to<string>();  break;
-        case 23: tP_ = prop.to<double>(); break;
-        case 24: sP_ = prop.to<double>(); break;
-        case 25: G_c = prop.to<double>(); break;
-        case 26: Cn = prop.to<double>(); break;
-        case 27: Cnn = prop.to<double>(); break;
-        case 28: Css = prop.to<double>(); break;
-        case 29: fc_current = prop.to<double>(); break;
-        case 30: friction_current_ = prop.to<double>(); break;
-        case 31: n_ = prop.to<double>(); break;
-        case 32: m_ = prop.to<double>(); break;
-        case 33: uel_ = prop.to<double>(); break;
-        case 34: un_hist_comp = prop.to<double>(); break;
-        case 35: peak_normal = prop.to<double>(); break;
-        case 36: ds_hist = prop.to<double>(); break;
-        case 37: un_ro = prop.to<double>(); break;
-        case 38: fm_ro = prop.to<double>(); break;
-        case 39: un_hist_ten = prop.to<double>(); break;
-        case 40: dt_hist = prop.to<double>(); break;
-        case 41: dc_hist = prop.to<double>(); break;
-        case 42: delta = prop.to<double>(); break;
-        case 43: dilation_current = prop.to<double>(); break;
-        case 44: un_dilatant = prop.to<double>(); break;
-        case 45: dil_hist = prop.to<double>(); break;
-        case 46: ddil = prop.to<double>(); break;
-        case 47: reloadFlag = prop.to<double>(); break;
+        case 2: mat.kn_initial_ = prop.to<double>(); break;
+        case 3: mat.ks_ = prop.to<double>();  break;
+        case 4: mat.cohesion_ = prop.to<double>();  break;
+        case 5: mat.compression_ = prop.to<double>(); break;
+        case 6: mat.friction_ = prop.to<double>();  break;
+        case 7: mat.dilation_ = prop.to<double>();  break;
+        case 8: mat.tension_ = prop.to<double>();  break;
+        case 9: mat.s_zero_dilation_ = prop.to<double>();  break;
+        case 10: mat.res_cohesion_ = prop.to<double>();  break;
+        case 11: mat.res_friction_ = prop.to<double>();  break;
+        case 12: mat.res_comp_ = prop.to<double>(); break;
+        case 13: mat.res_tension_ = prop.to<double>();  break;
+        case 14: mat.G_I = prop.to<double>(); break;
+        case 15: mat.G_II = prop.to<double>(); break;
+        case 21: mat.dtTable_ = prop.to<string>();  break;
+        case 22: mat.dsTable_ = prop.to<string>();  break;
+        case 25: mat.G_c = prop.to<double>(); break;
+        case 26: mat.Cn = prop.to<double>(); break;
+        case 27: mat.Cnn = prop.to<double>(); break;
+        case 28: mat.Css = prop.to<double>(); break;
+        case 31: mat.n_ = prop.to<double>(); break;
+        case 49: mat.substep_tol_ = prop.to<double>(); break;
+        case 50: mat.substep_max_ = prop.to<double>(); break;
+        case 51: mat.stiffness_damaged_ = prop.to<double>(); break;
+        case 52: mat.stiffness_floor_ = prop.to<double>(); break;
+        case 53: mat.table_tol_ = prop.to<double>(); break;
+        }
+        if (!(mat == *mat_)) {
+            mat.k_ = YopiMaterial::Constants();
+            mat_ = YopiMaterial::intern(mat);
         }
     }
 
@@ -281,60 +575,15 @@ namespace jmodels
     static const uint32 Dqkn = 2;
     static const uint32 Dqc = 3;
     static const uint32 D_un_hist = 4;
-    DVect3 last_shear_dir_; // previously used shear direction
 
     void JModelYopi::copy(const JointModel* m)
     {
         JointModel::copy(m);
         const JModelYopi* mm = dynamic_cast<const JModelYopi*>(m);
         if (!mm) throw std::runtime_error("Internal error: constitutive model dynamic cast failed.");
-        kn_ = mm->kn_;
-        kn_initial_ = mm->kn_initial_;
-        ks_ = mm->ks_;
-        cohesion_ = mm->cohesion_;
-        compression_ = mm->compression_;
-        friction_ = mm->friction_;
-        dilation_ = mm->dilation_;
-        tension_ = mm->tension_;
-        s_zero_dilation_ = mm->s_zero_dilation_;
-        res_cohesion_ = mm->res_cohesion_;
-        res_friction_ = mm->res_friction_;
-        res_comp_ = mm->res_comp_;
-        res_tension_ = mm->res_tension_;
-        tan_friction_ = mm->tan_friction_;
-        tan_dilation_ = mm->tan_dilation_;
-        tan_res_friction_ = mm->tan_res_friction_;
-        G_I = mm->G_I;
-        G_II = mm->G_II;
-        dt = mm->dt;
-        ds = mm->ds;
-        dc = mm->dc;
-        d_ts = mm->d_ts;
-        cc = mm->cc;
-        dtTable_ = mm->dtTable_;
-        dsTable_ = mm->dsTable_;
-        tP_ = mm->tP_;
-        sP_ = mm->sP_;
-        G_c = mm->G_c;
-        fc_current = mm->fc_current;
-        friction_current_ = mm->friction_current_;
-        n_ = mm->n_;
-        m_ = mm->m_;
-        uel_ = mm->uel_;
-        un_hist_comp = mm->un_hist_comp;
-        peak_normal = mm->peak_normal;
-        ds_hist = mm->ds_hist;
-        un_ro = mm->un_ro;
-        fm_ro = mm->fm_ro;
-        un_hist_ten = mm->un_hist_ten;
-        dt_hist = mm->dt_hist;
-        dc_hist = mm->dc_hist;
-        delta = mm->delta;
-        dilation_current = mm->dilation_current;
-        un_dilatant = mm->un_dilatant;
-        dil_hist = mm->dil_hist;
-        ddil = mm->ddil;
-        reloadFlag = mm->reloadFlag;
+        mat_ = mm->mat_;
+        hist_ = mm->hist_;
+        hist_.resetStepCaches();
     }
 
     void JModelYopi::initialize(uint32 dim, State* s)
@@ -347,51 +596,99 @@ namespace jmodels
         // with the updated tangential slip direction in run().
         s->iworking_[1] = 1;
 
-        tan_friction_ = tan(friction_ * dDegRad);
-        tan_res_friction_ = tan(res_friction_ * dDegRad);
-        tan_dilation_ = tan(dilation_ * dDegRad);
-        dilation_current = dilation_;
-        last_shear_dir_ = DVect3(0.0, 0.0, 0.0);
+        // Another contact with this record may have done the material part
+        // already in this pass: tables are not edited within one.
+        const uint64 pass = initializePass();
+        std::shared_ptr<const YopiMaterial> done;
+        if (mat_->initialized(pass, done)) {
+            if (done) mat_ = std::move(done);
+            initializeHistory(hist_);
+            return;
+        }
+        materialInitializationCount.fetch_add(1, std::memory_order_relaxed);
+        void* iTension = mat_->dtTable_.length() ? s->getTableIndexFromID(mat_->dtTable_) : nullptr;
+        void* iShear = mat_->dsTable_.length() ? s->getTableIndexFromID(mat_->dsTable_) : nullptr;
+
+        // Derived values and defaults go into a new record, shared by every
+        // contact that ends up with the same one.
+        YopiMaterial mat = *mat_;
+        mat.tan_friction_ = tan(mat.friction_ * dDegRad);
+        mat.tan_res_friction_ = tan(mat.res_friction_ * dDegRad);
+        mat.tan_dilation_ = tan(mat.dilation_ * dDegRad);
 
         // Initialize compressive cap
-        R_yield = 0.0;
-        R_violates = 0.0;
-
-        // Reset table indices
-        iTension_d_ = iShear_d_ = iHard_d_ = nullptr;
+        mat.R_yield = 0.0;
+        mat.R_violates = 0.0;
 
-        if (dtTable_.length()) iTension_d_ = s->getTableIndexFromID(dtTable_);
-        if (dsTable_.length()) iShear_d_ = s->getTableIndexFromID(dsTable_);
+        // Table indices, and the local copies: those of the record are kept
+        // if they still match the tables.
+        mat.iTension_d_ = iTension;
+        mat.iShear_d_ = iShear;
+        mat.iHard_d_ = nullptr;
+        mat.dtSample_ = localTable(*s, iTension, mat.table_tol_, mat_->dtSample_);
+        mat.dsSample_ = localTable(*s, iShear, mat.table_tol_, mat_->dsSample_);
 
         //// --- SAFE INITIALIZATION OF HISTORY VARIABLES ---
-        if (!G_c)
+        if (!mat.G_c)
             throw std::runtime_error("Internal error: Please input compressive fracture energy.");
-        if (!n_) n_ = 1.0;
-        if (n_ < 1.0)
+        if (!mat.n_) mat.n_ = 1.0;
+        if (mat.n_ < 1.0)
             throw std::runtime_error("Internal error: peak_ratio (n) must be bigger than 1.0");
 
-        if (G_I && iTension_d_)
+        if (mat.G_I && mat.iTension_d_)
             throw std::runtime_error("Internal error: either G_I or dtTable_ can be defined, not both.");
 
-        if (G_II && iShear_d_)
+        if (mat.G_II && mat.iShear_d_)
             throw std::runtime_error("Internal error: either G_II or dsTable_ can be defined, not both.");
 
-        if (dilation_ && !delta) delta = 2;
-        if (!dilation_) {
-            delta = 0.0;
-            un_dilatant = 0.0;
-        }
-
         // Ensure compressive values are reasonable
-        if (!compression_) compression_ = 1e20;
-        if (!res_comp_)    res_comp_ = 0.0;
-        if (!Cn)           Cn = 0.0;
-        if (!Cnn)          Cnn = 1.0;
-        if (!Css)          Css = 1.0;
+        if (!mat.compression_) mat.compression_ = 1e20;
+        if (!mat.res_comp_)    mat.res_comp_ = 0.0;
+        if (!mat.Cn)           mat.Cn = 0.0;
+        if (!mat.Cnn)          mat.Cnn = 1.0;
+        if (!mat.Css)          mat.Css = 1.0;
+
+        // Constants of the law, as run() used to compute them every cycle
+        YopiMaterial::Constants& k = mat.k_;
+        double kn_comp_ = mat.kn_initial_;
+        k.ucel_ = mat.n_ * mat.compression_ / kn_comp_;
+        k.uel_limit_ = mat.compression_ / kn_comp_ / 5.0;
+        k.fel_limit_ = mat.compression_ / 5.0;
+        k.mid_comp_ = mat.res_comp_ + (mat.compression_ - mat.res_comp_) / 2.0;
+        double beta_ = k.ucel_ * mat.res_comp_; //Coefficient for calculating intermediate ratio
+        double kappa_ = k.ucel_ * mat.compression_;
+        double gamma_ = 2.0;
+        k.m_ = (mat.G_c - 0.5 * (pow(mat.compression_, 2) / (9 * kn_comp_)) - 0.5 * (k.ucel_ - k.uel_limit_) * 1.3 * mat.compression_
+            + 0.75 * kappa_ + 0.25 * beta_) / (0.25 * kappa_ * (2 + gamma_) - 0.25 * beta_ * (2 - 3 * gamma_));
+        if (k.m_ < 1.5) k.m_ = 1.5;
+        k.ucul_ = k.m_ * k.ucel_;
+        k.uel_ = mat.tension_ / mat.kn_initial_;
+        double dil_0 = mat.dilation_ ? mat.dilation_ : 0.0;
+        k.tan_friction_dil_ = tan((mat.friction_ + dil_0) * dDegRad);
+
+        std::shared_ptr<const YopiMaterial> from = mat_;
+        if (!(mat == *mat_)) mat_ = YopiMaterial::intern(mat);
+        from->setInitialized(pass, mat_ == from ? nullptr : mat_);
+
+        initializeHistory(hist_);
+    }
+
+    // The part of initialize() that belongs to the contact rather than the material.
+    void JModelYopi::initializeHistory(YopiHistory& h) const
+    {
+        const YopiMaterial& mat = *mat_;
+        h.resetStepCaches();
+        h.open_ = 0.0;
+        h.dilation_current = mat.dilation_;
+        if (mat.dilation_ && !h.delta) h.delta = 2;
+        if (!mat.dilation_) {
+            h.delta = 0.0;
+            h.un_dilatant = 0.0;
+        }
     }
 
     // numerically-stable quadratic (q-formula) + finite clamp
-    double JModelYopi::solveQuadratic(double a, double b, double c) {
+    double JModelYopi::solveQuadratic(double a, double b, double c) const {
         // Returns the larger real root (used for projection), clamped finite.
         if (!std::isfinite(a) || !std::isfinite(b) || !std::isfinite(c)) return 0.0;
         if (std::abs(a) < 1e-18) {
@@ -453,10 +750,241 @@ namespace jmodels
     }
 
 
+    template <class M>
+    static std::array<decltype(&std::declval<M&>().ks_), 24> savedMaterial(M& m)
+    {
+        return { { &m.kn_initial_, &m.ks_, &m.cohesion_, &m.compression_, &m.friction_, &m.dilation_,
+                   &m.tension_, &m.s_zero_dilation_, &m.res_cohesion_, &m.res_friction_, &m.res_tension_,
+                   &m.G_I, &m.G_II, &m.G_c, &m.Cnn, &m.Css, &m.Cn, &m.res_comp_, &m.n_,
+                   &m.substep_tol_, &m.substep_max_, &m.stiffness_damaged_, &m.stiffness_floor_, &m.table_tol_ } };
+    }
+
+    // Everything but the step caches (dormant_, margin_, marginArea_), which
+    // initialize() clears anyway. plasFlag and pertFlag go as doubles.
+    template <class H>
+    static std::array<decltype(&std::declval<H&>().kn_), 26> savedHistory(H& h)
+    {
+        return { { &h.kn_, &h.dt, &h.ds, &h.dc, &h.d_ts, &h.cc, &h.tP_, &h.sP_, &h.fc_current,
+                   &h.friction_current_, &h.m_, &h.uel_, &h.un_hist_comp, &h.peak_normal, &h.ds_hist,
+                   &h.un_ro, &h.fm_ro, &h.un_hist_ten, &h.reloadFlag, &h.dc_hist, &h.dt_hist, &h.delta,
+                   &h.dilation_current, &h.un_dilatant, &h.dil_hist, &h.ddil } };
+    }
+
+    void JModelYopi::save(std::ostream& o) const
+    {
+        JointModel::save(o);
+        const YopiMaterial& mat = *mat_;
+        auto md = savedMaterial(mat);
+        auto hd = savedHistory(hist_);
+        const uint32 header[6] = { kSaveMagic, kSaveFormat, static_cast<uint32>(md.size()),
+                                   static_cast<uint32>(hd.size()), 5u, energies_ ? 3u : 0u };
+        std::vector<double> values;
+        values.reserve(md.size() + hd.size() + 6);
+        for (auto d : md) values.push_back(*d);
+        for (auto d : hd) values.push_back(*d);
+        values.push_back(hist_.plasFlag);
+        values.push_back(hist_.pertFlag);
+        values.push_back(hist_.open_);
+        values.push_back(hist_.openInc_);
+        values.push_back(hist_.slip_);
+        if (energies_) {
+            values.push_back(energies_->etension_);
+            values.push_back(energies_->ecompression_);
+            values.push_back(energies_->eshear_);
+        }
+        const uint32 names[2] = { static_cast<uint32>(mat.dtTable_.size()), static_cast<uint32>(mat.dsTable_.size()) };
+
+        std::vector<char> block(sizeof(header) + values.size() * sizeof(double) + sizeof(names)
+                                + names[0] + names[1]);
+        char* p = block.data();
+        auto put = [&p](const void* v, size_t n) {
+            if (n) std::memcpy(p, v, n);
+            p += n;
+        };
+        put(header, sizeof(header));
+        put(values.data(), values.size() * sizeof(double));
+        put(names, sizeof(names));
+        put(mat.dtTable_.data(), names[0]);
+        put(mat.dsTable_.data(), names[1]);
+        o.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+
+    void JModelYopi::restore(std::istream& i, uint32 restoreVersion)
+    {
+        JointModel::restore(i, restoreVersion);
+        if (restoreVersion < kFirstSaveVersion) return;
+        auto read = [&i](void* v, size_t n) {
+            if (n && !i.read(static_cast<char*>(v), static_cast<std::streamsize>(n)))
+                throw std::runtime_error("JModelYopi::restore: unexpected end of data.");
+        };
+        // magic, format, then the counts: material, history, extras, energies
+        uint32 header[6];
+        read(header, sizeof(header));
+        if (header[0] != kSaveMagic || header[1] < 1 || header[1] > kSaveFormat)
+            throw std::runtime_error("JModelYopi::restore: unknown data block.");
+        std::vector<double> values(static_cast<size_t>(header[2]) + header[3] + header[4] + header[5]);
+        read(values.data(), values.size() * sizeof(double));
+        uint32 names[2];
+        read(names, sizeof(names));
+        YopiMaterial mat;
+        mat.dtTable_.resize(names[0]);
+        mat.dsTable_.resize(names[1]);
+        read(&mat.dtTable_[0], names[0]);
+        read(&mat.dsTable_[0], names[1]);
+
+        YopiHistory h;
+        // Each list as far as both the file and this version know it.
+        const double* v = values.data();
+        auto take = [&v](const auto& fields, size_t n) {
+            for (size_t k = 0; k < n && k < fields.size(); ++k) *fields[k] = v[k];
+            v += n;
+        };
+        take(savedMaterial(mat), header[2]);
+        take(savedHistory(h), header[3]);
+        const double* extra = v;
+        v += header[4];
+        if (header[4] > 0) h.plasFlag = static_cast<uint32>(extra[0]);
+        if (header[4] > 1) h.pertFlag = static_cast<uint32>(extra[1]);
+        if (header[4] > 2) h.open_ = extra[2];
+        if (header[4] > 3) h.openInc_ = extra[3];
+        if (header[4] > 4) h.slip_ = extra[4];
+        if (header[5] >= 3) {
+            activateEnergy();
+            energies_->etension_ = v[0];
+            energies_->ecompression_ = v[1];
+            energies_->eshear_ = v[2];
+        }
+
+        mat_ = YopiMaterial::intern(mat);
+        hist_ = h;
+        // The derived constants and table indices come back with initialize().
+        setValid(0);
+    }
+
+    // With stiffness-damaged set, a contact open by more than the elastic range
+    // in tension (uel_) reports the secant kn_ its tensile damage left, and,
+    // while it slips, no shear stiffness once the residual strengths leave it
+    // no shear capacity (cc + tan(friction + dilation) * residual tension <=
+    // 0): it then slips at zero shear force. A contact that is closing, or
+    // would close in a step twice the last one, reports the pristine values,
+    // as it reloads in compression along kn_initial_ whatever dc is: 3DEC may
+    // not ask again before it has closed. Reported values never drop below
+    // stiffness-floor (0.05 by default) of the pristine ones.
+    static double stiffnessFloor(const YopiMaterial& mat)
+    {
+        return mat.stiffness_floor_ > 0.0 ? std::min(mat.stiffness_floor_, 1.0) : 0.05;
+    }
+
+    static bool reportsDamaged(const YopiMaterial& mat, const YopiHistory& h)
+    {
+        return mat.stiffness_damaged_ && h.openInc_ >= 0.0 && h.open_ - 2.0 * h.openInc_ > mat.k_.uel_;
+    }
+
+    double JModelYopi::getMaxNormalStiffness() const
+    {
+        const YopiMaterial& mat = *mat_;
+        const double pristine = std::max(hist_.kn_, mat.kn_initial_);
+        if (!reportsDamaged(mat, hist_)) return pristine;
+        return std::max(hist_.kn_, stiffnessFloor(mat) * mat.kn_initial_);
+    }
+
+    double JModelYopi::getMaxShearStiffness() const
+    {
+        const YopiMaterial& mat = *mat_;
+        if (!reportsDamaged(mat, hist_) || !hist_.slip_) return mat.ks_;
+        const double ten = mat.res_tension_ + (mat.tension_ - mat.res_tension_) * ((1 - hist_.d_ts) + 1e-12);
+        if (hist_.cc - mat.k_.tan_friction_dil_ * ten > 0.0) return mat.ks_;
+        return stiffnessFloor(mat) * mat.ks_;
+    }
+
     void JModelYopi::run(uint32 dim, State* s)
     {
+        // A contact that ran in this initialize pass already starts a new
+        // cycle, and with it a new pass; of the contacts that see so, only
+        // the first moves the pass on.
+        uint64 pass = initializePass();
+        if (runPass_ == pass && initializePassCount.compare_exchange_strong(pass, pass + 1, std::memory_order_acq_rel))
+            ++pass;
+        runPass_ = pass;
         JointModel::run(dim, s);
+        // The energies take a pool slot only once tracking is requested
+        if (s->trackEnergy()) activateEnergy();
+        if (mat_->substep_tol_) substep(hist_, energies_, s);
+        else law(hist_, energies_, s);
+        if (trace_.tag_) trace(s);
+        if (yopiSnapshotDue(contactId_, snapshot_)) snapshot();
+        if (contactId_)
+            if (uint32 crossed = yopiCrackCrossing(crack_, hist_.dt, hist_.ds, hist_.dc))
+                yopiCrackSubmit(contactId_, crack_, crossed, s->area_);
+    }
+
+    void JModelYopi::setTraceTag(double tag)
+    {
+        if (tag == trace_.tag_) return;
+        trace_ = YopiTraceSlot(); // a new tag takes a new slot
+        trace_.tag_ = tag;
+    }
+
+    void JModelYopi::setContactId(uint64 id)
+    {
+        if (id == contactId_) return;
+        // What the old id handed over is not the new one's; the crack links
+        // and the trace are the contact's own and stay.
+        contactId_ = id;
+        snapshot_ = YopiSnapshotSlot();
+        crack_.crossed_ = 0;
+        crack_.generation_ = 0;
+    }
+
+    void JModelYopi::setCrackLinks(uint64 host, uint64 face, uint64 vertex)
+    {
+        crack_.host_ = host;
+        crack_.face_ = face;
+        crack_.vertex_ = vertex;
+    }
+
+    void JModelYopi::trace(const State* s)
+    {
+        YopiTraceRecord r;
+        r.value_[static_cast<uint32>(YopiTraceColumn::Un)] = s->normal_disp_;
+        r.value_[static_cast<uint32>(YopiTraceColumn::Us)] = s->shear_disp_.mag();
+        r.value_[static_cast<uint32>(YopiTraceColumn::Fn)] = s->normal_force_;
+        r.value_[static_cast<uint32>(YopiTraceColumn::Fs)] = s->shear_force_.mag();
+        r.value_[static_cast<uint32>(YopiTraceColumn::Dt)] = hist_.dt;
+        r.value_[static_cast<uint32>(YopiTraceColumn::Ds)] = hist_.ds;
+        r.value_[static_cast<uint32>(YopiTraceColumn::Dc)] = hist_.dc;
+        r.value_[static_cast<uint32>(YopiTraceColumn::Dts)] = hist_.d_ts;
+        r.value_[static_cast<uint32>(YopiTraceColumn::PeakNormal)] = hist_.peak_normal;
+        r.value_[static_cast<uint32>(YopiTraceColumn::ReloadFlag)] = hist_.reloadFlag;
+        r.state_ = s->state_;
+        yopiTraceAppend(trace_, r);
+    }
 
+    void JModelYopi::snapshot()
+    {
+        YopiSnapshotValues v;
+        v[static_cast<uint32>(YopiSnapshotField::Dt)] = hist_.dt;
+        v[static_cast<uint32>(YopiSnapshotField::Ds)] = hist_.ds;
+        v[static_cast<uint32>(YopiSnapshotField::Dc)] = hist_.dc;
+        v[static_cast<uint32>(YopiSnapshotField::Dts)] = hist_.d_ts;
+        v[static_cast<uint32>(YopiSnapshotField::TP)] = hist_.tP_;
+        v[static_cast<uint32>(YopiSnapshotField::SP)] = hist_.sP_;
+        yopiSnapshotSubmit(contactId_, snapshot_, v);
+    }
+
+    template <class P>
+    void JModelYopi::lawKernel(YopiHistory& h, Energies* e, State* s, const YopiCompression* c) const
+    {
+        const YopiMaterial& mat = *mat_;
+        YopiProfileScope prof(&s->state_);
+        if (h.dormant_ && dormantStep(h, e, s)) {
+            prof.hit(YopiBranch::Dormant);
+            return;
+        }
+        if (h.margin_ && !c && screenedStep(h, e, s)) {
+            prof.hit(YopiBranch::Screened);
+            return;
+        }
         bool jumptoDC = false;
         /* --- state indicator:                                  */
         /*     store 'now' info. as 'past' and turn 'now' info off ---*/
@@ -468,14 +996,18 @@ namespace jmodels
         s->state_ &= ~comp_now;
         uint32 IPlas = 0;
 
-        // Ensure energy structure is allocated once tracking is requested
-        activateEnergy();
-
-        if (!s->area_) return;
+        if (!s->area_) {
+            h.dormant_ = 0.0;
+            h.margin_ = 0.0;
+            return;
+        }
+        // Conditions of dormantStep() at the start of the step
+        const bool settled = s->state_ != 0;
+        const bool quiet = isZero(s->shear_force_) && isZero(s->shear_disp_inc_);
 
         //double kna = kn_ * s->area_;
-        double ksa = ks_ * s->area_;
-        double kn_comp_ = kn_initial_;
+        double ksa = mat.ks_ * s->area_;
+        double kn_comp_ = mat.kn_initial_;
 
         if (!s->state_) {
             s->working_[Dqs] = 0.0;
@@ -484,11 +1016,12 @@ namespace jmodels
             s->working_[Dqc] = 0.0;
             s->working_[5] = 0.0;
         }
-        double ucel_ = n_ * compression_ / kn_comp_;
+        const YopiMaterial::Constants& k = mat.k_;
+        double ucel_ = k.ucel_;
 
         // normal force
         double fn0 = s->normal_force_;
-        double uel_limit = compression_ / kn_comp_ / 5.0;
+        double uel_limit = k.uel_limit_;
         double fn_old = s->normal_force_;          // force at start of step
         DVect3 fs_old = s->shear_force_;          // force at start of step
         double fn_new = fn_old;                    // we will modify this local only
@@ -503,48 +1036,58 @@ namespace jmodels
         constexpr double kEps = std::numeric_limits<double>::epsilon();
 
         //Calculate elastic limit
-        double fel_limit = compression_ / 5.0;
-        double fpeak = compression_;
+        double fel_limit = k.fel_limit_;
+        double fpeak = mat.compression_;
         //double ftemp = 0.0;        
 
         // --- TENSION BRANCH --------------------------------------------------
         // Opening (dn_ < 0) = loading; Closing (dn_ > 0) = unloading (secant)        
         if (un_current < 0.0) {
             // --- TENSION BRANCH ---
+            prof.hit(YopiBranch::Tension);
 
             // update tensile history as before
-            if (dn_ < 0.0 && un_current <= un_hist_ten) {
-                un_hist_ten = un_current;  // or un_new; same as your original intent
-                s->working_[D_un_hist] = un_hist_ten;
+            if (dn_ < 0.0 && un_current <= h.un_hist_ten) {
+                h.un_hist_ten = un_current;  // or un_new; same as your original intent
+                s->working_[D_un_hist] = h.un_hist_ten;
             }
 
             // compute the tensile increment using kn_
-            const double kna_t = kn_ * s->area_;  // kn_ may have been degraded by damage
+            const double kna_t = h.kn_ * s->area_;  // kn_ may have been degraded by damage
             double dfn_t = kna_t * dn_;     // Fn in tension
 
             fn_new += dfn_t;                   // <-- THIS is what must exist            
         }
+        else if (c) {
+            // compression branch already evaluated for this contact
+            prof.hit(YopiBranch::CompressionKernel);
+            if (c->jumptoDC_) prof.hit(YopiBranch::DamagedCapJump);
+            fn_new = c->fn_;
+            jumptoDC = c->jumptoDC_;
+        }
         else {//COMPRESSION BRANCH --------------------------------------------------
             // Update unloading history
-            if (un_current >= un_hist_comp && reloadFlag == 0 && dn_ >= 0.0) {
-                un_hist_comp = un_current;   // record current displacement for unloading
+            if (un_current >= h.un_hist_comp && h.reloadFlag == 0 && dn_ >= 0.0) {
+                h.un_hist_comp = un_current;   // record current displacement for unloading
             }
             // ---------------- Monotonic loading in compression ----------------
-            if ((sn_+dsn_ >= peak_normal) && ((s->state_ & comp_past) == 0)) {
+            if ((sn_+dsn_ >= h.peak_normal) && ((s->state_ & comp_past) == 0)) {
                 double kna_el = kn_comp_ * s->area_;
-                reloadFlag = 0;
+                h.reloadFlag = 0;
 
                 if (un_current <= uel_limit) {
                     // Purely elastic loading
+                    prof.hit(YopiBranch::ElasticCompression);
                     double dfn = kna_el * dn_;
                     fn_new += dfn;
-                    fc_current = fn_new / s->area_;
-                    peak_normal = fc_current;
+                    h.fc_current = fn_new / s->area_;
+                    h.peak_normal = h.fc_current;
                 }
-                else if (!s->state_ || sn_+dsn_ < compression_) {
+                else if (!s->state_ || sn_+dsn_ < mat.compression_) {
                     // Onto nonlinear compression envelope
+                    prof.hit(YopiBranch::EnvelopeLoading);
                     double x_new = (un_current - uel_limit) / ucel_;
-                    plasFlag = 1;
+                    h.plasFlag = 1;
 
                     // 2x - x^2 >= 0 guard
                     auto safe_sqrt_expr = [](double x)->double {
@@ -566,39 +1109,42 @@ namespace jmodels
                         fn_new = fenv * s->area_;
                     }
 
-                    fc_current = fn_new / s->area_;
-                    plasFlag = 1;
-                    if (dn_ >= 0.0) peak_normal = fc_current;
+                    h.fc_current = fn_new / s->area_;
+                    h.plasFlag = 1;
+                    if (dn_ >= 0.0) h.peak_normal = h.fc_current;
                 }
             }
             // ---------------- Unloading / reloading in compression -------------
             else {
                 // Unloading in compression
-                double mult = (dc > 0.0) ? 2.5 : 1.0;
-                double r = (un_hist_comp / ucel_);
+                double mult = (h.dc > 0.0) ? 2.5 : 1.0;
+                double r = (h.un_hist_comp / ucel_);
                 double un_plastic_rat = 0.47 * mult * r * r + 0.5 * mult * r;
                 double un_plastic = un_plastic_rat * ucel_;
-                if (dn_ < 0.0 && (plasFlag == 1)) { // unloading from compression
-                    if (un_current >= un_hist_comp * 0.985)
-                        pertFlag = 2;
+                if (dn_ < 0.0 && (h.plasFlag == 1)) { // unloading from compression
+                    if (un_current >= h.un_hist_comp * 0.985)
+                        h.pertFlag = 2;
                     else
-                        pertFlag = 0;
-                    if (sn_+dsn_ > 0.0 && (pertFlag == 0)) {
+                        h.pertFlag = 0;
+                    if (sn_+dsn_ > 0.0 && (h.pertFlag == 0)) {
                         // Nonlinear unloading (Xeta curve)
+                        prof.hit(YopiBranch::XetaUnloading);
                         double k1 = 1.5 * kn_comp_;
-                        double k2 = 0.15 * kn_comp_ / std::pow(1.0 + (un_hist_comp / ucel_), 2);
+                        double k2 = 0.15 * kn_comp_ / std::pow(1.0 + (h.un_hist_comp / ucel_), 2);
 
                         // Es
-                        double denom_Es = (un_hist_comp - un_plastic);
-                        if (std::abs(denom_Es) < kEps)
+                        double denom_Es = (h.un_hist_comp - un_plastic);
+                        if (std::abs(denom_Es) < kEps) {
                             denom_Es = (denom_Es >= 0 ? kEps : -kEps);
-                        double Es = peak_normal / denom_Es;
+                            prof.hit(YopiBranch::XetaGuard);
+                        }
+                        double Es = h.peak_normal / denom_Es;
 
                         // Xeta
-                        double denom_X = (un_plastic - un_hist_comp);
+                        double denom_X = (un_plastic - h.un_hist_comp);
 
 
-                        double Xeta = (un_new - un_hist_comp) / denom_X;
+                        double Xeta = (un_new - h.un_hist_comp) / denom_X;
                         // clamp Xeta to avoid extreme stiffness
                         //Xeta = std::max(-1.0, std::min(0.0, Xeta));
 
@@ -607,62 +1153,68 @@ namespace jmodels
                         double B2 = B1 - B3;
 
                         double denom_R = 1.0 + B2 * Xeta + B3 * Xeta * Xeta;
-                        if (std::abs(denom_R) < kEps)
+                        if (std::abs(denom_R) < kEps) {
                             denom_R = (denom_R >= 0 ? kEps : -kEps);
+                            prof.hit(YopiBranch::XetaGuard);
+                        }
 
                         double numer_R = (B1 * Xeta + Xeta * Xeta);
-                        double fm = peak_normal + (1e-12 - peak_normal) * (numer_R / denom_R);
+                        double fm = h.peak_normal + (1e-12 - h.peak_normal) * (numer_R / denom_R);
 
                         if (!std::isfinite(fm)) {
                             // fallback: linear elastic unloading
-                            fm = peak_normal + kn_comp_ * (un_new - un_hist_comp);
+                            fm = h.peak_normal + kn_comp_ * (un_new - h.un_hist_comp);
                         }
                         if (sn_ < 0.0) {
                             fm += 0.0;
                         }
                         fn_new = fm * s->area_;
-                        fc_current = fm;
+                        h.fc_current = fm;
 
                         // record for reloading
-                        reloadFlag = 1;
-                        fm_ro = fm;
-                        un_ro = un_current;
+                        h.reloadFlag = 1;
+                        h.fm_ro = fm;
+                        h.un_ro = un_current;
                     }
                     else if (sn_+ dsn_ < 0.0) {
                         // unload all the way to zero
-                        fm_ro = 0.0;
-                        reloadFlag = 1;
+                        prof.hit(YopiBranch::UnloadToZero);
+                        h.fm_ro = 0.0;
+                        h.reloadFlag = 1;
                         fn_new += 0.0;
-                        fc_current = 0.0;
+                        h.fc_current = 0.0;
                     }
                     else {
                         // purely elastic unloading from peak
-                        fm_ro = 0.0;
-                        reloadFlag = 0;
+                        prof.hit(YopiBranch::ElasticCompression);
+                        h.fm_ro = 0.0;
+                        h.reloadFlag = 0;
                         double dfn = kn_comp_ * s->area_ * dn_;
                         fn_new += dfn;
-                        fc_current = fn_new / s->area_;
+                        h.fc_current = fn_new / s->area_;
                     }
                 }
                 else {
                     // Reloading branch
-                    if (un_current < un_ro && dn_ >= 0.0) {
+                    if (un_current < h.un_ro && dn_ >= 0.0) {
                         // hold force; just flag reloading
-                        reloadFlag = 1;
-                        fc_current = fn_new / s->area_;
+                        prof.hit(YopiBranch::Hold);
+                        h.reloadFlag = 1;
+                        h.fc_current = fn_new / s->area_;
                     }
-                    else if (reloadFlag == 1 && dn_ >= 0.0) {
-                        double denom = un_hist_comp;
-                        if (un_ro != 0.0)
-                            denom = un_hist_comp - un_ro;
+                    else if (h.reloadFlag == 1 && dn_ >= 0.0) {
+                        prof.hit(YopiBranch::Reloading);
+                        double denom = h.un_hist_comp;
+                        if (h.un_ro != 0.0)
+                            denom = h.un_hist_comp - h.un_ro;
 
-                        double k_re = kn_initial_;
+                        double k_re = mat.kn_initial_;
                         double fm_re = 0.0;
                         double beta = 1.0;
 
-                        double un_rec = (un_hist_comp - un_ro) / ucel_;
+                        double un_rec = (h.un_hist_comp - h.un_ro) / ucel_;
                         double un_rec_nz = std::max(0.0, un_rec);
-                        if (un_hist_comp < ucel_) {
+                        if (h.un_hist_comp < ucel_) {
                             beta = 1.0 / (1.0 + 0.20 * std::sqrt(un_rec_nz));
                         }
                         else {
@@ -671,23 +1223,24 @@ namespace jmodels
 
                         if (std::abs(denom) < 1e-12) {
                             k_re = kn_comp_;
-                            fm_re = fm_ro;
+                            fm_re = h.fm_ro;
                         }
                         else {
-                            k_re = (beta * peak_normal - fm_ro) / denom;
-                            fm_re = fm_ro + k_re * (un_current - un_ro);
+                            k_re = (beta * h.peak_normal - h.fm_ro) / denom;
+                            fm_re = h.fm_ro + k_re * (un_current - h.un_ro);
                         }
 
-                        if (dc > 0.0) {
+                        if (h.dc > 0.0) {
                             // damaged compression cap
-                            double fc_env = compression_ * (1.0 - dc);
+                            double fc_env = mat.compression_ * (1.0 - h.dc);
                             if (fm_re < fc_env) {
                                 fn_new = fm_re * s->area_;
-                                fc_current = fm_re;
+                                h.fc_current = fm_re;
                             }
                             else {
-                                reloadFlag = 0;
+                                h.reloadFlag = 0;
                                 jumptoDC = true;
+                                prof.hit(YopiBranch::DamagedCapJump);
                             }
                         }
                         else {
@@ -700,23 +1253,24 @@ namespace jmodels
 
                             if (fm_re < fc_env) {
                                 fn_new = fm_re * s->area_;
-                                fc_current = fm_re;
+                                h.fc_current = fm_re;
                             }
                             else {
                                 fn_new = fc_env * s->area_;
-                                fc_current = fc_env;
-                                reloadFlag = 0;
+                                h.fc_current = fc_env;
+                                h.reloadFlag = 0;
                             }
                         }
 
-                        fc_current = fn_new / s->area_;
+                        h.fc_current = fn_new / s->area_;
                     }
                     else {
                         // Purely elastic unloading
+                        prof.hit(YopiBranch::ElasticCompression);
                         double dfn = kn_comp_ * s->area_ * dn_;
                         fn_new += dfn;
-                        fc_current = fn_new / s->area_;
-                        reloadFlag = 0;
+                        h.fc_current = fn_new / s->area_;
+                        h.reloadFlag = 0;
                     } //unloading  
                 }
             }
@@ -738,95 +1292,90 @@ namespace jmodels
 
         double ten;
         double comp = 0.0;
-        if (!res_comp_) res_comp_ = 0.0;
-        double mid_comp = res_comp_ + (compression_ - res_comp_) / 2.0;
-        double beta_ = ucel_ * res_comp_; //Coefficient for calculating intermediate ratio
-        double kappa_ = ucel_ * compression_;
-        double gamma_ = 2.0;
-        m_ = (G_c - 0.5 * (pow(compression_, 2) / (9 * kn_comp_)) - 0.5 * (ucel_ - uel_limit) * 1.3 * compression_
-            + 0.75 * kappa_ + 0.25 * beta_) / (0.25 * kappa_ * (2 + gamma_) - 0.25 * beta_ * (2 - 3 * gamma_));
-        if (m_ < 1.5) m_ = 1.5;
-        double ucul_ = m_ * ucel_;
+        double mid_comp = k.mid_comp_;
+        h.m_ = k.m_;
+        double ucul_ = k.ucul_;
 
         //Define the softening on compressive strength
         if (s->state_ || jumptoDC) {
             if ((un_current >= ucel_) && (un_current < ucul_)) {
-                dc = (1 - (mid_comp / compression_)) * pow((un_current - ucel_) / (ucul_ - ucel_), 2);
-                if (dn_ > 0.0) peak_normal = std::min(peak_normal, compression_ * (1 - dc));
+                h.dc = (1 - (mid_comp / mat.compression_)) * pow((un_current - ucel_) / (ucul_ - ucel_), 2);
+                if (dn_ > 0.0) h.peak_normal = std::min(h.peak_normal, mat.compression_ * (1 - h.dc));
             }
             else if (un_current >= ucul_) {
-                double alpha = 2 * (mid_comp - compression_) / (ucul_ - ucel_);
-                dc = 1 - (res_comp_ / compression_) - ((mid_comp - res_comp_) / compression_) * exp(alpha * (un_current - ucul_) / (mid_comp - res_comp_));
-                if (dn_ > 0.0) peak_normal = std::min(peak_normal, compression_ * (1 - dc));
+                double alpha = 2 * (mid_comp - mat.compression_) / (ucul_ - ucel_);
+                h.dc = 1 - (mat.res_comp_ / mat.compression_) - ((mid_comp - mat.res_comp_) / mat.compression_) * exp(alpha * (un_current - ucul_) / (mid_comp - mat.res_comp_));
+                if (dn_ > 0.0) h.peak_normal = std::min(h.peak_normal, mat.compression_ * (1 - h.dc));
             }
             else {
-                dc = 0.0;
+                h.dc = 0.0;
             }
             // Clamp compressive damage to avoid infinite approach to 1
-            dc = clampDamage(dc);
-            dc_hist = clampDamage(dc_hist);
-            if (dc >= dc_hist) dc_hist = dc;
-            else dc = dc_hist;
+            h.dc = clampDamage(h.dc);
+            h.dc_hist = clampDamage(h.dc_hist);
+            if (h.dc >= h.dc_hist) h.dc_hist = h.dc;
+            else h.dc = h.dc_hist;
 
             s->normal_force_inc_ = 0;
             s->shear_force_inc_ = DVect3(0, 0, 0);
-            comp = compression_ * (1 - dc) * s->area_;
+            comp = mat.compression_ * (1 - h.dc) * s->area_;
         }
         else {
-            dc = 0.0;
-            comp = compression_ * (1 - dc) * s->area_;
+            h.dc = 0.0;
+            comp = mat.compression_ * (1 - h.dc) * s->area_;
         }
 
-        fc_current = comp / s->area_;
-        uel_ = tension_ / kn_initial_;
+        h.fc_current = comp / s->area_;
+        h.uel_ = k.uel_;
         //Define the softening tensile strength
         if (s->state_)
         {
             bool sign = std::signbit(dn_);
             if (sign) {
-                if (iTension_d_) {
-                    tP_ = s->normal_disp_ / (tension_ / kn_);
-                    dt = s->getYFromX(iTension_d_, tP_); //if table_dt is provided.
+                if constexpr (P::tension_ == YopiSoftening::Table) {
+                    h.tP_ = s->normal_disp_ / (mat.tension_ / h.kn_);
+                    h.dt = tableY(mat.dtSample_.get(), s, mat.iTension_d_, h.tP_); //if table_dt is provided.
                 }
-                else if (G_I) {
-                    tP_ = s->normal_disp_ - (tension_ / kn_initial_);
-                    dt = 1.0 - exp(-tension_ / G_I * (s->normal_disp_ - (tension_ / kn_initial_))); //Exponential Softening
+                else if constexpr (P::tension_ == YopiSoftening::Exponential) {
+                    h.tP_ = s->normal_disp_ - (mat.tension_ / mat.kn_initial_);
+                    h.dt = 1.0 - exp(-mat.tension_ / mat.G_I * (s->normal_disp_ - (mat.tension_ / mat.kn_initial_))); //Exponential Softening
                 }
             }
-            if (dt_hist < dt) dt_hist = dt;
-            else dt = dt_hist;
+            if (h.dt_hist < h.dt) h.dt_hist = h.dt;
+            else h.dt = h.dt_hist;
             // Clamp tensile damage to avoid infinite approach to 1
-            dt = clampDamage(dt);
-            dt_hist = clampDamage(dt_hist);
-            d_ts = clampDamage(dt + ds - dt * ds);
+            h.dt = clampDamage(h.dt);
+            h.dt_hist = clampDamage(h.dt_hist);
+            h.d_ts = clampDamage(h.dt + h.ds - h.dt * h.ds);
             // use secant-to-origin stiffness referenced to the initial elastic kn_initial_
             // Tension softening guard
-            double uel_t = tension_ / kn_initial_;
+            double uel_t = k.uel_;
             if (un_current < (-uel_t)) {
-                if (std::abs(un_hist_ten) > 1e-9) {
+                if (std::abs(h.un_hist_ten) > 1e-9) {
                     if (sign) {
-                        kn_ = (tension_ * (1.0 - d_ts) / -un_hist_ten);
-                        if (kn_ <= 1)
+                        h.kn_ = (mat.tension_ * (1.0 - h.d_ts) / -h.un_hist_ten);
+                        if (h.kn_ <= 1)
                         {
-                            kn_ = 1e-6;
+                            h.kn_ = 1e-6;
                         }
                     }
                 }
             }
         }
-        ten = -(res_tension_ + (tension_ - res_tension_) * ((1 - d_ts) + 1e-12)) * s->area_;
+        ten = -(mat.res_tension_ + (mat.tension_ - mat.res_tension_) * ((1 - h.d_ts) + 1e-12)) * s->area_;
 
         // check tensile failure
         bool tenflag = false;
         double f1;
         f1 = s->normal_force_ - ten;
         // Change the criterion to f1 criterion for tensile instead
-        if (f1 <= 0)
+        const bool corrected = f1 <= 0;
+        if (corrected)
         {
             tenflag = tensionCorrection(s, &IPlas, ten, tenflag);
         }
         // Compressive cap "failure" flag: when dc is near fully damaged in compression
-        const bool compflag = (dc >= 0.99);
+        const bool compflag = (h.dc >= 0.99);
         // shear force
         if (!tenflag && !compflag)
         {
@@ -835,65 +1384,64 @@ namespace jmodels
 
             //Because the normal force is already in negative anyway, we don't have to change the signs
             double dil_0 = 0.0;
-            if (dilation_) dil_0 = dilation_;
-            else dil_0 = 0.0;
-            double fsmax = (cohesion_ * s->area_ + tan((friction_ + dil_0) * dDegRad) * s->normal_force_);
+            if constexpr (P::dilation_) dil_0 = mat.dilation_;
+            double fsmax = (mat.cohesion_ * s->area_ + k.tan_friction_dil_ * s->normal_force_);
             double fsm = s->shear_force_.mag();
             double f2;
-            double tmax = cohesion_ + tan((friction_ + dil_0) * dDegRad) * s->normal_force_ / s->area_;
-            double usel = tmax / ks_;
+            double tmax = mat.cohesion_ + k.tan_friction_dil_ * s->normal_force_ / s->area_;
+            double usel = tmax / mat.ks_;
             if (fsmax < 0.0) fsmax = 0.0;
             if (s->state_) {
                 //Calculate max shear stress                            
 
                 ////Exponential Softening                              
-                if (iShear_d_) {
-                    sP_ = s->shear_disp_.mag() / usel;
-                    ds = s->getYFromX(iShear_d_, sP_);
+                if constexpr (P::shear_ == YopiSoftening::Table) {
+                    h.sP_ = s->shear_disp_.mag() / usel;
+                    h.ds = tableY(mat.dsSample_.get(), s, mat.iShear_d_, h.sP_);
                 }
-                else if (G_II) {
-                    sP_ = s->shear_disp_.mag() - usel;
-                    ds = 1 - exp(-cohesion_ / G_II * (s->shear_disp_.mag() - usel));
+                else if constexpr (P::shear_ == YopiSoftening::Exponential) {
+                    h.sP_ = s->shear_disp_.mag() - usel;
+                    h.ds = 1 - exp(-mat.cohesion_ / mat.G_II * (s->shear_disp_.mag() - usel));
                 }
-                if (ds >= ds_hist) ds_hist = ds;
-                else ds = ds_hist;
+                if (h.ds >= h.ds_hist) h.ds_hist = h.ds;
+                else h.ds = h.ds_hist;
 
                 // Clamp shear damage to avoid infinite approach to 1
-                ds = clampDamage(ds);
-                ds_hist = clampDamage(ds_hist);
-                d_ts = clampDamage(dt + ds - dt * ds);
-                double resamueff = tan_res_friction_;
-                if (!resamueff) resamueff = tan_friction_;
-                cc = res_cohesion_ + (cohesion_ - res_cohesion_) * (1 - d_ts);
+                h.ds = clampDamage(h.ds);
+                h.ds_hist = clampDamage(h.ds_hist);
+                h.d_ts = clampDamage(h.dt + h.ds - h.dt * h.ds);
+                double resamueff = mat.tan_res_friction_;
+                if (!resamueff) resamueff = mat.tan_friction_;
+                h.cc = mat.res_cohesion_ + (mat.cohesion_ - mat.res_cohesion_) * (1 - h.d_ts);
 
                 //Store the current friction angle
                 double tc = 0.0;
 
-                double tan_friction_c = tan_res_friction_ + (tan_friction_ - tan_res_friction_) * (1 - ((cohesion_ - cc) / (cohesion_ - res_cohesion_)));
-                if (tan_friction_c) friction_current_ = atan(tan_friction_c) / dDegRad;
-                else friction_current_ = atan(tan_friction_) / dDegRad;
-                friction_current_ = (friction_ + dil_0);
-                tc = cc * s->area_ + s->normal_force_ * tan_friction_c;
+                double tan_friction_c = mat.tan_res_friction_ + (mat.tan_friction_ - mat.tan_res_friction_) * (1 - ((mat.cohesion_ - h.cc) / (mat.cohesion_ - mat.res_cohesion_)));
+                if (tan_friction_c) h.friction_current_ = atan(tan_friction_c) / dDegRad;
+                else h.friction_current_ = atan(mat.tan_friction_) / dDegRad;
+                h.friction_current_ = (mat.friction_ + dil_0);
+                tc = h.cc * s->area_ + s->normal_force_ * tan_friction_c;
 
-                if (dilation_) {
+                if constexpr (P::dilation_) {
                     if (!s->state_) {
-                        tc = cc * s->area_ + s->normal_force_ * tan((friction_ + (dil_0)) * dDegRad);
+                        tc = h.cc * s->area_ + s->normal_force_ * k.tan_friction_dil_;
                     }
-                    else if (dc == 0.0) {
+                    else if (h.dc == 0.0) {
                         double usm = s->shear_disp_.mag() - usel;
-                        double dilation_c = tan_dilation_ * (1 - (usm) / s_zero_dilation_) * exp(-delta * ((usm)));
+                        double dilation_c = mat.tan_dilation_ * (1 - (usm) / mat.s_zero_dilation_) * exp(-h.delta * ((usm)));
                         if (dilation_c < 0.0) dilation_c = 0.0;
-                        tc = cc * s->area_ + s->normal_force_ * tan((friction_ + (atan(dilation_c) / dDegRad)) * dDegRad);
-                        dilation_current = (atan(dilation_c) / dDegRad);
-                        friction_current_ = (friction_ + (atan(dilation_c) / dDegRad));
+                        tc = h.cc * s->area_ + s->normal_force_ * tan((mat.friction_ + (atan(dilation_c) / dDegRad)) * dDegRad);
+                        h.dilation_current = (atan(dilation_c) / dDegRad);
+                        h.friction_current_ = (mat.friction_ + (atan(dilation_c) / dDegRad));
                         double dusm = s->shear_disp_inc_.mag();
-                        if (ddil > 0.0 || dc == 0.0) {
-                            un_dilatant += dilation_c * dusm;
-                            s->normal_force_ += kn_ * s->area_ * dilation_c * dusm;
+                        if (h.ddil > 0.0 || h.dc == 0.0) {
+                            h.un_dilatant += dilation_c * dusm;
+                            s->normal_force_ += h.kn_ * s->area_ * dilation_c * dusm;
                         }
                     }
                     else {
-                        tc = cc * s->area_ + s->normal_force_ * tan((friction_)*dDegRad);
+                        tc = h.cc * s->area_ + s->normal_force_ * mat.tan_friction_;
                     }
                 }
                 fsmax = tc;
@@ -901,31 +1449,31 @@ namespace jmodels
             }
             else {
                 f2 = fsm - fsmax;
-                cc = cohesion_;
-                friction_current_ = friction_ + dil_0;
+                h.cc = mat.cohesion_;
+                h.friction_current_ = mat.friction_ + dil_0;
             }// if (state)
 
             //Check if slip
             if (f2 >= 0.0)
             {
+                prof.hit(YopiBranch::ShearSlip);
                 shearCorrection(s, &IPlas, fsm, fsmax, usel);
                 if (s->normal_disp_ < 0.0) {
                     //Check f3
-                    double f3;
-                    f3 = Cnn * pow(s->normal_force_, 2) + Css * pow(s->shear_force_.mag(), 2) + Cn * s->normal_force_ - pow(comp, 2);
-                    if (f3 >= 0.0) {
-                        compCorrection(s, &IPlas, comp);
+                    if (capF3<P>(mat, s, comp) >= 0.0) {
+                        prof.hit(YopiBranch::CapCorrection);
+                        compCorrection(h, s, &IPlas, comp);
                     }
                 }
             }// if (f2)
             //Check compressive failure (compressive cap)
             if (s->normal_disp_ < 0.0) {
                 //Check f3
-                double f3;
-                f3 = Cnn * pow(s->normal_force_, 2) + Css * pow(s->shear_force_.mag(), 2) + Cn * s->normal_force_ - pow(comp, 2);
-                if (f3 >= 0.0) {
-                    compCorrection(s, &IPlas, comp);
+                if (capF3<P>(mat, s, comp) >= 0.0) {
+                    prof.hit(YopiBranch::CapCorrection);
+                    compCorrection(h, s, &IPlas, comp);
                     if (f2 >= 0.0) {
+                        prof.hit(YopiBranch::ShearCapCorrection);
                         shearCorrection(s, &IPlas, fsm, fsmax, usel);
                     }
                 }
@@ -937,60 +1485,268 @@ namespace jmodels
             s->shear_force_ = DVect3(0.0, 0.0, 0.0);
         }
 
-        // --- Energy accumulation (normal tension / compression + shear) ---
-        if (energies_) {
-            // New forces at end of the step
-            const double fn_new_x = s->normal_force_;
-            const DVect3 fs_new = s->shear_force_;
-
-            // Displacement increments for this step
-            // In your convention: normal_disp < 0 in compression.
-            // We define du_n > 0 for compression by flipping the sign.
-            const double du_n = -s->normal_disp_inc_;   // + = compression increment
-            const DVect3 du_s = s->shear_disp_inc_;     // shear slip increment
-
-            // Mean forces over the step
-            const double fn_mean = 0.5 * (fn_old + fn_new_x);
-            const DVect3 fs_mean(
-                0.5 * (fs_old.x() + fs_new.x()),
-                0.5 * (fs_old.y() + fs_new.y()),
-                0.5 * (fs_old.z() + fs_new.z())
-            );
-            // Incremental normal work (positive = storing elastic energy,
-            // negative = releasing it during unloading / damage).
-            const double dWn = fn_mean * du_n;
-
-            // Split normal energy into tension vs compression based on sign of mean force:
-            //   fn_mean >= 0  -> compression branch
-            //   fn_mean < 0   -> tension branch
-            if (fn_mean >= 0.0) {
-                energies_->ecompression_ += dWn;
-            }
-            else {
-                energies_->etension_ += dWn;
+        if constexpr (P::energy_) accumulateEnergies(e, fn_old, fs_old, s);
+        checkForces(s);
+
+        // Dormant from the next step on if this one left the contact so, see
+        // dormantStep().
+        h.dormant_ = (settled && quiet && corrected && un_current < 0.0 && h.dt_hist == 1.0 && h.d_ts == 1.0)
+                   ? s->area_ : 0.0;
+        // A step that yielded nowhere is screened from the next one on, see
+        // screenedStep().
+        h.margin_ = s->state_ ? 0.0 : yieldMargin(comp, ten, s);
+        h.marginArea_ = s->area_;
+        h.open_ = s->normal_disp_ > 0.0 ? s->normal_disp_ : 0.0;
+        h.openInc_ = s->normal_disp_inc_;
+        h.slip_ = s->state_ & slip_now ? 1.0 : 0.0;
+    }//run
+
+
+    namespace
+    {
+        YopiSoftening softening(const void* table, double G)
+        {
+            return table ? YopiSoftening::Table : G != 0.0 ? YopiSoftening::Exponential : YopiSoftening::None;
+        }
+
+        // Calls \a f with \a v as a std::integral_constant.
+        template <class F>
+        void withSoftening(YopiSoftening v, F f)
+        {
+            switch (v) {
+            case YopiSoftening::Table: f(std::integral_constant<YopiSoftening, YopiSoftening::Table>()); return;
+            case YopiSoftening::Exponential: f(std::integral_constant<YopiSoftening, YopiSoftening::Exponential>()); return;
+            default: f(std::integral_constant<YopiSoftening, YopiSoftening::None>()); return;
             }
+        }
+        template <class F>
+        void withBool(bool v, F f)
+        {
+            if (v) f(std::true_type());
+            else f(std::false_type());
+        }
+    }
+
+    // The same tests law() made on every step before it was a template.
+    void JModelYopi::selectLaw(YopiMaterial& m)
+    {
+        const bool defaultCap = m.Cnn == 1.0 && m.Css == 1.0 && m.Cn == 0.0;
+        withSoftening(softening(m.iTension_d_, m.G_I), [&](auto t) {
+            withSoftening(softening(m.iShear_d_, m.G_II), [&](auto sh) {
+                withBool(m.dilation_ != 0.0, [&](auto d) {
+                    withBool(defaultCap, [&](auto cap) {
+                        typedef YopiLawPolicy<decltype(t)::value, decltype(sh)::value, decltype(d)::value,
+                                              decltype(cap)::value, false> Plain;
+                        typedef YopiLawPolicy<decltype(t)::value, decltype(sh)::value, decltype(d)::value,
+                                              decltype(cap)::value, true> Tracked;
+                        m.law_[0] = &lawEntry<Plain>;
+                        m.law_[1] = &lawEntry<Tracked>;
+                    });
+                });
+            });
+        });
+    }
 
-            // Incremental shear work: fs  du_s
-            const double dWs =
-                fs_mean.x() * du_s.x() +
-                fs_mean.y() * du_s.y() +
-                fs_mean.z() * du_s.z();
+    // A contact failed in tension (dt_hist, d_ts at 1) that stays open, with no
+    // shear force nor shear displacement increment, leaves everything but the
+    // normal terms of law() as it found them: ds, cc, the friction and dilation
+    // terms and the slip decision only depend on the residual tension force,
+    // the shear displacement and the material. law() marks the contact with its
+    // area (h.dormant_) after such a step made from a settled state, and the
+    // next step of the same area then only needs the normal terms, computed
+    // here as law() does. Anything else (closing past the residual tension,
+    // shear, a different area, a state reset by the host) returns false before
+    // touching the contact and the full law runs.
+    bool JModelYopi::dormantStep(YopiHistory& h, Energies* e, State* s) const
+    {
+        if (h.dormant_ != s->area_ || !s->area_) return false;
+        if (!(s->state_ & tension_now)) return false;
+        if (!isZero(s->shear_force_) || !isZero(s->shear_disp_inc_)) return false;
+        const double un_current = -s->normal_disp_;
+        if (!(un_current < 0.0)) return false;
+
+        const YopiMaterial& mat = *mat_;
+        const YopiMaterial::Constants& k = mat.k_;
+        const double dn_ = -s->normal_disp_inc_;
+        const double fn_old = s->normal_force_;
+        const DVect3 fs_old = s->shear_force_;
+        double fn_new = fn_old;
+        fn_new += h.kn_ * s->area_ * dn_;
+        // d_ts stays 1: the tension strength is down to its residual
+        double ten = -(mat.res_tension_ + (mat.tension_ - mat.res_tension_) * ((1 - h.d_ts) + 1e-12)) * s->area_;
+        if (!(fn_new - ten <= 0)) return false;
+
+        // The step repeats the plastic indicators of the one before.
+        const uint32 now = s->state_ & (slip_now | tension_now);
+        if (s->state_ & slip_now) s->state_ |= slip_past;
+        s->state_ &= ~slip_now;
+        s->state_ |= tension_past;
+        s->state_ &= ~tension_now;
+        if (s->state_ & comp_now) s->state_ |= comp_past;
+        s->state_ &= ~comp_now;
 
-            energies_->eshear_ += dWs;
+        if (dn_ < 0.0 && un_current <= h.un_hist_ten) {
+            h.un_hist_ten = un_current;
+            s->working_[D_un_hist] = h.un_hist_ten;
+        }
+        s->normal_force_inc_ = fn_new - fn_old;
+        s->normal_force_ = fn_new;
+        s->dnop_ = s->normal_disp_inc_;
+        if ((fn_old > 0.0) &&
+            (s->normal_force_ <= 0.0) &&
+            (s->normal_force_inc_ < 0.0))
+        {
+            s->dnop_ = -s->normal_disp_inc_ * fn_old / s->normal_force_inc_;
+            if (s->dnop_ > s->normal_disp_inc_) s->dnop_ = s->normal_disp_inc_;
         }
 
-        // At end of run()
-        if (std::isnan(s->normal_force_)) {
-            throw std::runtime_error("NaN detected in JModelYopi::run normal side");
+        // Compressive softening, open contact
+        h.dc = 0.0;
+        h.dc_hist = clampDamage(h.dc_hist);
+        if (h.dc >= h.dc_hist) h.dc_hist = h.dc;
+        else h.dc = h.dc_hist;
+        double comp = mat.compression_ * (1 - h.dc) * s->area_;
+        h.fc_current = comp / s->area_;
+
+        // Tensile softening: dt and d_ts are at 1 already
+        if (std::signbit(dn_)) {
+            if (mat.iTension_d_) h.tP_ = s->normal_disp_ / (mat.tension_ / h.kn_);
+            else if (mat.G_I) h.tP_ = s->normal_disp_ - (mat.tension_ / mat.kn_initial_);
+            if (un_current < (-k.uel_) && std::abs(h.un_hist_ten) > 1e-9) {
+                h.kn_ = (mat.tension_ * (1.0 - h.d_ts) / -h.un_hist_ten);
+                if (h.kn_ <= 1) h.kn_ = 1e-6;
+            }
         }
-        if (std::isnan(s->normal_force_) || std::isnan(s->shear_force_.x())
-            || std::isnan(s->shear_force_.y()) || std::isnan(s->shear_force_.z())) {
-            throw std::runtime_error("NaN detected in JModelYopi::run shear side");
+
+        uint32 IPlas = 0;
+        bool tenflag = false;
+        tenflag = tensionCorrection(s, &IPlas, ten, tenflag);
+        if (!tenflag && !(h.dc >= 0.99)) {
+            // Elastic trial of zero, then shearCorrection() with fsm = 0 if the
+            // step before slipped
+            s->shear_force_inc_ = s->shear_disp_inc_ * -(mat.ks_ * s->area_);
+            s->shear_force_ += s->shear_force_inc_;
+            if (now & slip_now) {
+                s->shear_force_ *= 0.0;
+                s->state_ |= slip_now;
+                s->shear_force_inc_ = DVect3(0, 0, 0);
+            }
         }
-    }//run
+        else {
+            s->shear_force_inc_ = DVect3(0.0, 0.0, 0.0);
+            s->shear_force_ = DVect3(0.0, 0.0, 0.0);
+        }
+        h.open_ = s->normal_disp_;
+        h.openInc_ = s->normal_disp_inc_;
+        h.slip_ = s->state_ & slip_now ? 1.0 : 0.0;
+
+        accumulateEnergies(e, fn_old, fs_old, s);
+        checkForces(s);
+        return true;
+    }
 
+    // A contact that has never yielded (no state bits) and stays on the elastic
+    // compression branch (0 <= un <= uel_limit, at its peak stress) moves its
+    // forces linearly, and the only things law() decides on are the three
+    // surfaces f1, f2 and f3, whose shape does not change while nothing yields.
+    // yieldMargin() bounds the force distance from the end of a step to the
+    // nearest of them, and each step here spends its force increment (plus the
+    // rounding of the force update) out of that. While some is left no surface
+    // can be reached, and the step is law()'s elastic one without the surface
+    // checks; the results are the same to the bit. Once the margin is spent,
+    // or the contact leaves the branch, false is returned before anything is
+    // touched and the full law runs and takes a new margin.
+    bool JModelYopi::screenedStep(YopiHistory& h, Energies* e, State* s) const
+    {
+        if (h.marginArea_ != s->area_ || !s->area_ || s->state_) return false;
+        const YopiMaterial& mat = *mat_;
+        const YopiMaterial::Constants& k = mat.k_;
+        const double un_current = -s->normal_disp_;
+        if (!(un_current >= 0.0) || !(un_current <= k.uel_limit_)) return false;
+        const double fn_old = s->normal_force_;
+        if (!(fn_old / s->area_ >= h.peak_normal)) return false;
+
+        const double dn_ = -s->normal_disp_inc_;
+        const double kna_el = mat.kn_initial_ * s->area_;
+        const double ksa = mat.ks_ * s->area_;
+        const DVect3 fs_old = s->shear_force_;
+        const DVect3& dus = s->shear_disp_inc_;
+        const double spent = kna_el * std::abs(dn_)
+                           + ksa * (std::abs(dus.x()) + std::abs(dus.y()) + std::abs(dus.z()))
+                           + 1e-15 * (std::abs(fn_old) + std::abs(fs_old.x()) + std::abs(fs_old.y()) + std::abs(fs_old.z()));
+        if (!(spent < h.margin_)) return false;
+        h.margin_ -= spent;
+
+        s->working_[Dqs] = 0.0;
+        s->working_[Dqt] = 0.0;
+        s->working_[Dqc] = 0.0;
+        s->working_[5] = 0.0;
+
+        // Compression branch, purely elastic loading
+        if (un_current >= h.un_hist_comp && h.reloadFlag == 0 && dn_ >= 0.0)
+            h.un_hist_comp = un_current;
+        h.reloadFlag = 0;
+        double fn_new = fn_old;
+        fn_new += kna_el * dn_;
+        h.fc_current = fn_new / s->area_;
+        h.peak_normal = h.fc_current;
+
+        s->normal_force_inc_ = fn_new - fn_old;
+        s->normal_force_ = fn_new;
+        s->dnop_ = s->normal_disp_inc_;
+        if ((fn_old > 0.0) &&
+            (s->normal_force_ <= 0.0) &&
+            (s->normal_force_inc_ < 0.0))
+        {
+            s->dnop_ = -s->normal_disp_inc_ * fn_old / s->normal_force_inc_;
+            if (s->dnop_ > s->normal_disp_inc_) s->dnop_ = s->normal_disp_inc_;
+        }
+
+        h.m_ = k.m_;
+        h.dc = 0.0;
+        double comp = mat.compression_ * (1 - h.dc) * s->area_;
+        h.fc_current = comp / s->area_;
+        h.uel_ = k.uel_;
+
+        // Elastic shear, inside f2
+        s->shear_force_inc_ = s->shear_disp_inc_ * -ksa;
+        s->shear_force_ += s->shear_force_inc_;
+        h.cc = mat.cohesion_;
+        h.friction_current_ = mat.friction_ + (mat.dilation_ ? mat.dilation_ : 0.0);
+        h.open_ = 0.0;
+        h.openInc_ = s->normal_disp_inc_;
+        h.slip_ = 0.0;
+
+        accumulateEnergies(e, fn_old, fs_old, s);
+        checkForces(s);
+        return true;
+    }
+
+    // Distances in the (fn, fs) force space, where a step moves by at most
+    // |dfn| + |dfs|: to the tension cut-off f1 it is fn - ten; to the Coulomb
+    // line f2 the slack fsmax - |fs| shrinks at most max(1, tan) times as fast;
+    // and f3, quadratic, grows by at most G r + M r^2 over a distance r, with G
+    // a bound on its gradient and M on its curvature. A relative and an absolute
+    // allowance cover the rounding of the surface checks in law().
+    double JModelYopi::yieldMargin(double comp, double ten, State* s) const
+    {
+        const YopiMaterial& mat = *mat_;
+        const double fn = s->normal_force_;
+        const double fsm = s->shear_force_.mag();
+        const double d1 = fn - ten;
+        const double d2 = (mat.cohesion_ * s->area_ + mat.k_.tan_friction_dil_ * fn - fsm)
+                        / std::max(1.0, std::abs(mat.k_.tan_friction_dil_));
+        const double f3 = mat.Cnn * fn * fn + mat.Css * fsm * fsm + mat.Cn * fn - comp * comp;
+        if (!(d1 > 0.0) || !(d2 > 0.0) || !(f3 < 0.0)) return 0.0;
+        const double G = std::abs(2.0 * mat.Cnn * fn + mat.Cn) + 2.0 * std::abs(mat.Css) * fsm;
+        const double M = std::max(std::abs(mat.Cnn), std::abs(mat.Css));
+        const double d3 = -2.0 * f3 / (G + std::sqrt(G * G - 4.0 * M * f3));
+        const double scale = std::abs(fn) + fsm + std::abs(ten) + std::abs(mat.cohesion_ * s->area_) + comp;
+        const double margin = std::min(d1, std::min(d2, d3)) * (1.0 - 1e-6) - 1e-12 * scale;
+        return margin > 0.0 ? margin : 0.0;
+    }
 
-    bool JModelYopi::tensionCorrection(State* s, uint32* IPlasticity, double& ten, bool& tenflag) {
+    bool JModelYopi::tensionCorrection(State* s, uint32* IPlasticity, double& ten, bool& tenflag) const {
         if (IPlasticity) *IPlasticity = 1;
         s->normal_force_ = ten;
         if (!s->normal_force_) {
@@ -1003,7 +1759,7 @@ namespace jmodels
         return tenflag;
     }
 
-    void JModelYopi::shearCorrection(State* s, uint32* IPlasticity, double& fsm, double& fsmax, double& usel) {
+    void JModelYopi::shearCorrection(State* s, uint32* IPlasticity, double& fsm, double& fsmax, double& usel) const {
         if (IPlasticity) *IPlasticity = 2;
         double rat = 0.0;
         if (fsm) rat = fsmax / fsm;
@@ -1015,7 +1771,8 @@ namespace jmodels
 
     }
 
-    void JModelYopi::compCorrection(State* s, uint32* IPlasticity, double& comp) {
+    void JModelYopi::compCorrection(const YopiHistory& h, State* s, uint32* IPlasticity, double& comp) const {
+        const YopiMaterial& mat = *mat_;
         if (IPlasticity) *IPlasticity = 3;
         s->state_ |= comp_now;
 
@@ -1036,8 +1793,8 @@ namespace jmodels
         const double xs = x / scale;
         const double ys = y / scale;
 
-        const double A = Cnn * xs * xs + Css * ys * ys;
-        const double B = (Cn * xs) / scale;
+        const double A = mat.Cnn * xs * xs + mat.Css * ys * ys;
+        const double B = (mat.Cn * xs) / scale;
         const double C = -(comp * comp) / (scale * scale);
 
         double lambda = solveQuadratic(A, B, C);
@@ -1048,9 +1805,9 @@ namespace jmodels
         if (lambda > 1.0) lambda = 1.0;
 
         // Full degradation branch
-        if (dc >= 0.99) {
+        if (h.dc >= 0.99) {
             // Residual compressive capacity (shear to zero at the cap)
-            s->normal_force_ = res_comp_ * s->area_;
+            s->normal_force_ = mat.res_comp_ * s->area_;
             s->shear_force_ = DVect3(0, 0, 0);
         }
         else {
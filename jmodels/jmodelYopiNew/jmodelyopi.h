@@ -1,3 +1,5 @@
+#pragma once
+
 #ifdef _WIN32
 #pragma warning(disable : 4275)
 #pragma warning(disable : 4459)
@@ -16,13 +18,222 @@
 #endif
 
 #include "jointmodel.h"
+#include "jmodelyopicrack.h"
+#include "jmodelyopienergy.h"
+#include "jmodelyopislab.h"
+#include "jmodelyopisnapshot.h"
+#include "jmodelyopitable.h"
+#include "jmodelyopitrace.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
 
 namespace jmodels
 {
-    
+    struct YopiBatch;
+    struct YopiHistory;
+    struct YopiCompression;
+    class JModelYopi;
+
+    // How a damage variable softens: not at all, exponentially with a fracture
+    // energy (G_I, G_II) or along a table (table-dt, table-ds).
+    enum class YopiSoftening { None, Exponential, Table };
+
+    // The choices of JModelYopi::law() that are fixed by the material (or, for
+    // the energies, by the contact), as a type: law() runs the instantiation of
+    // JModelYopi::lawKernel() for the policy of its material, which has these
+    // branches compiled out.
+    template <YopiSoftening Tension, YopiSoftening Shear, bool Dilation, bool DefaultCap, bool Energy>
+    struct YopiLawPolicy {
+        static constexpr YopiSoftening tension_ = Tension; // dt
+        static constexpr YopiSoftening shear_ = Shear;     // ds
+        static constexpr bool dilation_ = Dilation;        // dilation_ != 0
+        static constexpr bool defaultCap_ = DefaultCap;    // Cnn = Css = 1, Cn = 0
+        static constexpr bool energy_ = Energy;            // energies tracked
+    };
+    // One instantiation of law(), see YopiMaterial::law_.
+    typedef void (*YopiLawKernel)(const JModelYopi& m, YopiHistory& h, YopiEnergies* e, State* s,
+                                  const YopiCompression* c);
+
+    // The material constants of JModelYopi, with the values initialize() derives
+    // from them. Records are immutable once interned, and every contact with the
+    // same properties shares one (JModelYopi::mat_): a contact only owns its
+    // history, and copy() is a reference count increment.
+    struct YopiMaterial {
+        double kn_initial_ = 0.0; //Initial value of the normal stiffness
+        double ks_ = 0.0;
+        double cohesion_ = 0.0;
+        double compression_ = 0.0;
+        double friction_ = 0.0;
+        double dilation_ = 0.0;
+        double tension_ = 0.0;
+        double s_zero_dilation_ = 0.0; //zero dilation stress
+        double res_cohesion_ = 0.0;
+        double res_friction_ = 0.0;
+        double res_tension_ = 0.0;
+        double tan_friction_ = 0.0;
+        double tan_dilation_ = 0.0;
+        double tan_res_friction_ = 0.0;
+        double G_I = 0.0; //first mode fracture energy
+        double G_II = 0.0; //Second mode fracture energy
+        double G_c = 0.0; //Compressive fracture energy
+        string dtTable_, dsTable_; //damage parameter tables
+        double Cnn = 0.0; //Cap user defined parameter in normal direction
+        double Css = 0.0; //Cap user defined parameter in shear direction
+        double Cn = 0.0; //Cap user defined parameter for center of ellipsis
+        void* iTension_d_ = nullptr;
+        void* iShear_d_ = nullptr;
+        void* iHard_d_ = nullptr;
+        // Local copies of the tables above, null unless table_tol_ is set (and
+        // met). Made by initialize(), and compared by their stamps in == and
+        // hash(): an edited table gives a new record.
+        std::shared_ptr<const YopiTable> dtSample_, dsSample_;
+        double R_yield = 0.0;
+        double R_violates = 0.0;
+        double res_comp_ = 0.0;
+        double n_ = 0.0; //Ratio between the elastic displacement to compressive strength
+        double substep_tol_ = 0.0; // sub-stepping tolerance on force and damage, 0 is off
+        double substep_max_ = 0.0; // most sub-steps of one step, 0 for the default (64)
+        double stiffness_damaged_ = 0.0; // nonzero: report the damaged stiffness of open contacts
+        double stiffness_floor_ = 0.0;   // least reported fraction of it, 0 for the default (0.05)
+        double table_tol_ = 0.0;         // table-tolerance: damage tables are resampled within it, 0 is off
+        // law() for this material, without and with energies: picked by
+        // intern() from the fields above (JModelYopi::selectLaw()). Derived:
+        // left out of == and hash().
+        YopiLawKernel law_[2] = {};
+
+        // Constants of the law that depend on the material only. Computed by
+        // initialize(); setProperty() clears them along with the valid flag.
+        struct Constants {
+            double ucel_ = 0.0;             // n_ * compression_ / kn_initial_
+            double uel_limit_ = 0.0;        // end of the linear compression range
+            double fel_limit_ = 0.0;        // stress at uel_limit_
+            double mid_comp_ = 0.0;         // halfway between compression_ and res_comp_
+            double m_ = 0.0;                // ucul_ / ucel_, at least 1.5
+            double ucul_ = 0.0;             // end of the compressive softening parabola
+            double uel_ = 0.0;              // tension_ / kn_initial_
+            double tan_friction_dil_ = 0.0; // tan(friction_ + dilation_)
+        };
+        Constants k_;
+
+        // Field by field, bitwise for the doubles (so NaN and -0.0 intern apart).
+        bool   operator==(const YopiMaterial& m) const;
+        size_t hash() const;
+        // The shared record equal to \a m, created if there is none yet. Records
+        // are released with their last contact. Thread safe.
+        static std::shared_ptr<const YopiMaterial> intern(const YopiMaterial& m);
+        // Number of distinct records alive.
+        static size_t internedCount();
+
+        // What initialize() made of this record in initialize pass \a pass
+        // (JModelYopi::initializePass()), so the next contact holding it takes
+        // that instead of doing it all over: false if it has not run in \a
+        // pass, else true with \a result set to the record it became (left
+        // alone if it stayed this one). Thread safe, and lock free.
+        bool initialized(uint64 pass, std::shared_ptr<const YopiMaterial>& result) const;
+        // Records the outcome of initialize(); null \a result for this record.
+        void setInitialized(uint64 pass, std::shared_ptr<const YopiMaterial> result) const;
+
+    private:
+        // One outcome of initialize(). Only pass_ changes once published: an
+        // outcome seen again in a later pass is taken over, not made anew.
+        struct InitOutcome {
+            std::atomic<uint64>                 pass_{ 0 };
+            std::shared_ptr<const YopiMaterial> result_;
+        };
+        // Belongs to the record, not to its value: never copied. The outcomes
+        // are kept until the record goes, so a reader never sees one freed;
+        // there is one per distinct result.
+        struct InitMemo {
+            InitMemo() = default;
+            InitMemo(const InitMemo&) {}
+            InitMemo& operator=(const InitMemo&) { return *this; }
+            std::atomic<const InitOutcome*>           last_{ nullptr };
+            std::mutex                                mutex_; // of outcomes_, taken by setInitialized() only
+            std::vector<std::unique_ptr<InitOutcome>> outcomes_;
+        };
+        mutable InitMemo init_;
+    };
+
+    // Everything run() changes on a contact apart from the State itself. Plain
+    // data only: copy() and the batch gather/scatter copy it as one block.
+    struct YopiHistory {
+        double kn_ = 0.0; // current (secant) normal stiffness
+        double dt = 0.0; // tensile damage parameter
+        double ds = 0.0; // shear damage parameter
+        double dc = 0.0; // Compressive damage parameter
+        double d_ts = 0.0;
+        double cc = 0.0; //Softening part of shear strength
+        double tP_ = 0.0; //plastic tensile displacement
+        double sP_ = 0.0; //plastic shear displacement
+        double fc_current = 0.0;
+        double friction_current_ = 0.0; //Current friction angle
+        double m_ = 0.0; //Ratio between ultimate displacement to displacement at peak compressive strength
+        double uel_ = 0.0; //The elastic limit in tension
+        double un_hist_comp = 0.0; // The maximum current displacement
+        double peak_normal = 0.0; //The current peaks in compression
+        double ds_hist = 0.0;
+        double un_ro = 0.0;//reloading displacement
+        double fm_ro = 0.0; //reloading stress
+        double un_hist_ten = 0.0;
+        double reloadFlag = 0.0; //reloading flag
+        double dc_hist = 0.0;
+        double dt_hist = 0.0;
+        double delta = 0.0; //dilatancy gradient
+        double dilation_current = 0.0;
+        double un_dilatant = 0.0;
+        double dil_hist = 0.0;
+        double ddil = 0.0;
+        uint32 plasFlag = 0;
+        uint32 pertFlag = 0;
+        double dormant_ = 0.0; // area of the step that left the contact dormant, 0 if not
+        double margin_ = 0.0;  // force left to the nearest yield surface, see screenedStep()
+        double marginArea_ = 0.0; // area margin_ was taken at
+        double open_ = 0.0;    // opening (normal_disp_) at the end of the last step, 0 if closed
+        double openInc_ = 0.0; // normal_disp_inc_ of the last step, > 0 opening
+        double slip_ = 0.0;    // 1 if the last step slipped, else 0
+
+        // Drops what law() cached for the next step (dormant_, margin_): it only
+        // holds for the State of the step that cached it.
+        void resetStepCaches()
+        {
+            dormant_ = 0.0;
+            margin_ = 0.0;
+            marginArea_ = 0.0;
+        }
+    };
+    static_assert(std::is_trivially_copyable<YopiHistory>::value, "YopiHistory is copied as raw memory");
+
+    // Outcome of the compression branch of the law for one contact, when it is
+    // evaluated outside of the law (see jmodelyopisimd.h). The history updates
+    // of the branch are already in the contact's YopiHistory.
+    struct YopiCompression {
+        double fn_ = 0.0;        // normal force at the end of the step
+        bool   jumptoDC_ = false; // reloading reached the damaged cap
+        bool   ready_ = false;    // the branch was evaluated for this step
+    };
+
+    // Reentrancy: run() and initialize() on distinct contacts may run on any
+    // threads at the same time. They write only the contact's own history,
+    // energy slot and State; what they share is either read only (the material
+    // record) or behind a lock or per thread (the material registry and
+    // initialize() memo, YopiEnergyPool, the slabs, the profile shards, the
+    // trace slots, the snapshot and crack buffers).
+    // Calls on one contact must not overlap, and setProperty(), copy() and
+    // restore() are not to run while other threads cycle that contact. The
+    // totals (yopiProfile(), YopiEnergyPool::total(), yopiSlabStats()) are
+    // read between cycles. yopidriver --threads checks a replay on several
+    // threads bit for bit against one thread.
     class JModelYopi : public JointModel {
     public:
         JModelYopi();
+#ifdef YOPI_SLAB
+        // Instances come from the slabs of jmodelyopislab.h.
+        static void* operator new(size_t size) { return yopiSlabAllocate(size); }
+        static void  operator delete(void* p, size_t size) { yopiSlabFree(p, size); }
+#endif
         // Destructor, called when contact is deleted: free allocated memory, etc.
         virtual ~JModelYopi();
         virtual string         getName() const;
@@ -34,17 +245,54 @@ namespace jmodels
         virtual base::Property getProperty(uint32 index) const;
         virtual void           setProperty(uint32 index, const base::Property& p, uint32 restoreVersion = 0);
         virtual JModelYopi* clone() const { return new JModelYopi(); }
-        virtual double getMaxNormalStiffness() const override {
-            return std::max(kn_, kn_initial_);
-        }
-        virtual double         getMaxShearStiffness() const { return ks_; }
+        // The stiffnesses 3DEC sizes masses and the timestep with. Pristine ones
+        // unless the material has stiffness-damaged set, see the .cpp.
+        virtual double getMaxNormalStiffness() const override;
+        virtual double         getMaxShearStiffness() const;
         virtual void           copy(const JointModel* mod);
+        // One binary block of the material, the history and the energies.
+        virtual void           save(std::ostream& o) const;
+        virtual void           restore(std::istream& i, uint32 restoreVersion);
         virtual void           run(uint32 dim, State* s); // If !isValid(dim) calls initialize(dim,s)
         virtual void           initialize(uint32 dim, State* s); // calls setValid(dim)    
-        virtual double         solveQuadratic(double, double, double);
-        virtual void           compCorrection(State* s, uint32* IPlasticity, double& comp);
-        virtual void           shearCorrection(State* s, uint32* IPlasticity, double& fsm, double& fsmax, double& usel);
-        virtual bool           tensionCorrection(State* s, uint32* IPlasticity, double& ten, bool& tenflag);
+        // initialize() does the material part, table lookups included, once
+        // per material and initialize pass, not once per contact. A pass ends
+        // when a contact runs a second time in it, that is at the start of
+        // the next cycle, so contacts initialized lazily between valid ones
+        // share it. Tables edited between cycles are looked up again from the
+        // first contact that ran before; a contact created in between and run
+        // ahead of all of those still sees the tables of the last cycle.
+        static uint64          initializePass();
+        // The table-change notice: starts a new pass, for a host that edits
+        // tables between initialize() calls without a cycle in between.
+        static void            tablesChanged();
+        // Number of times initialize() did the material part, over all contacts.
+        static uint64          materialInitializations();
+        // The tags of the tools, which the law does not see. They are not
+        // properties: a host hook sets them between cycles through the
+        // exports below, and they are neither saved, restored nor copied.
+        // The trace tag of jmodelyopitrace.h, 0 for none.
+        void                   setTraceTag(double tag);
+        // The contact-id of jmodelyopisnapshot.h and jmodelyopicrack.h, 0 for
+        // none. A new id takes part in both afresh.
+        void                   setContactId(uint64 id);
+        // The host contact, face and vertex of jmodelyopicrack.h, 0 for none.
+        void                   setCrackLinks(uint64 host, uint64 face, uint64 vertex);
+        // Sets law_ of \a m to the kernels of its YopiLawPolicy.
+        static void            selectLaw(YopiMaterial& m);
+        virtual double         solveQuadratic(double, double, double) const;
+        virtual void           compCorrection(const YopiHistory& h, State* s, uint32* IPlasticity, double& comp) const;
+        virtual void           shearCorrection(State* s, uint32* IPlasticity, double& fsm, double& fsmax, double& usel) const;
+        virtual bool           tensionCorrection(State* s, uint32* IPlasticity, double& ten, bool& tenflag) const;
+        // Updates contacts [begin,end) of \a b, with this model as the material,
+        // which must have been initialized (throws otherwise). For the driver
+        // only: it is not built into the plugin.
+        // \a s provides the host services (tables, energy tracking); its contact
+        // fields are used as scratch. Bit-for-bit identical to run() per contact,
+        // except that it records no trace (jmodelyopitrace.h), takes no
+        // snapshot (jmodelyopisnapshot.h) and adds nothing to the crack
+        // network (jmodelyopicrack.h).
+        void                   runBatch(uint32 dim, YopiBatch& b, State* s, size_t begin, size_t end) const;
         
         // Enumerator for the energies.
         enum EnergyKeys {
@@ -59,7 +307,7 @@ namespace jmodels
                 ",energy-shear";
         }
         // Activate the energy. This is only called if the energy tracking is enabled. 
-        void     activateEnergy() override { if (energies_) return; energies_ = new Energies(); }
+        void     activateEnergy() override { if (energies_) return; energies_ = YopiEnergyPool::instance().acquire(); }
         // Returns the value of the energy (base 1 - getEnergy(1) returns the estrain energy).
         double   getEnergy(uint32 i) const override;
         // Returns whether or not each energy is accumulated (base 1 - getEnergyAccumulate(1) 
@@ -87,72 +335,67 @@ namespace jmodels
         virtual bool           supportsStrengthStressRatio() const { return false; }
         virtual bool           supportsPropertyScaling() const { return false; }
     private:
-        double kn_;
-        double kn_initial_; //Initial value of the normal stiffness
-        double ks_;
-        double cohesion_;
-        double compression_;
-        double friction_;
-        double dilation_;
-        double tension_;
-        double s_zero_dilation_; //zero dilation stress
-        double res_cohesion_;
-        double res_friction_;
-        double res_tension_;
-        double tan_friction_;
-        double tan_dilation_;
-        double tan_res_friction_;
-        double G_I; //first mode fracture energy
-        double G_II; //Second mode fracture energy
-        double G_c; //Compressive fracture energy
-        double dt = 0.0; // tensile damage parameter
-        double dc = 0.0; // Compressive damage parameter
-        double ds = 0.0; // shear damage parameter
-        double d_ts;
-        double cc; //Softening part of shear strength
-        string dtTable_, dsTable_; //damage parameter tables
-        double tP_; //plastic tensile displacement
-        double sP_; //plastic shear displacement
-        double Cnn; //Cap user defined parameter in normal direction
-        double Css; //Cap user defined parameter in shear direction
-        double Cn; //Cap user defined parameter for center of ellipsis
-        void* iTension_d_ = nullptr;
-        void* iShear_d_ = nullptr;
-        void* iHard_d_ = nullptr;
-        double  R_yield;
-        double  R_violates;
-        double fc_current;
-        double res_comp_;
-        double friction_current_; //Current friction angle
-        double n_; //Ratio between the elastic displacement to compressive strength
-        double m_; //Ratio between ultimate displacement to displacement at peak compressive strength
-        double uel_; //The elastic limit in tension
-        double un_hist_comp; // The maximum current displacement
-        double peak_normal; //The current peaks in compression   
-        double ds_hist;
-        double un_ro;//reloading displacement
-        double fm_ro; //reloading stress
-        double un_hist_ten;
-        double reloadFlag; //reloading flag
-        uint32 plasFlag;
-        double dc_hist;
-        uint32 pertFlag;
-        double dt_hist;
-        double delta; //dilatancy gradient
-        double dilation_current;
-        double un_dilatant;
-        double dil_hist;
-        double ddil;
-
-        // Structure to store the energies. 
-        struct Energies {
-            Energies() : etension_(0.0),ecompression_(0.0), eshear_(0.0) {}
-			double etension_;  // tensile elastic energy stored in contact
-			double ecompression_;  // compression elastic energy stored in contact
-			double eshear_;    // shear elastic energy stored in contact
-        };
-        Energies* energies_ = nullptr; // The energies
+        friend struct YopiBatch;
+        std::shared_ptr<const YopiMaterial> mat_; // never null
+        YopiHistory hist_;
+        uint64 runPass_ = 0; // the initialize pass of the last run(), not saved
+
+        // Structure to store the energies, a slot of YopiEnergyPool.
+        typedef YopiEnergies Energies;
+        Energies* energies_ = nullptr; // The energies, only when tracked
+        // The trace tag and the slot of jmodelyopitrace.h the contact records
+        // into (see setTraceTag()).
+        YopiTraceSlot trace_;
+        // The contact-id of the snapshots and of the crack network (see
+        // setContactId()), 0 for none.
+        uint64 contactId_ = 0;
+        // The snapshot of jmodelyopisnapshot.h the contact last took part in.
+        YopiSnapshotSlot snapshot_;
+        // The ids the contact links to in the crack network of
+        // jmodelyopicrack.h, and the crossings it handed over.
+        YopiCrackSlot crack_;
+
+        // The constitutive law for one contact, with this model as the material:
+        // updates the history \a h, the energies \a e (if any) and the forces in \a s.
+        // If \a c is given, its result replaces the compression branch.
+        void           law(YopiHistory& h, Energies* e, State* s, const YopiCompression* c = nullptr) const
+        {
+            mat_->law_[e ? 1 : 0](*this, h, e, s, c);
+        }
+        // law() for the material choices of the policy \a P (YopiLawPolicy).
+        template <class P>
+        void           lawKernel(YopiHistory& h, Energies* e, State* s, const YopiCompression* c) const;
+        template <class P>
+        static void    lawEntry(const JModelYopi& m, YopiHistory& h, Energies* e, State* s, const YopiCompression* c)
+        {
+            m.lawKernel<P>(h, e, s, c);
+        }
+        // Appends the state at the end of the step to the trace.
+        void           trace(const State* s);
+        // Hands the damage variables over to the snapshot being taken.
+        void           snapshot();
+        // The step of a dormant contact, false if \a h is not dormant in \a s.
+        bool           dormantStep(YopiHistory& h, Energies* e, State* s) const;
+        // The step of an elastic contact within its yield margin, false if the
+        // step may reach a yield surface or leave the elastic branch.
+        bool           screenedStep(YopiHistory& h, Energies* e, State* s) const;
+        // Lower bound of the force distance from the end of an elastic step to
+        // the yield surfaces, 0 if the contact is not to be screened.
+        double         yieldMargin(double comp, double ten, State* s) const;
+        // law(), in sub-steps of error within the material's substep_tol_.
+        void           substep(YopiHistory& h, Energies* e, State* s) const;
+        void           lawFraction(YopiHistory& h, Energies* e, State* s, double dn, const DVect3& dus,
+                                   double un_end, const DVect3& us_end, double t0, double t1) const;
+        // The part of initialize() that acts on a contact's history.
+        void           initializeHistory(YopiHistory& h) const;
     };
 } // namespace models
 
+// The exports of jmodelyopi.cpp that set the tags of the contact whose model
+// is \a model, 0 on success (see JModelYopi::setTraceTag()).
+extern "C" EXPORT_TAG int yopiSetTraceTag(void* model, double tag);
+extern "C" EXPORT_TAG int yopiSetContactId(void* model, unsigned long long id);
+extern "C" EXPORT_TAG int yopiSetCrackLinks(void* model, unsigned long long host, unsigned long long face,
+                                            unsigned long long vertex);
+
 // EOF
@@ -0,0 +1,72 @@
+// AVX2 instance of the compression kernel (jmodelyopisimdkernel.h).
+// Everything this file includes comes before the target pragma, so only the
+// code below is built for AVX2; it only runs after yopiSimdDetect() said so.
+
+#include "jmodelyopisimd.h"
+#include <cmath>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+// No contraction into fused multiply-add: the kernel rounds like the scalar law.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace jmodels
+{
+    namespace
+    {
+        struct Avx2D {
+            static const size_t width = 4;
+            struct Mask {
+                __m256d m_;
+                Mask operator&(Mask o) const { return { _mm256_and_pd(m_, o.m_) }; }
+                Mask operator|(Mask o) const { return { _mm256_or_pd(m_, o.m_) }; }
+                Mask operator~() const { return { _mm256_xor_pd(m_, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))) }; }
+                unsigned bits() const { return static_cast<unsigned>(_mm256_movemask_pd(m_)); }
+            };
+            __m256d v_;
+            Avx2D(__m256d v) : v_(v) {}
+            Avx2D(double d) : v_(_mm256_set1_pd(d)) {}
+            static Avx2D load(const double* p) { return _mm256_loadu_pd(p); }
+            void store(double* p) const { _mm256_storeu_pd(p, v_); }
+        };
+        inline Avx2D operator+(Avx2D a, Avx2D b) { return _mm256_add_pd(a.v_, b.v_); }
+        inline Avx2D operator-(Avx2D a, Avx2D b) { return _mm256_sub_pd(a.v_, b.v_); }
+        inline Avx2D operator*(Avx2D a, Avx2D b) { return _mm256_mul_pd(a.v_, b.v_); }
+        inline Avx2D operator/(Avx2D a, Avx2D b) { return _mm256_div_pd(a.v_, b.v_); }
+        inline Avx2D neg(Avx2D a) { return _mm256_xor_pd(a.v_, _mm256_set1_pd(-0.0)); }
+        inline Avx2D abs(Avx2D a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v_); }
+        inline Avx2D sqrt(Avx2D a) { return _mm256_sqrt_pd(a.v_); }
+        inline Avx2D::Mask lt(Avx2D a, Avx2D b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_LT_OQ) }; }
+        inline Avx2D::Mask le(Avx2D a, Avx2D b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_LE_OQ) }; }
+        inline Avx2D::Mask gt(Avx2D a, Avx2D b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_GT_OQ) }; }
+        inline Avx2D::Mask ge(Avx2D a, Avx2D b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_GE_OQ) }; }
+        inline Avx2D::Mask eq(Avx2D a, Avx2D b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_EQ_OQ) }; }
+        inline Avx2D::Mask ne(Avx2D a, Avx2D b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_NEQ_UQ) }; }
+        inline Avx2D select(Avx2D::Mask m, Avx2D a, Avx2D b) { return _mm256_blendv_pd(b.v_, a.v_, m.m_); }
+    } // namespace
+} // namespace jmodels
+
+#include "jmodelyopisimdkernel.h"
+
+namespace jmodels
+{
+    void yopiCompressionAvx2(const YopiCompressionBlock& b)
+    {
+        compressionKernel<Avx2D>(b);
+    }
+} // namespace jmodels
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
+
+// EOF
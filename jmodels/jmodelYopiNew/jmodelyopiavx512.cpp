@@ -0,0 +1,73 @@
+// AVX-512 instance of the compression kernel (jmodelyopisimdkernel.h).
+// Everything this file includes comes before the target pragma, so only the
+// code below is built for AVX-512F; it only runs after yopiSimdDetect() said so.
+
+#include "jmodelyopisimd.h"
+#include <cmath>
+#include <cstdint>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+// No contraction into fused multiply-add: the kernel rounds like the scalar law.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace jmodels
+{
+    namespace
+    {
+        struct Avx512D {
+            static const size_t width = 8;
+            struct Mask {
+                __mmask8 m_;
+                Mask operator&(Mask o) const { return { static_cast<__mmask8>(m_ & o.m_) }; }
+                Mask operator|(Mask o) const { return { static_cast<__mmask8>(m_ | o.m_) }; }
+                Mask operator~() const { return { static_cast<__mmask8>(~m_) }; }
+                unsigned bits() const { return m_; }
+            };
+            __m512d v_;
+            Avx512D(__m512d v) : v_(v) {}
+            Avx512D(double d) : v_(_mm512_set1_pd(d)) {}
+            static Avx512D load(const double* p) { return _mm512_loadu_pd(p); }
+            void store(double* p) const { _mm512_storeu_pd(p, v_); }
+        };
+        inline Avx512D operator+(Avx512D a, Avx512D b) { return _mm512_add_pd(a.v_, b.v_); }
+        inline Avx512D operator-(Avx512D a, Avx512D b) { return _mm512_sub_pd(a.v_, b.v_); }
+        inline Avx512D operator*(Avx512D a, Avx512D b) { return _mm512_mul_pd(a.v_, b.v_); }
+        inline Avx512D operator/(Avx512D a, Avx512D b) { return _mm512_div_pd(a.v_, b.v_); }
+        inline Avx512D neg(Avx512D a) { return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a.v_), _mm512_set1_epi64(INT64_MIN))); }
+        inline Avx512D abs(Avx512D a) { return _mm512_abs_pd(a.v_); }
+        inline Avx512D sqrt(Avx512D a) { return _mm512_sqrt_pd(a.v_); }
+        inline Avx512D::Mask lt(Avx512D a, Avx512D b) { return { _mm512_cmp_pd_mask(a.v_, b.v_, _CMP_LT_OQ) }; }
+        inline Avx512D::Mask le(Avx512D a, Avx512D b) { return { _mm512_cmp_pd_mask(a.v_, b.v_, _CMP_LE_OQ) }; }
+        inline Avx512D::Mask gt(Avx512D a, Avx512D b) { return { _mm512_cmp_pd_mask(a.v_, b.v_, _CMP_GT_OQ) }; }
+        inline Avx512D::Mask ge(Avx512D a, Avx512D b) { return { _mm512_cmp_pd_mask(a.v_, b.v_, _CMP_GE_OQ) }; }
+        inline Avx512D::Mask eq(Avx512D a, Avx512D b) { return { _mm512_cmp_pd_mask(a.v_, b.v_, _CMP_EQ_OQ) }; }
+        inline Avx512D::Mask ne(Avx512D a, Avx512D b) { return { _mm512_cmp_pd_mask(a.v_, b.v_, _CMP_NEQ_UQ) }; }
+        inline Avx512D select(Avx512D::Mask m, Avx512D a, Avx512D b) { return _mm512_mask_blend_pd(m.m_, b.v_, a.v_); }
+    } // namespace
+} // namespace jmodels
+
+#include "jmodelyopisimdkernel.h"
+
+namespace jmodels
+{
+    void yopiCompressionAvx512(const YopiCompressionBlock& b)
+    {
+        compressionKernel<Avx512D>(b);
+    }
+} // namespace jmodels
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
+
+// EOF
@@ -0,0 +1,131 @@
+#include "jmodelyopibatch.h"
+#include "state.h"
+#include <stdexcept>
+
+namespace jmodels
+{
+    void YopiBatch::resize(size_t n)
+    {
+        state_.resize(n, 0);
+        area_.resize(n, 0.0);
+        normal_force_.resize(n, 0.0);
+        shear_force_.resize(n, DVect3(0.0));
+        normal_disp_.resize(n, 0.0);
+        shear_disp_.resize(n, DVect3(0.0));
+        normal_disp_inc_.resize(n, 0.0);
+        shear_disp_inc_.resize(n, DVect3(0.0));
+        normal_force_inc_.resize(n, 0.0);
+        shear_force_inc_.resize(n, DVect3(0.0));
+        dnop_.resize(n, 0.0);
+        hist_.resize(n);
+        energies_.resize(n);
+        tracked_.resize(n, 0);
+        valid_.resize(n, 0);
+        comp_.resize(n);
+    }
+
+    void YopiBatch::load(size_t i, State& s) const
+    {
+        s.state_ = state_[i];
+        s.area_ = area_[i];
+        s.normal_force_ = normal_force_[i];
+        s.shear_force_ = shear_force_[i];
+        s.normal_disp_ = normal_disp_[i];
+        s.shear_disp_ = shear_disp_[i];
+        s.normal_disp_inc_ = normal_disp_inc_[i];
+        s.shear_disp_inc_ = shear_disp_inc_[i];
+        s.normal_force_inc_ = normal_force_inc_[i];
+        s.shear_force_inc_ = shear_force_inc_[i];
+        s.dnop_ = dnop_[i];
+    }
+
+    void YopiBatch::store(size_t i, const State& s)
+    {
+        state_[i] = s.state_;
+        area_[i] = s.area_;
+        normal_force_[i] = s.normal_force_;
+        shear_force_[i] = s.shear_force_;
+        normal_disp_[i] = s.normal_disp_;
+        shear_disp_[i] = s.shear_disp_;
+        normal_disp_inc_[i] = s.normal_disp_inc_;
+        shear_disp_inc_[i] = s.shear_disp_inc_;
+        normal_force_inc_[i] = s.normal_force_inc_;
+        shear_force_inc_[i] = s.shear_force_inc_;
+        dnop_[i] = s.dnop_;
+    }
+
+    void YopiBatch::gather(size_t i, const JModelYopi& m, const State& s)
+    {
+        store(i, s);
+        hist_[i] = m.hist_;
+        energies_[i] = m.energies_ ? *m.energies_ : JModelYopi::Energies();
+        tracked_[i] = m.energies_ ? 1 : 0;
+        valid_[i] = m.isValid(3) ? 3 : (m.isValid(2) ? 2 : 0);
+    }
+
+    void YopiBatch::scatter(size_t i, JModelYopi& m, State& s) const
+    {
+        load(i, s);
+        // initialize() sets up the derived material terms of the model; the
+        // history it resets is overwritten right after.
+        if (valid_[i]) m.initialize(valid_[i], &s);
+        m.hist_ = hist_[i];
+        if (tracked_[i]) {
+            m.activateEnergy();
+            *m.energies_ = energies_[i];
+        }
+    }
+
+    void JModelYopi::runBatch(uint32 dim, YopiBatch& b, State* s, size_t begin, size_t end) const
+    {
+        // run() initializes the material itself; runBatch() is const and
+        // would read the zeroed constants of mat_->k_ instead.
+        if (!isValid(dim))
+            throw std::runtime_error("JModelYopi::runBatch: the material is not initialized.");
+        if (end > b.size()) end = b.size();
+        if (begin >= end) return;
+        const bool track = s->trackEnergy();
+        for (size_t i = begin; i < end; ++i) {
+            // What run() does on a contact once energy tracking is requested.
+            if (track) b.tracked_[i] = 1;
+            if (b.valid_[i] != dim) {
+                // What run() does on a contact that has not been initialized yet.
+                initializeHistory(b.hist_[i]);
+                b.valid_[i] = static_cast<uint8>(dim);
+            }
+        }
+
+        // Sub-steps need the whole law per fraction: no vectorised branch then.
+        YopiCompression* comp = nullptr;
+        if (b.simd_ != YopiSimd::None && !mat_->substep_tol_) {
+            const YopiMaterial& mat = *mat_;
+            YopiCompressionBlock c;
+            c.kn_comp_ = mat.kn_initial_;
+            c.compression_ = mat.compression_;
+            c.ucel_ = mat.k_.ucel_;
+            c.uel_limit_ = mat.k_.uel_limit_;
+            c.fel_limit_ = mat.k_.fel_limit_;
+            c.n_ = end - begin;
+            c.state_ = &b.state_[begin];
+            c.area_ = &b.area_[begin];
+            c.normal_force_ = &b.normal_force_[begin];
+            c.normal_disp_ = &b.normal_disp_[begin];
+            c.normal_disp_inc_ = &b.normal_disp_inc_[begin];
+            c.hist_ = &b.hist_[begin];
+            c.comp_ = &b.comp_[begin];
+            yopiCompressionSimd(b.simd_, c);
+            comp = c.comp_;
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            b.load(i, *s);
+            const YopiCompression* c = comp && comp[i - begin].ready_ ? &comp[i - begin] : nullptr;
+            Energies* e = b.tracked_[i] ? &b.energies_[i] : nullptr;
+            if (mat_->substep_tol_) substep(b.hist_[i], e, s);
+            else law(b.hist_[i], e, s, c);
+            b.store(i, *s);
+        }
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "jmodelyopi.h"
+#include "jmodelyopisimd.h"
+#include <vector>
+
+namespace jmodels
+{
+    // A block of contacts of one material, for JModelYopi::runBatch(). The State
+    // fields the law reads and writes are kept in structure-of-arrays form; the
+    // history of each contact is one contiguous YopiHistory record, so a contact
+    // costs a few sequential cache lines rather than one stream per field.
+    // Entry i of every array belongs to contact i. The State working areas are
+    // not carried: the model only writes them.
+    //
+    // With simd_ at YopiSimd::None (strict mode) runBatch() is bit-for-bit run();
+    // otherwise the compression branch goes through the vectorised kernel of
+    // jmodelyopisimd.h, within kYopiSimdUlpBound of run() per step.
+    struct YopiBatch {
+        void   resize(size_t n);
+        size_t size() const { return area_.size(); }
+
+        // Copies contact \a i in from / back out to a model and its State.
+        void   gather(size_t i, const JModelYopi& m, const State& s);
+        void   scatter(size_t i, JModelYopi& m, State& s) const;
+
+        // State
+        std::vector<uint32> state_;
+        std::vector<double> area_;
+        std::vector<double> normal_force_;
+        std::vector<DVect3> shear_force_;
+        std::vector<double> normal_disp_;
+        std::vector<DVect3> shear_disp_;
+        std::vector<double> normal_disp_inc_;
+        std::vector<DVect3> shear_disp_inc_;
+        std::vector<double> normal_force_inc_;
+        std::vector<DVect3> shear_force_inc_;
+        std::vector<double> dnop_;
+
+        // Model
+        std::vector<YopiHistory>          hist_;
+        std::vector<JModelYopi::Energies> energies_;
+        // Whether the contact has energies, as JModelYopi::getEnergyActivated().
+        std::vector<uint8>                tracked_;
+        // Dimension the contact was initialized for, 0 if initialize() is still due.
+        std::vector<uint8>                valid_;
+        // Scratch for the vectorised compression branch.
+        std::vector<YopiCompression>      comp_;
+
+        YopiSimd                          simd_ = YopiSimd::None;
+
+    private:
+        void   load(size_t i, State& s) const;
+        void   store(size_t i, const State& s);
+        friend class JModelYopi;
+    };
+} // namespace jmodels
+
+// EOF
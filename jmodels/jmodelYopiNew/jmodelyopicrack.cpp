@@ -0,0 +1,208 @@
+#include "jmodelyopicrack.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace jmodels
+{
+    std::atomic<uint32> yopiCrackGeneration{ 0 };
+    YopiCrackLimits     yopiCrackLimits;
+
+    namespace
+    {
+        // Node keys: the kind in the top two bits, the id below.
+        const uint64 kindContact = 0;
+        const uint64 kindHost = 1ull << 62;
+        const uint64 kindFace = 2ull << 62;
+        const uint64 kindVertex = 3ull << 62;
+        const uint64 idMask = (1ull << 62) - 1;
+
+        struct Crossing {
+            uint64 id_, host_, face_, vertex_;
+            uint32 bits_;
+            double area_;
+        };
+
+        // The crossings of one thread. Shards are never freed; they are
+        // emptied by the queries, between cycles.
+        struct Shard {
+            std::vector<Crossing> crossings_;
+        };
+
+        // Union by size, with path halving. Only roots carry the cluster totals.
+        struct Network {
+            std::unordered_map<uint64, uint32> node_; // key -> node
+            std::vector<uint32>                parent_;
+            std::vector<uint32>                size_;     // nodes, for the union
+            std::vector<uint64>                contacts_; // contacts of the cluster
+            std::vector<double>                area_;
+            std::vector<uint64>                first_;    // smallest contact-id
+            std::unordered_map<uint64, uint32> bits_;     // contact-id -> bits taken in
+            YopiCrackStats                     stats_;
+
+            void clear() { *this = Network(); }
+
+            uint32 find(uint32 n)
+            {
+                while (parent_[n] != n) {
+                    parent_[n] = parent_[parent_[n]];
+                    n = parent_[n];
+                }
+                return n;
+            }
+            uint32 node(uint64 key)
+            {
+                auto it = node_.emplace(key, static_cast<uint32>(parent_.size()));
+                if (it.second) {
+                    parent_.push_back(it.first->second);
+                    size_.push_back(1);
+                    contacts_.push_back(0);
+                    area_.push_back(0.0);
+                    first_.push_back(~0ull);
+                }
+                return it.first->second;
+            }
+            void join(uint32 a, uint32 b)
+            {
+                a = find(a);
+                b = find(b);
+                if (a == b) return;
+                if (size_[a] < size_[b]) std::swap(a, b);
+                if (contacts_[a] && contacts_[b]) --stats_.clusters_;
+                parent_[b] = a;
+                size_[a] += size_[b];
+                contacts_[a] += contacts_[b];
+                area_[a] += area_[b];
+                first_[a] = std::min(first_[a], first_[b]);
+                stats_.largest_ = std::max(stats_.largest_, contacts_[a]);
+                stats_.largestArea_ = std::max(stats_.largestArea_, area_[a]);
+            }
+            void take(const Crossing& c)
+            {
+                uint32& had = bits_[c.id_];
+                const uint32 bits = c.bits_ & ~had;
+                if (bits & kYopiCrackTension) ++stats_.tension_;
+                if (bits & kYopiCrackShear) ++stats_.shear_;
+                if (bits & kYopiCrackCompression) ++stats_.compression_;
+                const bool joins = !had;
+                had |= c.bits_;
+                if (!joins) return;
+                const uint32 n = node(kindContact | (c.id_ & idMask));
+                const uint32 r = find(n);
+                if (!contacts_[r]) ++stats_.clusters_;
+                ++contacts_[r];
+                area_[r] += c.area_;
+                first_[r] = std::min(first_[r], c.id_);
+                ++stats_.contacts_;
+                stats_.area_ += c.area_;
+                stats_.largest_ = std::max(stats_.largest_, contacts_[r]);
+                stats_.largestArea_ = std::max(stats_.largestArea_, area_[r]);
+                if (c.host_) join(n, node(kindHost | (c.host_ & idMask)));
+                if (c.face_) join(n, node(kindFace | (c.face_ & idMask)));
+                if (c.vertex_) join(n, node(kindVertex | (c.vertex_ & idMask)));
+            }
+        };
+
+        struct Registry {
+            std::mutex          mutex_;
+            std::vector<Shard*> shards_;
+            Network             network_;
+            uint32              generation_ = 0; // of the network
+        };
+
+        Registry& registry()
+        {
+            static Registry* r = new Registry; // outlives every contact
+            return *r;
+        }
+
+        thread_local Shard* tlsShard = nullptr;
+
+        // Takes the buffered crossings in. Under the mutex.
+        uint64 drainLocked(Registry& g)
+        {
+            uint64 n = 0;
+            for (auto s : g.shards_) {
+                for (auto& c : s->crossings_) g.network_.take(c);
+                n += s->crossings_.size();
+                s->crossings_.clear();
+            }
+            return n;
+        }
+
+        struct EnvironmentStart {
+            EnvironmentStart()
+            {
+                const char* v = std::getenv("YOPI_CRACK");
+                if (!v) return;
+                YopiCrackThresholds t;
+                if (std::sscanf(v, "%lf,%lf,%lf", &t.dt_, &t.ds_, &t.dc_) == 3) yopiCrackEnable(t);
+            }
+        } environmentStart;
+    }
+
+    void yopiCrackEnable(const YopiCrackThresholds& t)
+    {
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        for (auto s : g.shards_) s->crossings_.clear();
+        g.network_.clear();
+        yopiCrackLimits.dt_.store(t.dt_, std::memory_order_relaxed);
+        yopiCrackLimits.ds_.store(t.ds_, std::memory_order_relaxed);
+        yopiCrackLimits.dc_.store(t.dc_, std::memory_order_relaxed);
+        if (!++g.generation_) ++g.generation_; // 0 is off
+        yopiCrackGeneration.store(g.generation_, std::memory_order_release);
+    }
+
+    void yopiCrackDisable()
+    {
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        drainLocked(g);
+        yopiCrackGeneration.store(0, std::memory_order_release);
+    }
+
+    YopiCrackStats yopiCrackStats()
+    {
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        const uint64 taken = drainLocked(g);
+        YopiCrackStats r = g.network_.stats_;
+        r.taken_ = taken;
+        return r;
+    }
+
+    uint64 yopiCrackCluster(uint64 id)
+    {
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        drainLocked(g);
+        Network& n = g.network_;
+        auto it = n.node_.find(kindContact | (id & idMask));
+        return it == n.node_.end() ? 0 : n.first_[n.find(it->second)];
+    }
+
+    void yopiCrackSubmit(uint64 id, YopiCrackSlot& c, uint32 bits, double area)
+    {
+        const uint32 g = yopiCrackGeneration.load(std::memory_order_relaxed);
+        if (c.generation_ != g) {
+            c.generation_ = g;
+            c.crossed_ = 0;
+        }
+        c.crossed_ |= bits;
+        Shard* p = tlsShard;
+        if (!p) {
+            p = new Shard;
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex_);
+            r.shards_.push_back(p);
+            tlsShard = p;
+        }
+        p->crossings_.push_back({ id, c.host_, c.face_, c.vertex_, bits, area });
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <atomic>
+
+// The crack network, built while the model runs. A contact whose dt, ds or dc
+// reaches its threshold joins the network; two such contacts are in the same
+// fracture cluster if they are linked through a host contact, a face or a
+// vertex they share. The links are kept in a union-find over contacts, host
+// contacts, faces and vertices, so the clusters only ever merge: a contact
+// stays in the network once it is in.
+//
+// The model sees none of those ids: 3DEC gives them through
+// block::ISubcontactThing (getSubcontactID(), getHostContactID(),
+// getFaceID(), getVertexID()), and a host hook hands them to the model through
+// the exports yopiSetContactId() and yopiSetCrackLinks() of jmodelyopi.h; 0 is
+// none. Only contacts with a contact-id are tracked. Like the trace tag, the
+// ids are not properties: they are not saved and are set again after a restore.
+//
+// run() compares the damages against the thresholds, one load and three
+// compares, and hands a crossing to a buffer of its thread. yopiCrackStats()
+// and yopiCrackCluster() take the buffered crossings into the union-find
+// first, so a query costs in proportion to the contacts damaged since the
+// last one. Query between cycles, from the driver or a host hook: a query
+// while contacts run races with their submissions, so no property of the
+// model makes one. The environment variable YOPI_CRACK=dt,ds,dc
+// switches tracking on with those thresholds when the plugin is loaded.
+
+namespace jmodels
+{
+    struct YopiCrackThresholds {
+        double dt_ = 0.99; // a threshold above 1 is never reached
+        double ds_ = 0.99;
+        double dc_ = 0.99;
+    };
+
+    // Bits of the damages past their threshold.
+    static const uint32 kYopiCrackTension = 0x1;
+    static const uint32 kYopiCrackShear = 0x2;
+    static const uint32 kYopiCrackCompression = 0x4;
+
+    struct YopiCrackStats {
+        uint64 contacts_ = 0;     // contacts in the network
+        uint64 tension_ = 0;      // of those, past the dt threshold
+        uint64 shear_ = 0;        // past the ds threshold
+        uint64 compression_ = 0;  // past the dc threshold
+        uint64 clusters_ = 0;     // fracture clusters
+        uint64 largest_ = 0;      // contacts of the largest cluster
+        double area_ = 0.0;       // area of the contacts in the network, when they joined
+        double largestArea_ = 0.0; // area of the cluster with the most
+        uint64 taken_ = 0;        // crossings taken in by this query
+    };
+
+    // Per contact.
+    struct YopiCrackSlot {
+        uint64 host_ = 0;
+        uint64 face_ = 0;
+        uint64 vertex_ = 0;
+        uint32 crossed_ = 0;    // kYopiCrack* bits already handed over
+        uint32 generation_ = 0; // network crossed_ belongs to
+    };
+
+    // Starts a new network with \a t. Contacts report again what they had
+    // crossed in the one before.
+    void           yopiCrackEnable(const YopiCrackThresholds& t);
+    // Stops tracking; the network is kept for queries.
+    void           yopiCrackDisable();
+    YopiCrackStats yopiCrackStats();
+    // Smallest contact-id of the cluster of contact \a id, 0 if the contact
+    // is not in the network.
+    uint64         yopiCrackCluster(uint64 id);
+
+    // The thresholds of the network being built, as the contacts read them.
+    struct YopiCrackLimits {
+        std::atomic<double> dt_{ 0.99 };
+        std::atomic<double> ds_{ 0.99 };
+        std::atomic<double> dc_{ 0.99 };
+    };
+
+    // The network being built, 0 if tracking is off; and its thresholds,
+    // stored before the generation is released.
+    extern std::atomic<uint32> yopiCrackGeneration;
+    extern YopiCrackLimits     yopiCrackLimits;
+    // The kYopiCrack* bits the contact of \a c has newly crossed.
+    inline uint32  yopiCrackCrossing(const YopiCrackSlot& c, double dt, double ds, double dc)
+    {
+        const uint32 g = yopiCrackGeneration.load(std::memory_order_acquire);
+        if (!g) return 0;
+        const uint32 bits = (dt >= yopiCrackLimits.dt_.load(std::memory_order_relaxed) ? kYopiCrackTension : 0u)
+                            | (ds >= yopiCrackLimits.ds_.load(std::memory_order_relaxed) ? kYopiCrackShear : 0u)
+                            | (dc >= yopiCrackLimits.dc_.load(std::memory_order_relaxed) ? kYopiCrackCompression : 0u);
+        return bits & ~(c.generation_ == g ? c.crossed_ : 0u);
+    }
+    // Hands the crossing \a bits of contact \a id, of \a area, over. Thread
+    // safe for distinct \a c.
+    void           yopiCrackSubmit(uint64 id, YopiCrackSlot& c, uint32 bits, double area);
+} // namespace jmodels
+
+// EOF
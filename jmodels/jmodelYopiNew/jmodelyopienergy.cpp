@@ -0,0 +1,162 @@
+#include "jmodelyopienergy.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace jmodels
+{
+    YopiEnergyPool& YopiEnergyPool::instance()
+    {
+        static YopiEnergyPool* p = new YopiEnergyPool; // outlives every contact
+        return *p;
+    }
+
+    YopiEnergies* YopiEnergyPool::acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            YopiEnergies* e = free_.back();
+            free_.pop_back();
+            return e;
+        }
+        if (used_ == chunkSize_) {
+            chunks_.emplace_back(new YopiEnergies[chunkSize_]);
+            used_ = 0;
+        }
+        return &chunks_.back()[used_++];
+    }
+
+    void YopiEnergyPool::release(YopiEnergies* e)
+    {
+        if (!e) return;
+        *e = YopiEnergies();
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(e);
+    }
+
+    void YopiAccumulator::add(const YopiAccumulator& a)
+    {
+        auto merge = [](uint64* w, const uint64* v) {
+            uint64 carry = 0;
+            for (uint32 k = 0; k < limbs_; ++k) {
+                const uint64 x = v[k] + carry;
+                carry = x < carry;
+                w[k] += x;
+                carry += w[k] < x;
+            }
+        };
+        merge(pos_, a.pos_);
+        merge(neg_, a.neg_);
+        special_ += a.special_;
+    }
+
+    double YopiAccumulator::value() const
+    {
+        if (special_ != 0.0 || std::isnan(special_)) return special_;
+        // pos_ - neg_, as a magnitude and a sign.
+        const uint64* big = pos_;
+        const uint64* small = neg_;
+        bool negative = false;
+        for (uint32 k = limbs_; k--;) {
+            if (pos_[k] == neg_[k]) continue;
+            negative = pos_[k] < neg_[k];
+            break;
+        }
+        if (negative) std::swap(big, small);
+        uint64 d[limbs_];
+        uint64 borrow = 0;
+        for (uint32 k = 0; k < limbs_; ++k) {
+            const uint64 x = small[k] + borrow;
+            borrow = x < borrow;
+            d[k] = big[k] - x;
+            borrow += big[k] < x;
+        }
+        uint32 top = limbs_;
+        while (top && !d[top - 1]) --top;
+        if (!top) return 0.0;
+        // The three top limbs, highest first: 128 bits past the leading one
+        // are more than a double holds.
+        double r = 0.0;
+        for (uint32 k = top; k-- && k + 3 >= top;)
+            r += std::ldexp(static_cast<double>(d[k]), static_cast<int>(64 * k) - 1074);
+        return negative ? -r : r;
+    }
+
+    void YopiEnergySum::add(const YopiEnergySum& s)
+    {
+        etension_.add(s.etension_);
+        ecompression_.add(s.ecompression_);
+        eshear_.add(s.eshear_);
+    }
+
+    YopiEnergies YopiEnergySum::value() const
+    {
+        YopiEnergies e;
+        e.etension_ = etension_.value();
+        e.ecompression_ = ecompression_.value();
+        e.eshear_ = eshear_.value();
+        return e;
+    }
+
+    void YopiEnergyPool::sumLocked(size_t begin, size_t end, YopiEnergySum& s) const
+    {
+        for (size_t c = begin; c < end && c < chunks_.size(); ++c) {
+            const YopiEnergies* e = chunks_[c].get();
+            size_t n = c + 1 == chunks_.size() ? used_ : chunkSize_;
+            for (size_t i = 0; i < n; ++i)
+                s.add(e[i]);
+        }
+    }
+
+    YopiEnergies YopiEnergyPool::total(uint32 threads) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t n = chunks_.size();
+        size_t t = std::min<size_t>(std::max<uint32>(threads, 1), n);
+        YopiEnergySum sum;
+        if (t <= 1) {
+            sumLocked(0, n, sum);
+            return sum.value();
+        }
+        // Contiguous runs of chunks, one per thread; this thread takes the first.
+        std::vector<YopiEnergySum> part(t - 1);
+        std::vector<std::thread>   pool;
+        auto range = [&](size_t k) { return std::make_pair(n * k / t, n * (k + 1) / t); };
+        for (size_t k = 1; k < t; ++k)
+            pool.emplace_back([&, k]() { sumLocked(range(k).first, range(k).second, part[k - 1]); });
+        sumLocked(range(0).first, range(0).second, sum);
+        for (auto& th : pool)
+            th.join();
+        for (auto& p : part)
+            sum.add(p);
+        return sum.value();
+    }
+
+    YopiEnergySum YopiEnergyPool::sum(size_t begin, size_t end) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        YopiEnergySum s;
+        sumLocked(begin, end, s);
+        return s;
+    }
+
+    size_t YopiEnergyPool::chunks() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return chunks_.size();
+    }
+
+    size_t YopiEnergyPool::live() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacityLocked() - free_.size();
+    }
+
+    size_t YopiEnergyPool::capacity() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacityLocked();
+    }
+} // namespace jmodels
+
+// EOF
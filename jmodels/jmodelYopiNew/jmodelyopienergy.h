@@ -0,0 +1,128 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Energy storage of the JModelYopi contacts. Only the contacts of a model with
+// energy tracking on have a slot; they all live in one pool of contiguous
+// chunks, so a global sum is a linear sweep instead of a pointer chase.
+//
+// The sum is exact: every energy is added into a fixed point integer wide
+// enough for any double (YopiAccumulator), and only the end result is rounded.
+// It therefore does not depend on the order of the slots, which follows the
+// order contacts were created in, nor on how the sweep is split over threads:
+// the same energies give the same bits, every time.
+
+namespace jmodels
+{
+    // The energies of one contact.
+    struct YopiEnergies {
+        double etension_ = 0.0;     // tensile elastic energy stored in contact
+        double ecompression_ = 0.0; // compression elastic energy stored in contact
+        double eshear_ = 0.0;       // shear elastic energy stored in contact
+    };
+
+    // Exact sum of doubles. Same idea as itasca::ExtendedPrecision
+    // (utility/src/extendedprecision.h), positive and negative values summed
+    // apart, but wide enough to drop no bit: 2^-1074 to 2^1024, with 78 bits
+    // of headroom for the carries. itasca::AccOnly itself is not used, its
+    // header needs Qt and it lives in the utility library, neither of which a
+    // joint model plugin builds against.
+    class YopiAccumulator {
+    public:
+        void add(double d)
+        {
+            uint64 bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            const uint32 exp = static_cast<uint32>(bits >> 52) & 0x7ff;
+            uint64 mant = bits & 0x000fffffffffffffULL;
+            if (exp == 0x7ff) { // inf or nan
+                special_ += d;
+                return;
+            }
+            if (!exp && !mant) return;
+            uint32 shift = 0; // of mant, in units of 2^-1074
+            if (exp) {
+                mant |= 1ULL << 52;
+                shift = exp - 1;
+            }
+            uint64* w = (bits >> 63) ? neg_ : pos_;
+            const uint32 i = shift / 64, o = shift % 64;
+            const uint64 lo = mant << o;
+            w[i] += lo;
+            const uint64 hi = (o ? mant >> (64 - o) : 0) + (w[i] < lo);
+            w[i + 1] += hi;
+            for (uint32 k = i + 2, carry = w[i + 1] < hi; carry; ++k)
+                carry = ++w[k] == 0;
+        }
+        void add(const YopiAccumulator& a);
+        // The sum rounded to a double, within an ulp or two; inf or nan if
+        // one was added.
+        double value() const;
+
+    private:
+        static const uint32 limbs_ = 34;
+        uint64 pos_[limbs_] = {};
+        uint64 neg_[limbs_] = {};
+        double special_ = 0.0;
+    };
+
+    // Exact sums of the three energies.
+    struct YopiEnergySum {
+        YopiAccumulator etension_;
+        YopiAccumulator ecompression_;
+        YopiAccumulator eshear_;
+
+        void add(const YopiEnergies& e)
+        {
+            etension_.add(e.etension_);
+            ecompression_.add(e.ecompression_);
+            eshear_.add(e.eshear_);
+        }
+        void add(const YopiEnergySum& s);
+        YopiEnergies value() const;
+    };
+
+    // Slots are handed out of fixed size chunks and never move. A released slot
+    // is zeroed and put on a free list, so it adds nothing to total().
+    class YopiEnergyPool {
+    public:
+        static YopiEnergyPool& instance();
+
+        // A zeroed slot. Thread safe.
+        YopiEnergies* acquire();
+        // Gives back a slot of acquire(). Thread safe.
+        void          release(YopiEnergies* e);
+        // Exact sum over every slot, split over \a threads threads (none started
+        // for 1); the result is the same for any number. Not to be called while
+        // contacts are running.
+        YopiEnergies  total(uint32 threads = 1) const;
+        // The same, for the caller to merge with YopiEnergySum::add(): the exact
+        // sum of chunks [\a begin, \a end), of chunks() chunks of the pool, for
+        // a host that splits the sweep over its own threads.
+        YopiEnergySum sum(size_t begin, size_t end) const;
+        size_t        chunks() const;
+        // Number of slots in use, and allocated.
+        size_t        live() const;
+        size_t        capacity() const;
+
+    private:
+        YopiEnergyPool() = default;
+        static const size_t chunkSize_ = 4096;
+        size_t capacityLocked() const {
+            return chunks_.empty() ? 0 : (chunks_.size() - 1) * chunkSize_ + used_;
+        }
+        void sumLocked(size_t begin, size_t end, YopiEnergySum& s) const;
+
+        mutable std::mutex                           mutex_;
+        std::vector<std::unique_ptr<YopiEnergies[]>> chunks_;
+        size_t                                       used_ = chunkSize_; // slots taken from the last chunk
+        std::vector<YopiEnergies*>                   free_;
+    };
+} // namespace jmodels
+
+// EOF
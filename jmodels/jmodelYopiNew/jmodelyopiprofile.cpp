@@ -0,0 +1,256 @@
+#include "jmodelyopiprofile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jmodels
+{
+    const char* yopiBranchName(YopiBranch b)
+    {
+        switch (b) {
+        case YopiBranch::Tension:            return "tension";
+        case YopiBranch::ElasticCompression: return "elastic-compression";
+        case YopiBranch::EnvelopeLoading:    return "envelope-loading";
+        case YopiBranch::XetaUnloading:      return "xeta-unloading";
+        case YopiBranch::UnloadToZero:       return "unload-to-zero";
+        case YopiBranch::Hold:               return "hold";
+        case YopiBranch::Reloading:          return "reloading";
+        case YopiBranch::DamagedCapJump:     return "damaged-cap-jump";
+        case YopiBranch::CompressionKernel:  return "compression-kernel";
+        case YopiBranch::ShearSlip:          return "shear-slip";
+        case YopiBranch::CapCorrection:      return "cap-correction";
+        case YopiBranch::ShearCapCorrection: return "shear-cap-correction";
+        case YopiBranch::XetaGuard:          return "xeta-guard";
+        case YopiBranch::Dormant:            return "dormant";
+        case YopiBranch::Screened:           return "screened";
+        case YopiBranch::Count:              break;
+        }
+        return "?";
+    }
+
+    string yopiStateClassName(uint32 c)
+    {
+        if (!c) return "elastic";
+        string r;
+        if (c & 1) r += "slip";
+        if (c & 2) r += r.empty() ? "tension" : "+tension";
+        if (c & 4) r += r.empty() ? "comp" : "+comp";
+        return r;
+    }
+
+    uint32 YopiHistogram::bucket(uint64 ticks)
+    {
+        if (ticks < 4) return static_cast<uint32>(ticks);
+        uint32 e = 0;
+        for (uint64 v = ticks; v >>= 1;) ++e;
+        uint32 sub = static_cast<uint32>(ticks >> (e - 2)) & 3u;
+        return 4 * (e - 1) + sub;
+    }
+
+    uint64 YopiHistogram::lower(uint32 b)
+    {
+        if (b < 4) return b;
+        uint32 e = b / 4 + 1;
+        return static_cast<uint64>(4 + b % 4) << (e - 2);
+    }
+
+    uint64 YopiHistogram::samples() const
+    {
+        uint64 n = 0;
+        for (auto c : count_) n += c;
+        return n;
+    }
+
+    double YopiHistogram::percentile(double q) const
+    {
+        uint64 n = samples();
+        if (!n) return 0.0;
+        uint64 rank = static_cast<uint64>(q * static_cast<double>(n - 1));
+        uint64 seen = 0;
+        for (uint32 b = 0; b < buckets_; ++b) {
+            seen += count_[b];
+            if (seen > rank) {
+                double lo = static_cast<double>(lower(b));
+                double hi = b + 1 < buckets_ ? static_cast<double>(lower(b + 1)) : 2.0 * lo;
+                return 0.5 * (lo + hi);
+            }
+        }
+        return 0.0;
+    }
+
+#ifndef YOPI_NO_PROFILE
+    std::atomic<uint32> yopiProfileMode{ 0 };
+    std::atomic<uint32> yopiProfileEvery{ 0 };
+
+    namespace
+    {
+        // Shards are never freed, so the counts of a thread that has ended are
+        // still in the totals.
+        struct ShardList {
+            std::mutex                     mutex_;
+            std::vector<YopiProfileShard*> shards_;
+        };
+
+        ShardList& shardList()
+        {
+            static ShardList* l = new ShardList; // outlives every thread
+            return *l;
+        }
+
+        // Reference points for yopiTicksPerNs(), taken when the plugin loads.
+        const uint64                                tickStart = yopiTicks();
+        const std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+
+        struct ExitDump {
+            ExitDump()
+            {
+                if (std::getenv("YOPI_PROFILE"))
+                    yopiProfileCounting(true);
+                if (const char* every = std::getenv("YOPI_PROFILE_SAMPLE"))
+                    yopiProfileSampling(static_cast<uint32>(std::strtoul(every, nullptr, 10)));
+            }
+            ~ExitDump()
+            {
+                if (const char* path = std::getenv("YOPI_PROFILE"))
+                    yopiProfileDump(path);
+            }
+        } exitDump;
+    }
+
+    void yopiProfileSample(YopiProfileShard* p, uint32 hits, uint32 state, uint64 ticks)
+    {
+        auto bump = [](std::atomic<uint64>& c) {
+            c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        };
+        uint32 k = YopiHistogram::bucket(ticks);
+        for (uint32 b = 0; b < kYopiBranchCount; ++b)
+            if (hits & (1u << b)) bump(p->branch_[b][k]);
+        // slip_now 0x01, tension_now 0x02, comp_now 0x10 (see jmodelyopi.cpp)
+        uint32 c = (state & 0x01) | (state & 0x02) | ((state & 0x10) >> 2);
+        bump(p->state_[c][k]);
+    }
+
+    thread_local YopiProfileShard* yopiProfileTls = nullptr;
+
+    YopiProfileShard* yopiProfileNewShard()
+    {
+        YopiProfileShard* shard = new YopiProfileShard;
+        {
+            ShardList& l = shardList();
+            std::lock_guard<std::mutex> lock(l.mutex_);
+            l.shards_.push_back(shard);
+        }
+        yopiProfileTls = shard;
+        return shard;
+    }
+
+    bool yopiProfileEnabled() { return true; }
+
+    YopiProfile yopiProfile()
+    {
+        YopiProfile r;
+        ShardList& l = shardList();
+        std::lock_guard<std::mutex> lock(l.mutex_);
+        for (auto p : l.shards_) {
+            r.calls_ += p->calls_.load(std::memory_order_relaxed);
+            for (uint32 b = 0; b < kYopiBranchCount; ++b) {
+                r.hits_[b] += p->hits_[b].load(std::memory_order_relaxed);
+                r.ns_[b] += p->ns_[b].load(std::memory_order_relaxed);
+                for (uint32 k = 0; k < YopiHistogram::buckets_; ++k)
+                    r.branch_[b].count_[k] += p->branch_[b][k].load(std::memory_order_relaxed);
+            }
+            for (uint32 c = 0; c < kYopiStateClasses; ++c)
+                for (uint32 k = 0; k < YopiHistogram::buckets_; ++k)
+                    r.state_[c].count_[k] += p->state_[c][k].load(std::memory_order_relaxed);
+        }
+        return r;
+    }
+
+    void yopiProfileReset()
+    {
+        ShardList& l = shardList();
+        std::lock_guard<std::mutex> lock(l.mutex_);
+        for (auto p : l.shards_) {
+            p->calls_.store(0, std::memory_order_relaxed);
+            for (uint32 b = 0; b < kYopiBranchCount; ++b) {
+                p->hits_[b].store(0, std::memory_order_relaxed);
+                p->ns_[b].store(0, std::memory_order_relaxed);
+                for (auto& k : p->branch_[b]) k.store(0, std::memory_order_relaxed);
+            }
+            for (auto& c : p->state_)
+                for (auto& k : c) k.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static void setMode(uint32 bit, bool on)
+    {
+        if (on) yopiProfileMode.fetch_or(bit, std::memory_order_relaxed);
+        else yopiProfileMode.fetch_and(~bit, std::memory_order_relaxed);
+    }
+
+    void yopiProfileCounting(bool on) { setMode(kYopiProfileCount, on); }
+
+    void yopiProfileTiming(bool on) { setMode(kYopiProfileTime, on); }
+
+    void yopiProfileSampling(uint32 every)
+    {
+        yopiProfileEvery.store(every, std::memory_order_relaxed);
+        setMode(kYopiProfileSample, every != 0);
+    }
+
+    double yopiTicksPerNs()
+    {
+        // Below a few milliseconds since load the estimate is too coarse: wait.
+        using namespace std::chrono;
+        while (steady_clock::now() - clockStart < milliseconds(20))
+            std::this_thread::sleep_for(milliseconds(5));
+        double ns = static_cast<double>(duration_cast<nanoseconds>(steady_clock::now() - clockStart).count());
+        return static_cast<double>(yopiTicks() - tickStart) / ns;
+    }
+#else
+    bool        yopiProfileEnabled() { return false; }
+    YopiProfile yopiProfile() { return YopiProfile(); }
+    void        yopiProfileReset() {}
+    void        yopiProfileCounting(bool) {}
+    void        yopiProfileTiming(bool) {}
+    void        yopiProfileSampling(uint32) {}
+    double      yopiTicksPerNs() { return 1.0; }
+#endif
+
+    bool yopiProfileDump(const string& path)
+    {
+        FILE* f = std::fopen(path.c_str(), "w");
+        if (!f) return false;
+        YopiProfile p = yopiProfile();
+        double tpn = yopiTicksPerNs();
+        std::fprintf(f, "calls %llu\n", static_cast<unsigned long long>(p.calls_));
+        std::fprintf(f, "%-22s %14s %8s %14s\n", "branch", "hits", "share", "ns/hit");
+        for (uint32 b = 0; b < kYopiBranchCount; ++b) {
+            double share = p.calls_ ? 100.0 * p.hits_[b] / p.calls_ : 0.0;
+            double ns = p.hits_[b] ? static_cast<double>(p.ns_[b]) / p.hits_[b] : 0.0;
+            std::fprintf(f, "%-22s %14llu %7.2f%% %14.1f\n", yopiBranchName(static_cast<YopiBranch>(b)),
+                         static_cast<unsigned long long>(p.hits_[b]), share, ns);
+        }
+
+        // Sampled latency, ns
+        auto latency = [f, tpn](const string& name, const YopiHistogram& h) {
+            uint64 n = h.samples();
+            if (!n) return;
+            std::fprintf(f, "%-22s %10llu %10.1f %10.1f %10.1f %10.1f\n", name.c_str(),
+                         static_cast<unsigned long long>(n), h.percentile(0.5) / tpn,
+                         h.percentile(0.99) / tpn, h.percentile(0.999) / tpn, h.percentile(1.0) / tpn);
+        };
+        std::fprintf(f, "\nsampled latency (ns), %.3f ticks/ns\n", tpn);
+        std::fprintf(f, "%-22s %10s %10s %10s %10s %10s\n", "branch", "samples", "p50", "p99", "p999", "max");
+        for (uint32 b = 0; b < kYopiBranchCount; ++b)
+            latency(yopiBranchName(static_cast<YopiBranch>(b)), p.branch_[b]);
+        std::fprintf(f, "%-22s %10s %10s %10s %10s %10s\n", "state", "samples", "p50", "p99", "p999", "max");
+        for (uint32 c = 0; c < kYopiStateClasses; ++c)
+            latency(yopiStateClassName(c), p.state_[c]);
+        return std::fclose(f) == 0;
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <atomic>
+#include <chrono>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// Branch counters of JModelYopi::law(). Once switched on, every call records
+// which branches of the law it took, in counters sharded per thread so the
+// contacts of different threads never share a cache line. Optionally the
+// duration of each call is added to every branch it took as well. Switched off
+// (the default) a call costs one relaxed load and a few register ORs.
+//
+// Build with YOPI_NO_PROFILE to compile the instrumentation out of the law (the
+// query functions then report nothing). The Release configurations of the
+// plugin projects define it; the Debug ones and the driver keep the counters.
+//
+// On top of that, one call in N can be sampled: its duration is read from the
+// time stamp counter and added to log-scale latency histograms, one for each
+// branch the call took and one for the contact state bits (slip_now,
+// tension_now, comp_now) it ended with. The histograms give the tail (p99,
+// p999) that the mean of the timed counters hides.
+//
+// Counters are summed when queried: query or reset while no contacts run.
+// Setting the environment variable YOPI_PROFILE to a file name dumps the
+// counters to that file when the plugin is unloaded, and switches counting on
+// from the start; YOPI_PROFILE_SAMPLE=N does the same for sampling.
+
+namespace jmodels
+{
+    enum class YopiBranch : uint32 {
+        Tension,            // opening or open contact
+        ElasticCompression, // elastic loading or unloading in compression
+        EnvelopeLoading,    // onto the nonlinear compression envelope
+        XetaUnloading,      // nonlinear unloading from compression
+        UnloadToZero,       // unloading below zero stress
+        Hold,               // reloading below the reload point, force held
+        Reloading,          // reloading towards the envelope or damaged cap
+        DamagedCapJump,     // reloading reached the damaged cap (jumptoDC)
+        CompressionKernel,  // compression branch taken from the vectorised kernel
+        ShearSlip,          // shear correction
+        CapCorrection,      // compressive cap correction
+        ShearCapCorrection, // cap correction followed by a second shear correction
+        XetaGuard,          // a denominator of the Xeta curve was clamped to epsilon
+        Dormant,            // failed open contact, see JModelYopi::dormantStep()
+        Screened,           // elastic step within the yield margin, see JModelYopi::screenedStep()
+        Count
+    };
+    static const uint32 kYopiBranchCount = static_cast<uint32>(YopiBranch::Count);
+
+    // Short name of \a b, as in the dump.
+    const char* yopiBranchName(YopiBranch b);
+
+    // Sampled histograms are kept per combination of these state bits.
+    static const uint32 kYopiStateClasses = 8; // slip_now, tension_now, comp_now
+    // "elastic", "slip", "tension", ... of a state class, as in the dump.
+    string      yopiStateClassName(uint32 c);
+
+    // Latency histogram, in ticks of yopiTicks(). Bucket b < 4 holds b ticks;
+    // above, each power of two is split in four buckets, so a percentile is
+    // known within 25%.
+    struct YopiHistogram {
+        static const uint32 buckets_ = 256;
+        uint64 count_[buckets_] = {};
+
+        static uint32 bucket(uint64 ticks);
+        static uint64 lower(uint32 b); // smallest value of bucket b
+        uint64 samples() const;
+        // Value at quantile \a q in [0,1], as the middle of its bucket. 0 if empty.
+        double percentile(double q) const;
+    };
+
+    // Totals over all threads.
+    struct YopiProfile {
+        uint64        calls_ = 0;                     // law() calls
+        uint64        hits_[kYopiBranchCount] = {};    // calls that took the branch
+        uint64        ns_[kYopiBranchCount] = {};      // duration of those calls, if timed
+        YopiHistogram branch_[kYopiBranchCount];       // sampled calls that took the branch
+        YopiHistogram state_[kYopiStateClasses];       // sampled calls by state class
+    };
+
+    // False if built with YOPI_NO_PROFILE.
+    bool        yopiProfileEnabled();
+    YopiProfile yopiProfile();
+    void        yopiProfileReset();
+    // Each of these switches counting on while it is on.
+    void        yopiProfileCounting(bool on);
+    // Times every call; two clock reads per call.
+    void        yopiProfileTiming(bool on);
+    // Samples one law() call in \a every on each thread; 0 is off.
+    void        yopiProfileSampling(uint32 every);
+    // Time stamp counter ticks per nanosecond, estimated against the steady
+    // clock since the first sample. 1 where ticks are nanoseconds already.
+    double      yopiTicksPerNs();
+
+    // Time stamp counter where there is one, steady clock nanoseconds otherwise.
+    inline uint64 yopiTicks()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        return __rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        return __rdtsc();
+#else
+        return static_cast<uint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+    // Writes yopiProfile() as a table to \a path. False if it cannot be written.
+    bool        yopiProfileDump(const string& path);
+
+#ifndef YOPI_NO_PROFILE
+    // The counters of one thread. Only the owning thread writes them.
+    struct alignas(64) YopiProfileShard {
+        std::atomic<uint64> calls_{ 0 };
+        std::atomic<uint64> hits_[kYopiBranchCount] = {};
+        std::atomic<uint64> ns_[kYopiBranchCount] = {};
+        uint32              countdown_ = 0; // calls until the next sample
+        std::atomic<uint64> branch_[kYopiBranchCount][YopiHistogram::buckets_] = {};
+        std::atomic<uint64> state_[kYopiStateClasses][YopiHistogram::buckets_] = {};
+    };
+    extern thread_local YopiProfileShard* yopiProfileTls;
+    YopiProfileShard* yopiProfileNewShard(); // registers one for the calling thread
+    // The shard of the calling thread.
+    inline YopiProfileShard* yopiProfileShard()
+    {
+        YopiProfileShard* p = yopiProfileTls;
+        return p ? p : yopiProfileNewShard();
+    }
+    // Adds a sampled call to the histograms of \a p.
+    void yopiProfileSample(YopiProfileShard* p, uint32 hits, uint32 state, uint64 ticks);
+    // Bits of yopiProfileMode.
+    static const uint32 kYopiProfileCount = 0x1;
+    static const uint32 kYopiProfileTime = 0x2;
+    static const uint32 kYopiProfileSample = 0x4;
+    extern std::atomic<uint32> yopiProfileMode;
+    extern std::atomic<uint32> yopiProfileEvery;
+
+    // Collects the branches of one law() call and records them when it ends.
+    // \a state is read then, for the state class of a sampled call.
+    class YopiProfileScope {
+    public:
+        explicit YopiProfileScope(const uint32* state) :
+            state_(state),
+            mode_(yopiProfileMode.load(std::memory_order_relaxed))
+        {
+            if (!mode_) return;
+            shard_ = yopiProfileShard();
+            timed_ = (mode_ & kYopiProfileTime) != 0;
+            if (mode_ & kYopiProfileSample) {
+                uint32 every = yopiProfileEvery.load(std::memory_order_relaxed);
+                if (every && ++shard_->countdown_ >= every) {
+                    shard_->countdown_ = 0;
+                    sampled_ = true;
+                }
+            }
+            if (timed_) t0_ = std::chrono::steady_clock::now();
+            if (sampled_) tick0_ = yopiTicks();
+        }
+        ~YopiProfileScope()
+        {
+            if (!mode_) return;
+            if (sampled_) yopiProfileSample(shard_, hits_, *state_, yopiTicks() - tick0_);
+            YopiProfileShard* p = shard_;
+            bump(p->calls_, 1);
+            uint64 ns = 0;
+            if (timed_)
+                ns = static_cast<uint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - t0_).count());
+            for (uint32 m = hits_; m; m &= m - 1) {
+                uint32 b = lowestBit(m);
+                bump(p->hits_[b], 1);
+                if (timed_) bump(p->ns_[b], ns);
+            }
+        }
+        void hit(YopiBranch b) { hits_ |= 1u << static_cast<uint32>(b); }
+
+    private:
+        static uint32 lowestBit(uint32 m)
+        {
+#if defined(_MSC_VER)
+            unsigned long b;
+            _BitScanForward(&b, m);
+            return b;
+#else
+            return static_cast<uint32>(__builtin_ctz(m));
+#endif
+        }
+        static void bump(std::atomic<uint64>& c, uint64 d)
+        {
+            c.store(c.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+        }
+        const uint32*                         state_;
+        uint32                                mode_;
+        YopiProfileShard*                     shard_ = nullptr;
+        uint32                                hits_ = 0;
+        bool                                  timed_ = false;
+        bool                                  sampled_ = false;
+        std::chrono::steady_clock::time_point t0_;
+        uint64                                tick0_ = 0;
+    };
+#else
+    class YopiProfileScope {
+    public:
+        explicit YopiProfileScope(const uint32*) {}
+        void hit(YopiBranch) {}
+    };
+#endif
+} // namespace jmodels
+
+// EOF
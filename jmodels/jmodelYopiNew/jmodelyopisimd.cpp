@@ -0,0 +1,73 @@
+#include "jmodelyopisimd.h"
+#include <stdexcept>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace jmodels
+{
+    static YopiSimd detect()
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave) return YopiSimd::None;
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        bool avx2 = (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+        bool avx512 = (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0;
+        if (avx512) return YopiSimd::Avx512;
+        if (avx2) return YopiSimd::Avx2;
+#elif defined(__GNUC__) && defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return YopiSimd::Avx512;
+        if (__builtin_cpu_supports("avx2")) return YopiSimd::Avx2;
+#endif
+        return YopiSimd::None;
+    }
+
+    YopiSimd yopiSimdDetect()
+    {
+        static const YopiSimd isa = detect();
+        return isa;
+    }
+
+    const char* yopiSimdName(YopiSimd isa)
+    {
+        switch (isa) {
+        case YopiSimd::Avx2:   return "avx2";
+        case YopiSimd::Avx512: return "avx512";
+        default:               return "none";
+        }
+    }
+
+    YopiSimd yopiSimdFromName(const string& name)
+    {
+        YopiSimd isa = YopiSimd::None;
+        if (name == "auto") return yopiSimdDetect();
+        else if (name == "none") return YopiSimd::None;
+        else if (name == "avx2") isa = YopiSimd::Avx2;
+        else if (name == "avx512") isa = YopiSimd::Avx512;
+        else throw std::runtime_error("Unknown instruction set " + name + ".");
+        if (static_cast<int>(isa) > static_cast<int>(yopiSimdDetect()))
+            throw std::runtime_error("This CPU does not support " + name + ".");
+        return isa;
+    }
+
+    void yopiCompressionSimd(YopiSimd isa, const YopiCompressionBlock& b)
+    {
+#if defined(__x86_64__) || defined(_M_X64)
+        switch (isa) {
+        case YopiSimd::Avx512: yopiCompressionAvx512(b); return;
+        case YopiSimd::Avx2:   yopiCompressionAvx2(b); return;
+        default: break;
+        }
+#endif
+        (void)isa;
+        for (size_t i = 0; i < b.n_; ++i)
+            b.comp_[i].ready_ = false;
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "jmodelyopi.h"
+
+// Vectorised compression branch of JModelYopi (monotonic envelope, Xeta
+// unloading, beta reloading), for the non-strict mode of JModelYopi::runBatch().
+// All sub-branches are evaluated across the lanes and blended by mask. The
+// instruction set is chosen at run time from what the CPU supports.
+//
+// Accuracy: the kernel performs the scalar operations in the same order, with
+// IEEE add/mul/div/sqrt and no fused multiply-add; pow(x,0.2) of the reloading
+// branch is taken from the C library per active lane. The normal force of one
+// step is within kYopiSimdUlpBound ulp of run(); the remaining difference comes
+// from pow(x,2) being a product in the kernel, and from FP contraction if the
+// scalar path is built with it (-ffp-contract=fast, /fp:fast).
+
+namespace jmodels
+{
+    enum class YopiSimd { None, Avx2, Avx512 };
+
+    // Bound on the normal force difference of one step to run(), in ulp.
+    static const uint32 kYopiSimdUlpBound = 4;
+
+    // The material constants and the block of contacts the kernel works on.
+    // Contacts in tension or without area are left to the scalar law.
+    struct YopiCompressionBlock {
+        double kn_comp_ = 0.0;
+        double compression_ = 0.0;
+        double ucel_ = 0.0;
+        double uel_limit_ = 0.0;
+        double fel_limit_ = 0.0;
+
+        size_t           n_ = 0;
+        const uint32*    state_ = nullptr;
+        const double*    area_ = nullptr;
+        const double*    normal_force_ = nullptr;
+        const double*    normal_disp_ = nullptr;
+        const double*    normal_disp_inc_ = nullptr;
+        YopiHistory*     hist_ = nullptr;
+        YopiCompression* comp_ = nullptr;
+    };
+
+    // Best instruction set this build and CPU support; checked once.
+    YopiSimd    yopiSimdDetect();
+    // "none", "avx2", "avx512".
+    const char* yopiSimdName(YopiSimd isa);
+    // Parses yopiSimdName() back; "auto" gives yopiSimdDetect(). Throws if the
+    // name is unknown or the CPU does not support it.
+    YopiSimd    yopiSimdFromName(const string& name);
+    // Evaluates the compression branch for every contact of \a b it can, and
+    // sets comp_[i].ready_ accordingly. \a isa must be supported by the CPU.
+    void        yopiCompressionSimd(YopiSimd isa, const YopiCompressionBlock& b);
+
+    // Per instruction set kernels, each in its own translation unit.
+    void        yopiCompressionAvx2(const YopiCompressionBlock& b);
+    void        yopiCompressionAvx512(const YopiCompressionBlock& b);
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,216 @@
+#pragma once
+
+// The compression kernel of jmodelyopisimd.h, written once against a lane type V.
+// Included by the per instruction set translation units after their target
+// pragma, so it must not pull in any header of its own: inline functions
+// instantiated here would be compiled for that instruction set.
+//
+// V provides: width, Mask, V(double), load/store, + - * /, neg, abs, sqrt,
+// lt/le/gt/ge/eq (ordered) and ne (unordered) returning Mask, select(m, a, b),
+// and on Mask: & | ~, bits().
+//
+// Each sub-branch of the scalar law is evaluated on all lanes and blended in
+// where its mask is set, with the operations of JModelYopi::law() in the same
+// order. Masks are taken from the values at the start of the branch, as the
+// if/else chain of the law sees them.
+
+namespace jmodels
+{
+    namespace
+    {
+        const uint32 simd_comp_bits = 0x30; // comp_now | comp_past, see jmodelyopi.cpp
+
+        template <class V>
+        void compressionKernel(const YopiCompressionBlock& b)
+        {
+            typedef typename V::Mask M;
+            const size_t W = V::width;
+            const double kEps = 2.220446049250313e-16; // std::numeric_limits<double>::epsilon()
+
+            const V zero(0.0), one(1.0), two(2.0);
+            const V kn(b.kn_comp_), comp(b.compression_), ucel(b.ucel_);
+            const V uell(b.uel_limit_), fel(b.fel_limit_), fpeak(b.compression_);
+            const V eps(kEps), meps(-kEps);
+            const V fspan = fpeak - fel;
+
+            size_t i0 = 0;
+            for (; i0 + W <= b.n_; i0 += W) {
+                alignas(64) double a_uhc[W], a_reload[W], a_fc[W], a_peak[W], a_plas[W];
+                alignas(64) double a_pert[W], a_fmro[W], a_unro[W], a_dc[W], a_st0[W], a_cp[W];
+                for (size_t j = 0; j < W; ++j) {
+                    const YopiHistory& h = b.hist_[i0 + j];
+                    a_uhc[j] = h.un_hist_comp;
+                    a_reload[j] = h.reloadFlag;
+                    a_fc[j] = h.fc_current;
+                    a_peak[j] = h.peak_normal;
+                    a_plas[j] = h.plasFlag;
+                    a_pert[j] = h.pertFlag;
+                    a_fmro[j] = h.fm_ro;
+                    a_unro[j] = h.un_ro;
+                    a_dc[j] = h.dc;
+                    // law() has moved the 'now' bits to 'past' by the time it gets here
+                    uint32 st = b.state_[i0 + j];
+                    a_st0[j] = st ? 0.0 : 1.0;
+                    a_cp[j] = (st & simd_comp_bits) ? 1.0 : 0.0;
+                }
+
+                V area = V::load(b.area_ + i0);
+                V fn_old = V::load(b.normal_force_ + i0);
+                V dn = neg(V::load(b.normal_disp_inc_ + i0));
+                V un = neg(V::load(b.normal_disp_ + i0));
+                V un_new = un + dn;
+
+                M active = ~lt(un, zero) & ne(area, zero);
+                if (!active.bits()) {
+                    for (size_t j = 0; j < W; ++j)
+                        b.comp_[i0 + j].ready_ = false;
+                    continue;
+                }
+
+                V uhc = V::load(a_uhc), reload = V::load(a_reload), fc = V::load(a_fc);
+                V peak = V::load(a_peak), plas = V::load(a_plas), pert = V::load(a_pert);
+                V fmro = V::load(a_fmro), unro = V::load(a_unro), dc = V::load(a_dc);
+                V st0 = V::load(a_st0), cp = V::load(a_cp);
+
+                V sn = fn_old / area;
+                V dsn = (fn_old - fn_old) / area;
+                V snd = sn + dsn;
+                V fn_new = fn_old;
+                M jump = lt(one, zero);
+
+                // Update unloading history
+                uhc = select(ge(un, uhc) & eq(reload, zero) & ge(dn, zero), un, uhc);
+
+                // ---------------- Monotonic loading in compression ----------------
+                M mA = ge(snd, peak) & eq(cp, zero);
+                M mA1 = mA & le(un, uell);
+                M mA2 = mA & ~le(un, uell) & (ne(st0, zero) | lt(snd, comp));
+                V kna_el = kn * area;
+                V fn_el = fn_old + kna_el * dn;
+
+                V x = (un - uell) / ucel;
+                V val = two * x - x * x;
+                V fenv = fel + fspan * select(ge(val, zero), sqrt(val), zero);
+                V fn_env = select(ge(fenv / un, kn), fn_el, fenv * area);
+
+                reload = select(mA, zero, reload);
+                fn_new = select(mA1, fn_el, select(mA2, fn_env, fn_new));
+                fc = select(mA1 | mA2, fn_new / area, fc);
+                peak = select(mA1 | (mA2 & ge(dn, zero)), fc, peak);
+                plas = select(mA2, one, plas);
+
+                // ---------------- Unloading / reloading in compression -------------
+                M mB = ~mA;
+                M mUnl = lt(dn, zero) & eq(plas, one);
+                M mB1 = mB & mUnl;
+                M mB2 = mB & ~mUnl;
+
+                V mult = select(gt(dc, zero), V(2.5), one);
+                V r = uhc / ucel;
+                V un_plastic = (V(0.47) * mult * r * r + V(0.5) * mult * r) * ucel;
+
+                // Unloading from compression (Xeta curve)
+                pert = select(mB1, select(ge(un, uhc * V(0.985)), two, zero), pert);
+                M mB1a = mB1 & gt(snd, zero) & eq(pert, zero);
+                M mB1b = mB1 & ~mB1a & lt(snd, zero);
+                M mB1c = mB1 & ~mB1a & ~lt(snd, zero);
+                {
+                    V k1 = V(1.5) * kn;
+                    V t = one + uhc / ucel;
+                    V k2 = V(0.15) * kn / (t * t);
+                    V denom_Es = uhc - un_plastic;
+                    denom_Es = select(lt(abs(denom_Es), eps), select(ge(denom_Es, zero), eps, meps), denom_Es);
+                    V Es = peak / denom_Es;
+                    V Xeta = (un_new - uhc) / (un_plastic - uhc);
+                    V B1 = k1 / Es;
+                    V B3 = two - (k2 / Es) * (one + B1);
+                    V B2 = B1 - B3;
+                    V denom_R = one + B2 * Xeta + B3 * Xeta * Xeta;
+                    denom_R = select(lt(abs(denom_R), eps), select(ge(denom_R, zero), eps, meps), denom_R);
+                    V numer_R = B1 * Xeta + Xeta * Xeta;
+                    V fm = peak + (V(1e-12) - peak) * (numer_R / denom_R);
+                    fm = select(le(abs(fm), V(1.7976931348623157e308)), fm, peak + kn * (un_new - uhc));
+                    fm = select(lt(sn, zero), fm + zero, fm);
+
+                    fn_new = select(mB1a, fm * area, fn_new);
+                    fc = select(mB1a, fm, fc);
+                    fmro = select(mB1a, fm, fmro);
+                    unro = select(mB1a, un, unro);
+                }
+                fn_new = select(mB1b, fn_old + zero, select(mB1c, fn_old + kn * area * dn, fn_new));
+                fc = select(mB1b, zero, select(mB1c, fn_new / area, fc));
+                fmro = select(mB1b | mB1c, zero, fmro);
+                reload = select(mB1a | mB1b, one, select(mB1c, zero, reload));
+
+                // Reloading branch
+                M mHold = lt(un, unro) & ge(dn, zero);
+                M mB2a = mB2 & mHold;
+                M mB2b = mB2 & ~mHold & eq(reload, one) & ge(dn, zero);
+                M mB2c = mB2 & ~mB2a & ~mB2b;
+                {
+                    V denom = select(ne(unro, zero), uhc - unro, uhc);
+                    V un_rec = (uhc - unro) / ucel;
+                    V un_rec_nz = select(lt(zero, un_rec), un_rec, zero);
+                    M mLow = lt(uhc, ucel);
+                    alignas(64) double a_pow[W];
+                    un_rec_nz.store(a_pow);
+                    unsigned powLanes = (active & mB2b & ~mLow).bits();
+                    for (size_t j = 0; j < W; ++j)
+                        a_pow[j] = (powLanes >> j) & 1u ? std::pow(a_pow[j], 0.2) : 0.0;
+                    V beta = select(mLow, one / (one + V(0.20) * sqrt(un_rec_nz)),
+                                          one / (one + V(0.35) * V::load(a_pow)));
+
+                    M mSmall = lt(abs(denom), V(1e-12));
+                    V k_re = select(mSmall, kn, (beta * peak - fmro) / denom);
+                    V fm_re = select(mSmall, fmro, fmro + k_re * (un - unro));
+
+                    M mDc = gt(dc, zero);
+                    M mCap = lt(fm_re, comp * (one - dc));
+                    V x_env = (un - uell) / ucel;
+                    V v_env = two * x_env - x_env * x_env;
+                    V fc_env = fel + fspan * sqrt(select(lt(zero, v_env), v_env, zero));
+                    M mEnv = lt(fm_re, fc_env);
+
+                    V fn_re = select(mDc, select(mCap, fm_re * area, fn_new),
+                                          select(mEnv, fm_re * area, fc_env * area));
+                    fn_new = select(mB2b, fn_re, fn_new);
+                    jump = mB2b & mDc & ~mCap;
+                    reload = select(mB2b & ((mDc & ~mCap) | (~mDc & ~mEnv)), zero, reload);
+                    fc = select(mB2b, fn_new / area, fc);
+                }
+                reload = select(mB2a, one, reload);
+                fc = select(mB2a, fn_old / area, fc);
+                fn_new = select(mB2c, fn_old + kn * area * dn, fn_new);
+                fc = select(mB2c, fn_new / area, fc);
+                reload = select(mB2c, zero, reload);
+
+                uhc.store(a_uhc); reload.store(a_reload); fc.store(a_fc); peak.store(a_peak);
+                plas.store(a_plas); pert.store(a_pert); fmro.store(a_fmro); unro.store(a_unro);
+                alignas(64) double a_fn[W];
+                fn_new.store(a_fn);
+                unsigned act = active.bits(), jmp = jump.bits();
+                for (size_t j = 0; j < W; ++j) {
+                    YopiCompression& c = b.comp_[i0 + j];
+                    c.ready_ = (act >> j) & 1u;
+                    if (!c.ready_) continue;
+                    YopiHistory& h = b.hist_[i0 + j];
+                    h.un_hist_comp = a_uhc[j];
+                    h.reloadFlag = a_reload[j];
+                    h.fc_current = a_fc[j];
+                    h.peak_normal = a_peak[j];
+                    h.plasFlag = static_cast<uint32>(a_plas[j]);
+                    h.pertFlag = static_cast<uint32>(a_pert[j]);
+                    h.fm_ro = a_fmro[j];
+                    h.un_ro = a_unro[j];
+                    c.fn_ = a_fn[j];
+                    c.jumptoDC_ = (jmp >> j) & 1u;
+                }
+            }
+            // The tail is left to the scalar law.
+            for (; i0 < b.n_; ++i0)
+                b.comp_[i0].ready_ = false;
+        }
+    } // namespace
+} // namespace jmodels
+
+// EOF
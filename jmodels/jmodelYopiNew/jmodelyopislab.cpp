@@ -0,0 +1,203 @@
+#include "jmodelyopislab.h"
+#include "jmodelyopi.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace jmodels
+{
+#ifdef YOPI_SLAB
+    namespace
+    {
+        const size_t blockAlign = alignof(std::max_align_t);
+        const size_t blockSize = (sizeof(JModelYopi) + blockAlign - 1) / blockAlign * blockAlign;
+        static_assert(alignof(JModelYopi) <= blockAlign, "JModelYopi needs a stricter alignment than the slab gives.");
+        const size_t slabBlocks = 1024; // blocks per slab
+        const size_t batch = 64;        // blocks moved between a cache and the shared list at once
+        const size_t cacheMax = 2 * batch;
+
+        // A free block holds the link to the next one.
+        struct FreeBlock {
+            FreeBlock* next_;
+        };
+
+        struct Chain {
+            FreeBlock* head_ = nullptr;
+            size_t     count_ = 0;
+
+            void push(void* p)
+            {
+                FreeBlock* b = static_cast<FreeBlock*>(p);
+                b->next_ = head_;
+                head_ = b;
+                ++count_;
+            }
+            void* pop()
+            {
+                FreeBlock* b = head_;
+                head_ = b->next_;
+                --count_;
+                return b;
+            }
+        };
+
+        // The counters of one thread. Only the owning thread writes them.
+        struct alignas(64) Shard {
+            std::atomic<uint64> allocations_{ 0 };
+            std::atomic<uint64> frees_{ 0 };
+            std::atomic<uint64> cached_{ 0 };
+            std::atomic<uint64> refills_{ 0 };
+            std::atomic<uint64> spills_{ 0 };
+        };
+
+        void bump(std::atomic<uint64>& c)
+        {
+            c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        // Never freed: models deleted while statics are torn down, and the
+        // counts of threads that have ended, still have a home.
+        struct Shared {
+            std::mutex          mutex_;
+            Chain               free_;
+            uint64              slabs_ = 0;
+            std::vector<Shard*> shards_;
+
+            // Moves up to \a n blocks to \a to, carving a new slab if none is free.
+            void take(Chain& to, size_t n)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!free_.count_) {
+                    char* slab = static_cast<char*>(::operator new(slabBlocks * blockSize));
+                    for (size_t i = slabBlocks; i--;)
+                        free_.push(slab + i * blockSize);
+                    ++slabs_;
+                }
+                while (n-- && free_.count_)
+                    to.push(free_.pop());
+            }
+            // Moves \a n blocks of \a from back.
+            void give(Chain& from, size_t n)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                while (n-- && from.count_)
+                    free_.push(from.pop());
+            }
+        };
+
+        Shared& shared()
+        {
+            static Shared* s = new Shared; // outlives every contact
+            return *s;
+        }
+
+        struct Cache {
+            Chain free_;
+            ~Cache() { shared().give(free_, free_.count_); }
+        };
+
+        // Plain pointers, still readable while the thread is torn down.
+        thread_local Shard* tlsShard = nullptr;
+        thread_local Cache* tlsCache = nullptr;
+        thread_local bool   tlsEnded = false;
+
+        Shard* shard()
+        {
+            if (Shard* s = tlsShard) return s;
+            Shard* s = new Shard;
+            Shared& g = shared();
+            std::lock_guard<std::mutex> lock(g.mutex_);
+            g.shards_.push_back(s);
+            tlsShard = s;
+            return s;
+        }
+
+        // The cache of the calling thread, null once its destructor has run.
+        Cache* cache()
+        {
+            if (Cache* c = tlsCache) return c;
+            if (tlsEnded) return nullptr;
+            struct Owner {
+                Cache cache_;
+                ~Owner()
+                {
+                    tlsCache = nullptr;
+                    tlsEnded = true;
+                }
+            };
+            static thread_local Owner owner;
+            tlsCache = &owner.cache_;
+            return tlsCache;
+        }
+    }
+
+    bool yopiSlabEnabled() { return true; }
+
+    YopiSlabStats yopiSlabStats()
+    {
+        YopiSlabStats r;
+        Shared& g = shared();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        for (auto s : g.shards_) {
+            r.allocations_ += s->allocations_.load(std::memory_order_relaxed);
+            r.frees_ += s->frees_.load(std::memory_order_relaxed);
+            r.cached_ += s->cached_.load(std::memory_order_relaxed);
+            r.refills_ += s->refills_.load(std::memory_order_relaxed);
+            r.spills_ += s->spills_.load(std::memory_order_relaxed);
+        }
+        r.slabs_ = g.slabs_;
+        r.blocks_ = g.slabs_ * slabBlocks;
+        return r;
+    }
+
+    void* yopiSlabAllocate(size_t size)
+    {
+        if (size > blockSize) return ::operator new(size);
+        Shard* s = shard();
+        bump(s->allocations_);
+        Cache* c = cache();
+        if (!c) { // thread teardown: one block straight from the shared list
+            Chain one;
+            shared().take(one, 1);
+            return one.pop();
+        }
+        if (c->free_.count_) bump(s->cached_);
+        else {
+            shared().take(c->free_, batch);
+            bump(s->refills_);
+        }
+        return c->free_.pop();
+    }
+
+    void yopiSlabFree(void* p, size_t size)
+    {
+        if (!p) return;
+        if (size > blockSize) {
+            ::operator delete(p);
+            return;
+        }
+        Shard* s = shard();
+        bump(s->frees_);
+        Cache* c = cache();
+        if (!c) {
+            Chain one;
+            one.push(p);
+            shared().give(one, 1);
+            return;
+        }
+        c->free_.push(p);
+        if (c->free_.count_ > cacheMax) {
+            shared().give(c->free_, batch);
+            bump(s->spills_);
+        }
+    }
+#else
+    bool          yopiSlabEnabled() { return false; }
+    YopiSlabStats yopiSlabStats() { return YopiSlabStats(); }
+    void*         yopiSlabAllocate(size_t size) { return ::operator new(size); }
+    void          yopiSlabFree(void* p, size_t) { ::operator delete(p); }
+#endif
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <cstddef>
+
+// Storage of the JModelYopi instances, when built with YOPI_SLAB: createInstance(),
+// clone() and destroy() then go through JModelYopi::operator new/delete, which
+// take blocks from here instead of the general heap. 3DEC creates and deletes a
+// model with every subcontact, and while contacts are detected that churn never
+// stops.
+//
+// Blocks are carved out of slabs of many models each, which are never given
+// back. Every thread keeps a cache of free blocks, so most allocations and
+// frees take no lock; the cache is refilled from the shared free list, and
+// spills into it, a batch of blocks at a time. A block freed on another thread
+// than the one it came from joins the cache of the thread freeing it. The
+// cache of a thread that ends goes back to the shared list.
+//
+// Only the driver build defines YOPI_SLAB (driver/CMakeLists.txt): against the
+// mock host the slabs make no measurable difference to setup and restore
+// times, and memory of deleted contacts is never returned to the heap. The
+// plugin uses the general heap until a gain is shown against that of 3DEC.
+// Without YOPI_SLAB the functions below use the general heap and the
+// statistics stay 0.
+
+namespace jmodels
+{
+    // Totals over all threads.
+    struct YopiSlabStats {
+        uint64 allocations_ = 0; // blocks handed out
+        uint64 frees_ = 0;       // blocks given back
+        uint64 cached_ = 0;      // allocations served from the cache of the thread, no lock
+        uint64 refills_ = 0;     // batches taken from the shared free list
+        uint64 spills_ = 0;      // batches given back to it
+        uint64 slabs_ = 0;       // slabs allocated
+        uint64 blocks_ = 0;      // blocks in those slabs
+        uint64 live() const { return allocations_ - frees_; }
+    };
+
+    // False unless built with YOPI_SLAB.
+    bool          yopiSlabEnabled();
+    // Summed when queried: query while no contacts are created or deleted.
+    YopiSlabStats yopiSlabStats();
+    // A block for an object of \a size bytes. Sizes above that of JModelYopi
+    // (a derived model) come from the general heap. Thread safe.
+    void*         yopiSlabAllocate(size_t size);
+    // Gives back a block of yopiSlabAllocate(size). Thread safe.
+    void          yopiSlabFree(void* p, size_t size);
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,356 @@
+#include "jmodelyopisnapshot.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace jmodels
+{
+    const char* yopiSnapshotFieldName(YopiSnapshotField f)
+    {
+        switch (f) {
+        case YopiSnapshotField::Dt:    return "dt";
+        case YopiSnapshotField::Ds:    return "ds";
+        case YopiSnapshotField::Dc:    return "dc";
+        case YopiSnapshotField::Dts:   return "d_ts";
+        case YopiSnapshotField::TP:    return "tensile-disp-plastic";
+        case YopiSnapshotField::SP:    return "shear-disp-plastic";
+        case YopiSnapshotField::Count: break;
+        }
+        return "?";
+    }
+
+    std::atomic<uint64> yopiSnapshotEpoch{ 0 };
+
+    namespace
+    {
+        const char   fileMagic[8] = "YOPISNP";
+        const char   indexMagic[8] = "YOPIIDX";
+        const uint32 frameMagic = 0x4d415246; // "FRAM"
+        const uint32 version = 1;
+
+        struct FileHeader {
+            char   magic_[8];
+            uint32 version_;
+            uint32 fields_; // kYopiSnapshotFields
+            double damageTolerance_;
+            double displacementTolerance_;
+            uint32 keyframeEvery_;
+            uint32 reserved_;
+        };
+        // Followed by uint64 ids[count_] and double values[count_][fields_].
+        struct FrameHeader {
+            uint32 magic_;
+            uint32 keyframe_;
+            double label_;
+            uint64 count_;
+        };
+        // The last bytes of a closed file, after the index.
+        struct Trailer {
+            uint64 indexOffset_;
+            uint64 frames_;
+            char   magic_[8];
+        };
+
+        struct Record {
+            uint64             id_;
+            YopiSnapshotValues v_;
+        };
+
+        // The submissions of one thread. Shards are never freed; they are
+        // emptied when a snapshot is sealed, between cycles.
+        struct Shard {
+            std::vector<Record> records_;
+        };
+
+        struct Writer {
+            std::mutex                                     mutex_;
+            std::vector<Shard*>                            shards_;
+            std::unique_ptr<std::ofstream>                 out_;
+            YopiSnapshotOptions                            options_;
+            YopiSnapshotStats                              stats_;
+            std::unordered_map<uint64, YopiSnapshotValues> stored_; // as the file last has them
+            std::vector<FrameHeader>                       index_;
+            std::vector<uint64>                            offsets_;
+            double                                         label_ = 0.0;
+            uint64                                         nextEpoch_ = 1;
+            bool                                           envTried_ = false;
+        };
+
+        Writer& writer()
+        {
+            static Writer* w = new Writer; // outlives every contact
+            return *w;
+        }
+
+        thread_local Shard* tlsShard = nullptr;
+
+        // Drops the file after a failed write, and throws. Under the mutex.
+        void check(Writer& w)
+        {
+            if (*w.out_) return;
+            const string path = w.stats_.path_;
+            yopiSnapshotEpoch.store(0, std::memory_order_relaxed);
+            for (auto s : w.shards_) s->records_.clear();
+            w.out_.reset();
+            w.stored_.clear();
+            w.index_.clear();
+            w.offsets_.clear();
+            w.label_ = 0.0;
+            w.stats_.open_ = false;
+            throw std::runtime_error("yopiSnapshot: unable to write " + path);
+        }
+
+        void put(Writer& w, const void* p, size_t n)
+        {
+            w.out_->write(static_cast<const char*>(p), static_cast<std::streamsize>(n));
+            check(w);
+            w.stats_.bytes_ += n;
+        }
+
+        bool moved(const YopiSnapshotOptions& o, const YopiSnapshotValues& a, const YopiSnapshotValues& b)
+        {
+            for (uint32 k = 0; k < kYopiSnapshotFields; ++k) {
+                const double tol = k < static_cast<uint32>(YopiSnapshotField::TP) ? o.damageTolerance_
+                                                                                   : o.displacementTolerance_;
+                if (!(std::abs(a[k] - b[k]) <= tol)) return true; // NaN counts as moved
+            }
+            return false;
+        }
+
+        // Writes the snapshot being taken as a frame. Under the mutex.
+        void sealLocked(Writer& w)
+        {
+            const uint64 epoch = yopiSnapshotEpoch.load(std::memory_order_relaxed);
+            if (!epoch || !w.out_) return;
+            yopiSnapshotEpoch.store(0, std::memory_order_relaxed);
+            std::vector<Record> in;
+            for (auto s : w.shards_) {
+                in.insert(in.end(), s->records_.begin(), s->records_.end());
+                s->records_.clear();
+            }
+            // In contact-id order, whatever the threads: the same file for the same run.
+            std::stable_sort(in.begin(), in.end(), [](const Record& a, const Record& b) { return a.id_ < b.id_; });
+            const bool key = w.index_.size() % std::max<uint32>(1, w.options_.keyframeEvery_) == 0;
+            std::vector<Record> out;
+            for (auto& r : in) {
+                auto it = w.stored_.find(r.id_);
+                if (it == w.stored_.end()) it = w.stored_.emplace(r.id_, r.v_).first;
+                else if (key || moved(w.options_, it->second, r.v_)) it->second = r.v_;
+                else continue;
+                if (!key) out.push_back(r);
+            }
+            if (key) {
+                out.reserve(w.stored_.size());
+                for (auto& e : w.stored_) out.push_back({ e.first, e.second });
+                std::sort(out.begin(), out.end(), [](const Record& a, const Record& b) { return a.id_ < b.id_; });
+            }
+
+            FrameHeader h = { frameMagic, key ? 1u : 0u, w.label_, out.size() };
+            w.offsets_.push_back(w.stats_.bytes_);
+            w.index_.push_back(h);
+            put(w, &h, sizeof(h));
+            for (auto& r : out) put(w, &r.id_, sizeof(r.id_));
+            for (auto& r : out) put(w, r.v_.data(), sizeof(r.v_));
+            w.out_->flush();
+            check(w);
+            ++w.stats_.frames_;
+            if (key) ++w.stats_.keyframes_;
+            w.stats_.contacts_ = w.stored_.size();
+            w.stats_.submitted_ += in.size();
+            w.stats_.records_ += out.size();
+            w.stats_.fullBytes_ += sizeof(h) + in.size() * sizeof(Record);
+        }
+
+        void closeLocked(Writer& w)
+        {
+            if (!w.out_) return;
+            sealLocked(w);
+            Trailer t = { w.stats_.bytes_, w.index_.size(), {} };
+            std::memcpy(t.magic_, indexMagic, sizeof(t.magic_));
+            for (size_t f = 0; f < w.index_.size(); ++f) {
+                const FrameHeader& h = w.index_[f];
+                put(w, &w.offsets_[f], sizeof(uint64));
+                put(w, &h.label_, sizeof(h.label_));
+                put(w, &h.count_, sizeof(h.count_));
+                const uint32 flags[2] = { h.keyframe_, 0 };
+                put(w, flags, sizeof(flags));
+            }
+            put(w, &t, sizeof(t));
+            w.out_->close();
+            check(w);
+            w.out_.reset();
+            w.stored_.clear();
+            w.index_.clear();
+            w.offsets_.clear();
+            w.label_ = 0.0;
+            w.stats_.open_ = false;
+        }
+
+        void openLocked(Writer& w, const string& path, const YopiSnapshotOptions& o)
+        {
+            closeLocked(w);
+            std::unique_ptr<std::ofstream> out(new std::ofstream(path, std::ios::binary | std::ios::trunc));
+            if (!*out) throw std::runtime_error("yopiSnapshotOpen: unable to create " + path);
+            w.out_ = std::move(out);
+            w.options_ = o;
+            w.stats_ = YopiSnapshotStats();
+            w.stats_.open_ = true;
+            w.stats_.path_ = path;
+            FileHeader h = { {}, version, kYopiSnapshotFields, o.damageTolerance_, o.displacementTolerance_,
+                             o.keyframeEvery_, 0 };
+            std::memcpy(h.magic_, fileMagic, sizeof(h.magic_));
+            put(w, &h, sizeof(h));
+        }
+
+        // The index is written when the plugin is unloaded, if it can be locked.
+        struct ExitClose {
+            ~ExitClose()
+            {
+                Writer& w = writer();
+                std::unique_lock<std::mutex> lock(w.mutex_, std::try_to_lock);
+                if (!lock.owns_lock()) return;
+                try {
+                    closeLocked(w);
+                }
+                catch (std::exception&) {
+                    // the file stays as far as it got
+                }
+            }
+        } exitClose;
+    }
+
+    void yopiSnapshotOpen(const string& path, const YopiSnapshotOptions& o)
+    {
+        Writer& w = writer();
+        std::lock_guard<std::mutex> lock(w.mutex_);
+        openLocked(w, path, o);
+    }
+
+    void yopiSnapshotTake(double label)
+    {
+        Writer& w = writer();
+        std::lock_guard<std::mutex> lock(w.mutex_);
+        if (!w.out_ && !w.envTried_) {
+            w.envTried_ = true;
+            if (const char* path = std::getenv("YOPI_SNAPSHOT")) {
+                try {
+                    openLocked(w, path, YopiSnapshotOptions());
+                }
+                catch (std::exception&) {
+                    // no snapshots; run() goes on
+                }
+            }
+        }
+        if (!w.out_) return;
+        if (yopiSnapshotEpoch.load(std::memory_order_relaxed) && label == w.label_) return;
+        sealLocked(w);
+        w.label_ = label;
+        yopiSnapshotEpoch.store(w.nextEpoch_++, std::memory_order_relaxed);
+    }
+
+    double yopiSnapshotLabel()
+    {
+        Writer& w = writer();
+        std::lock_guard<std::mutex> lock(w.mutex_);
+        return w.label_;
+    }
+
+    void yopiSnapshotClose()
+    {
+        Writer& w = writer();
+        std::lock_guard<std::mutex> lock(w.mutex_);
+        closeLocked(w);
+    }
+
+    YopiSnapshotStats yopiSnapshotStats()
+    {
+        Writer& w = writer();
+        std::lock_guard<std::mutex> lock(w.mutex_);
+        return w.stats_;
+    }
+
+    void yopiSnapshotSubmit(uint64 id, YopiSnapshotSlot& s, const YopiSnapshotValues& v)
+    {
+        Shard* p = tlsShard;
+        if (!p) {
+            p = new Shard;
+            Writer& w = writer();
+            std::lock_guard<std::mutex> lock(w.mutex_);
+            w.shards_.push_back(p);
+            tlsShard = p;
+        }
+        p->records_.push_back({ id, v });
+        s.epoch_ = yopiSnapshotEpoch.load(std::memory_order_relaxed);
+    }
+
+    YopiSnapshotFile::YopiSnapshotFile(const string& path) :
+        in_(path, std::ios::binary)
+    {
+        FileHeader h;
+        if (!in_.read(reinterpret_cast<char*>(&h), sizeof(h)) || std::memcmp(h.magic_, fileMagic, sizeof(h.magic_))
+            || h.version_ != version || h.fields_ != kYopiSnapshotFields)
+            throw std::runtime_error(path + " is not a Yopi snapshot file.");
+        options_.damageTolerance_ = h.damageTolerance_;
+        options_.displacementTolerance_ = h.displacementTolerance_;
+        options_.keyframeEvery_ = h.keyframeEvery_;
+
+        in_.seekg(0, std::ios::end);
+        const uint64 size = static_cast<uint64>(in_.tellg());
+        Trailer t;
+        if (size >= sizeof(h) + sizeof(t)) {
+            in_.seekg(static_cast<std::streamoff>(size - sizeof(t)));
+            if (in_.read(reinterpret_cast<char*>(&t), sizeof(t)) && !std::memcmp(t.magic_, indexMagic, sizeof(t.magic_))
+                && t.indexOffset_ + t.frames_ * sizeof(Frame) + sizeof(t) == size) {
+                frames_.resize(t.frames_);
+                in_.seekg(static_cast<std::streamoff>(t.indexOffset_));
+                indexed_ = frames_.empty()
+                           || !!in_.read(reinterpret_cast<char*>(frames_.data()),
+                                         static_cast<std::streamsize>(frames_.size() * sizeof(Frame)));
+            }
+        }
+        if (indexed_) return;
+        // Not closed: walk the frames, up to the first one cut short.
+        frames_.clear();
+        in_.clear();
+        const uint64 recordBytes = sizeof(uint64) + sizeof(YopiSnapshotValues);
+        for (uint64 at = sizeof(h); at + sizeof(FrameHeader) <= size;) {
+            FrameHeader fh;
+            in_.seekg(static_cast<std::streamoff>(at));
+            if (!in_.read(reinterpret_cast<char*>(&fh), sizeof(fh)) || fh.magic_ != frameMagic) break;
+            const uint64 end = at + sizeof(fh) + fh.count_ * recordBytes;
+            if (end > size) break;
+            frames_.push_back({ at, fh.label_, fh.count_, fh.keyframe_, 0 });
+            at = end;
+        }
+        in_.clear();
+    }
+
+    YopiSnapshotFile::Field YopiSnapshotFile::load(size_t f)
+    {
+        Field r;
+        if (f >= frames_.size()) throw std::runtime_error("YopiSnapshotFile: no such frame.");
+        size_t k = f;
+        while (k && !frames_[k].keyframe_) --k;
+        for (; k <= f; ++k) apply(frames_[k], r);
+        return r;
+    }
+
+    void YopiSnapshotFile::apply(const Frame& fr, Field& to)
+    {
+        std::vector<uint64>             ids(fr.count_);
+        std::vector<YopiSnapshotValues> values(fr.count_);
+        in_.clear();
+        in_.seekg(static_cast<std::streamoff>(fr.offset_ + sizeof(FrameHeader)));
+        if (!in_.read(reinterpret_cast<char*>(ids.data()), static_cast<std::streamsize>(ids.size() * sizeof(uint64)))
+            || !in_.read(reinterpret_cast<char*>(values.data()),
+                         static_cast<std::streamsize>(values.size() * sizeof(YopiSnapshotValues))))
+            throw std::runtime_error("YopiSnapshotFile: frame cut short.");
+        for (size_t i = 0; i < ids.size(); ++i) to[ids[i]] = values[i];
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+// Snapshots of the damage field (dt, ds, dc, d_ts and the plastic
+// displacements tP_, sP_) of every contact that has a contact-id, for
+// animating crack growth over long runs without a full dump through FISH each
+// time.
+//
+// yopiSnapshotTake() starts a snapshot: each contact with a contact-id hands
+// its values over in its next run(), into a buffer of its thread. The next
+// yopiSnapshotTake() or yopiSnapshotClose() seals the snapshot into a frame of
+// the file. A frame holds only the contacts whose values moved by more than
+// the tolerance from what the file last stored for them, so a value read back
+// is never further than the tolerance from the true one. Every keyframeEvery_
+// frames a keyframe stores every contact known. Contacts that did not run
+// between two takes keep their last values.
+//
+// The file: a header, the frames, each its own header, the contact-ids and the
+// values [record][field]; at close, an index of the frames, so YopiSnapshotFile
+// finds a frame without reading the ones before (it rebuilds the index by
+// scanning a file that was not closed).
+//
+// Take and close between cycles, from the driver or a host hook: the plugin
+// exports them as yopiSnapshotTakeLabel() and yopiSnapshotCloseFile(). The
+// contacts only carry their contact-id, set by the export yopiSetContactId().
+// Setting the environment variable YOPI_SNAPSHOT to a file name opens that
+// file on the first snapshot, and
+// closes it when the plugin is unloaded. A write that fails (a full disk,
+// say) closes the file, as far as it got, and throws.
+
+namespace jmodels
+{
+    enum class YopiSnapshotField : uint32 {
+        Dt,  // tensile damage
+        Ds,  // shear damage
+        Dc,  // compressive damage
+        Dts, // combined tension-shear damage (d_ts)
+        TP,  // tensile plastic displacement (tensile-disp-plastic)
+        SP,  // shear plastic displacement (shear-disp-plastic)
+        Count
+    };
+    static const uint32 kYopiSnapshotFields = static_cast<uint32>(YopiSnapshotField::Count);
+    typedef std::array<double, kYopiSnapshotFields> YopiSnapshotValues;
+
+    // Short name of \a f, as the property it is read from.
+    const char* yopiSnapshotFieldName(YopiSnapshotField f);
+
+    struct YopiSnapshotOptions {
+        double damageTolerance_ = 1e-3;       // of dt, ds, dc, d_ts
+        double displacementTolerance_ = 1e-7; // of tP_, sP_
+        uint32 keyframeEvery_ = 16;           // frames per keyframe, 1 keyframes them all
+    };
+
+    struct YopiSnapshotStats {
+        bool   open_ = false;
+        string path_;
+        uint64 frames_ = 0;
+        uint64 keyframes_ = 0;
+        uint64 contacts_ = 0;  // contact-ids seen
+        uint64 submitted_ = 0; // values handed over by contacts
+        uint64 records_ = 0;   // of those, written to the file
+        uint64 bytes_ = 0;     // written to the file
+        uint64 fullBytes_ = 0; // a full dump of every submitted contact would have written
+    };
+
+    // Per contact: the last snapshot it took part in. The contact-id is the
+    // model's own, shared with jmodelyopicrack.h.
+    struct YopiSnapshotSlot {
+        uint64 epoch_ = 0;
+    };
+
+    // Opens a snapshot file at \a path, closing any open. Throws if the file
+    // cannot be created.
+    void              yopiSnapshotOpen(const string& path, const YopiSnapshotOptions& o = YopiSnapshotOptions());
+    // Seals the snapshot being taken, if any, and starts one labelled \a label.
+    // Nothing if \a label is that of the snapshot being taken. Opens the file
+    // of YOPI_SNAPSHOT if none is open; nothing if there is none either.
+    // Throws if the file cannot be written.
+    void              yopiSnapshotTake(double label);
+    // Label of the last snapshot started, 0 if none.
+    double            yopiSnapshotLabel();
+    // Seals the snapshot being taken, writes the index and closes the file.
+    // Throws if the file cannot be written; it is closed all the same.
+    void              yopiSnapshotClose();
+    YopiSnapshotStats yopiSnapshotStats();
+
+    // The snapshot being taken, 0 if none.
+    extern std::atomic<uint64> yopiSnapshotEpoch;
+    // True if contact \a id (0 for none), of slot \a s, has a snapshot to take part in.
+    inline bool       yopiSnapshotDue(uint64 id, const YopiSnapshotSlot& s)
+    {
+        const uint64 e = yopiSnapshotEpoch.load(std::memory_order_relaxed);
+        return e && id && e != s.epoch_;
+    }
+    // Hands \a v of contact \a id over to the snapshot being taken. Thread
+    // safe for distinct \a s.
+    void              yopiSnapshotSubmit(uint64 id, YopiSnapshotSlot& s, const YopiSnapshotValues& v);
+
+    // Reads a snapshot file back.
+    class YopiSnapshotFile {
+    public:
+        typedef std::unordered_map<uint64, YopiSnapshotValues> Field;
+
+        // Throws if \a path is not a snapshot file.
+        explicit YopiSnapshotFile(const string& path);
+        const YopiSnapshotOptions& options() const { return options_; }
+        size_t frames() const { return frames_.size(); }
+        double label(size_t f) const { return frames_[f].label_; }
+        bool   keyframe(size_t f) const { return frames_[f].keyframe_ != 0; }
+        uint64 records(size_t f) const { return frames_[f].count_; }
+        // False if the index was rebuilt: the file was not closed.
+        bool   indexed() const { return indexed_; }
+        // The values of every contact at frame \a f: the keyframe at or
+        // before it, with the frames after it applied.
+        Field  load(size_t f);
+
+    private:
+        struct Frame {
+            uint64 offset_;
+            double label_;
+            uint64 count_;
+            uint32 keyframe_;
+            uint32 reserved_;
+        };
+        void apply(const Frame& fr, Field& to);
+
+        std::ifstream       in_;
+        YopiSnapshotOptions options_;
+        std::vector<Frame>  frames_;
+        bool                indexed_ = false;
+    };
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,181 @@
+#include "jmodelyopi.h"
+#include "state.h"
+#include <algorithm>
+#include <cmath>
+
+// Error-controlled sub-stepping of JModelYopi::law(), see JModelYopi::substep().
+
+namespace jmodels
+{
+    namespace
+    {
+        const uint32 nowBits = 0x01 | 0x02 | 0x10; // slip_now, tension_now, comp_now (see jmodelyopi.cpp)
+        const uint32 defaultSubstepMax = 64;
+
+        // The State fields the law writes, to roll a trial sub-step back.
+        struct Snapshot {
+            uint32 state_;
+            double normal_force_;
+            DVect3 shear_force_;
+            double normal_force_inc_;
+            DVect3 shear_force_inc_;
+            double dnop_;
+            double working_[State::max_working_];
+            int32  iworking_[State::max_iworking_];
+
+            void save(const State& s)
+            {
+                state_ = s.state_;
+                normal_force_ = s.normal_force_;
+                shear_force_ = s.shear_force_;
+                normal_force_inc_ = s.normal_force_inc_;
+                shear_force_inc_ = s.shear_force_inc_;
+                dnop_ = s.dnop_;
+                std::copy(s.working_, s.working_ + State::max_working_, working_);
+                std::copy(s.iworking_, s.iworking_ + State::max_iworking_, iworking_);
+            }
+            void load(State& s) const
+            {
+                s.state_ = state_;
+                s.normal_force_ = normal_force_;
+                s.shear_force_ = shear_force_;
+                s.normal_force_inc_ = normal_force_inc_;
+                s.shear_force_inc_ = shear_force_inc_;
+                s.dnop_ = dnop_;
+                std::copy(working_, working_ + State::max_working_, s.working_);
+                std::copy(iworking_, iworking_ + State::max_iworking_, s.iworking_);
+            }
+        };
+
+        double l1(const DVect3& v) { return std::abs(v.x()) + std::abs(v.y()) + std::abs(v.z()); }
+    }
+
+    // One step of the law over the fraction [t0, t1] of the host's increment.
+    // The displacements seen by the law are those at the end of the fraction.
+    void JModelYopi::lawFraction(YopiHistory& h, Energies* e, State* s, double dn, const DVect3& dus,
+                                 double un_end, const DVect3& us_end, double t0, double t1) const
+    {
+        s->normal_disp_inc_ = dn * (t1 - t0);
+        s->shear_disp_inc_ = dus * (t1 - t0);
+        s->normal_disp_ = t1 == 1.0 ? un_end : un_end - dn * (1.0 - t1);
+        s->shear_disp_ = t1 == 1.0 ? us_end : us_end - dus * (1.0 - t1);
+        law(h, e, s);
+    }
+
+    // A step whose elastic force increment is within the tolerance of the
+    // force scale of the contact is taken whole. Otherwise the increment is
+    // cut into fractions: each is taken once whole and once as two halves,
+    // from the same start, and the difference of the two ends (in force,
+    // relative to the force scale, and in the dt, ds, dc damages) estimates
+    // the error of the halves. Within the tolerance, the halves are kept and
+    // the next fraction may double; else both are rolled back and the fraction
+    // is halved, down to 1 / substep-max of the step.
+    //
+    // Towards the host the result is one step: the force increments add up,
+    // dnop_ is measured from the start of the step, and the state has the
+    // 'now' bits of any sub-step on top of the 'past' bits of the step before.
+    void JModelYopi::substep(YopiHistory& h, Energies* e, State* s) const
+    {
+        const YopiMaterial& mat = *mat_;
+        const double tol = mat.substep_tol_;
+        const double area = s->area_;
+        const double dn = s->normal_disp_inc_;
+        const DVect3 dus = s->shear_disp_inc_;
+        auto forceScale = [&]() {
+            double f = std::max({ std::abs(s->normal_force_) + s->shear_force_.mag(),
+                                  mat.tension_ * area, mat.cohesion_ * area });
+            if (!(f > 0.0)) f = mat.compression_ * area;
+            return f > 0.0 ? f : 1.0;
+        };
+        const double kn = std::max(h.kn_, mat.kn_initial_);
+        const double elastic = kn * area * std::abs(dn) + mat.ks_ * area * l1(dus);
+        if (!area || !(elastic > tol * forceScale())) {
+            law(h, e, s);
+            return;
+        }
+
+        const double un_end = s->normal_disp_;
+        const DVect3 us_end = s->shear_disp_;
+        // What law() does to the state bits before the first sub-step.
+        uint32 state = s->state_;
+        if (state & 0x01) state |= 0x04;
+        if (state & 0x02) state |= 0x08;
+        if (state & 0x10) state |= 0x20;
+        state &= ~nowBits;
+        uint32 now = 0;
+
+        const double smallest = 1.0 / (mat.substep_max_ >= 1.0 ? mat.substep_max_ : defaultSubstepMax);
+        double dnop = dn;
+        bool   opened = false;
+        double fn_inc = 0.0;
+        DVect3 fs_inc(0.0);
+
+        Snapshot start, whole;
+        YopiHistory h0, hw;
+        Energies e0;
+        double t = 0.0;
+        double frac = 1.0;
+        while (t < 1.0) {
+            double t1 = (frac >= 1.0 - t) ? 1.0 : t + frac;
+            double tm = t + 0.5 * (t1 - t);
+            start.save(*s);
+            h0 = h;
+            if (e) e0 = *e;
+
+            lawFraction(h, e, s, dn, dus, un_end, us_end, t, t1);
+            whole.save(*s);
+            hw = h;
+
+            start.load(*s);
+            h = h0;
+            if (e) *e = e0;
+            lawFraction(h, e, s, dn, dus, un_end, us_end, t, tm);
+            const double inc_half = s->normal_disp_inc_;
+            const double fn_half = s->normal_force_inc_;
+            const DVect3 fs_half = s->shear_force_inc_;
+            const double dnop_half = s->dnop_;
+            const uint32 now_half = s->state_ & nowBits;
+            lawFraction(h, e, s, dn, dus, un_end, us_end, tm, t1);
+
+            const double ferr = (std::abs(s->normal_force_ - whole.normal_force_)
+                                 + (s->shear_force_ - whole.shear_force_).mag()) / forceScale();
+            const double derr = std::max({ std::abs(h.dt - hw.dt), std::abs(h.ds - hw.ds), std::abs(h.dc - hw.dc) });
+            const double err = std::max(ferr, derr);
+            if (err > tol && t1 - t > smallest) {
+                start.load(*s);
+                h = h0;
+                if (e) *e = e0;
+                frac = 0.5 * (t1 - t);
+                continue;
+            }
+
+            // Keep the two halves.
+            if (!opened && dnop_half != inc_half) {
+                dnop = dn * t + dnop_half;
+                opened = true;
+            }
+            if (!opened && s->dnop_ != s->normal_disp_inc_) {
+                dnop = dn * tm + s->dnop_;
+                opened = true;
+            }
+            fn_inc += fn_half + s->normal_force_inc_;
+            fs_inc += fs_half + s->shear_force_inc_;
+            now |= now_half | (s->state_ & nowBits);
+            frac = 2.0 * (t1 - t);
+            t = t1;
+        }
+
+        s->normal_disp_inc_ = dn;
+        s->shear_disp_inc_ = dus;
+        s->normal_disp_ = un_end;
+        s->shear_disp_ = us_end;
+        s->normal_force_inc_ = fn_inc;
+        s->shear_force_inc_ = fs_inc;
+        s->dnop_ = dnop;
+        s->state_ = state | now;
+        h.openInc_ = dn; // of the whole step
+        h.slip_ = s->state_ & 0x01 ? 1.0 : 0.0;
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,104 @@
+#include "jmodelyopitable.h"
+#include "state.h"
+#include <algorithm>
+
+namespace jmodels
+{
+    namespace
+    {
+        // Whether table \a index of \a s is constant past \a end: flat at end,
+        // 2 end and 4 end.
+        bool flatFrom(const State& s, void* index, double end)
+        {
+            const double y = s.getYFromX(index, end);
+            return s.getSlopeFromX(index, end) == 0.0 && s.getSlopeFromX(index, 2.0 * end) == 0.0
+                   && s.getYFromX(index, 2.0 * end) == y && s.getYFromX(index, 4.0 * end) == y;
+        }
+    }
+
+    double YopiTable::errorTo(const State& s, void* index, double limit) const
+    {
+        const double dn = static_cast<double>(line_.size());
+        double err = 0.0;
+        for (size_t i = 0; i < line_.size() && err <= limit; ++i) {
+            const double x0 = end_ * static_cast<double>(i) / dn, x1 = end_ * static_cast<double>(i + 1) / dn;
+            for (int k = 1; k <= 8; ++k) {
+                const double x = x0 + (x1 - x0) * k / 9.0;
+                err = std::max(err, std::abs(y(x) - s.getYFromX(index, x)));
+            }
+        }
+        return err;
+    }
+
+    bool YopiTable::matches(const State& s, void* index, double tolerance) const
+    {
+        if (index != index_ || tolerance != tolerance_) return false;
+        if (s.getYFromX(index, end_) != yEnd_ || !flatFrom(s, index, end_)) return false;
+        // The grid points, then the points in between.
+        const double dn = static_cast<double>(line_.size());
+        for (size_t i = 0; i < line_.size(); ++i) {
+            const double x = end_ * static_cast<double>(i) / dn;
+            if (std::abs(y(x) - s.getYFromX(index, x)) > tolerance) return false;
+        }
+        return errorTo(s, index, tolerance) <= tolerance;
+    }
+
+    std::shared_ptr<const YopiTable> YopiTable::resample(const State& s, void* index, double tolerance)
+    {
+        if (!index || !(tolerance > 0.0)) return nullptr;
+        auto hostY = [&](double x) { return s.getYFromX(index, x); };
+
+        // The end of the varying part.
+        double end = 1.0;
+        for (int k = 0;; ++k, end *= 2.0) {
+            if (k == 64) return nullptr;
+            if (!std::isfinite(hostY(end))) return nullptr;
+            if (flatFrom(s, index, end)) break;
+        }
+
+        std::shared_ptr<YopiTable> t = std::make_shared<YopiTable>();
+        t->end_ = end;
+        t->yEnd_ = hostY(end);
+        std::vector<double> ys;
+        for (size_t n = minIntervals_; n <= maxIntervals_; n *= 2) {
+            const double dn = static_cast<double>(n);
+            auto gridX = [&](size_t i) { return end * static_cast<double>(i) / dn; };
+            ys.resize(n + 1);
+            for (size_t i = 0; i <= n; ++i) {
+                ys[i] = hostY(gridX(i));
+                if (!std::isfinite(ys[i])) return nullptr;
+            }
+            t->line_.resize(n);
+            t->invStep_ = dn / end;
+            for (size_t i = 0; i < n; ++i) {
+                const double x0 = gridX(i), x1 = gridX(i + 1);
+                Line& l = t->line_[i];
+                l.slope_ = (ys[i + 1] - ys[i]) / (x1 - x0);
+                l.intercept_ = ys[i] - l.slope_ * x0;
+            }
+
+            const double err = t->errorTo(s, index, tolerance);
+            if (err <= tolerance) {
+                t->error_ = err;
+                t->index_ = index;
+                t->tolerance_ = tolerance;
+                uint64 h = 14695981039346656037ULL;
+                auto mix = [&h](const void* p, size_t n) {
+                    const unsigned char* b = static_cast<const unsigned char*>(p);
+                    for (size_t i = 0; i < n; ++i) {
+                        h ^= b[i];
+                        h *= 1099511628211ULL;
+                    }
+                };
+                mix(t->line_.data(), t->line_.size() * sizeof(Line));
+                mix(&t->end_, sizeof(t->end_));
+                mix(&t->yEnd_, sizeof(t->yEnd_));
+                t->stamp_ = h;
+                return t;
+            }
+        }
+        return nullptr;
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Local copies of the table-dt / table-ds damage tables. With table-tolerance
+// set, initialize() samples each table once per material, through the State,
+// on a uniform grid with the slope of every interval precomputed: a lookup in
+// run() is then an index and one multiply-add instead of a virtual call into
+// the host and a search there. The host does not say when a table is edited,
+// so every initialize pass checks the copy against the table again
+// (matches()) and samples it anew if it is off.
+
+namespace jmodels
+{
+    struct State;
+
+    class YopiTable {
+    public:
+        // Smallest and largest number of grid intervals tried.
+        static const size_t minIntervals_ = 256;
+        static const size_t maxIntervals_ = 65536;
+
+        // Samples the host table \a index of \a s on [0, end], where end is the
+        // first power of two from 1 past which the table is constant. The grid
+        // is refined until linear interpolation on it is within \a tolerance of
+        // the host table at eight points in every interval. Null if the table
+        // has no constant end, or maxIntervals_ does not reach the tolerance:
+        // the host table is then used as it is.
+        static std::shared_ptr<const YopiTable> resample(const State& s, void* index, double tolerance);
+        // Whether this copy was sampled from \a index with \a tolerance, and
+        // still meets it: the same check as resample(), on the current table.
+        bool matches(const State& s, void* index, double tolerance) const;
+
+        // The value at \a x, for x >= 0; negative x are left to the host table.
+        double y(double x) const
+        {
+            if (x >= end_) return yEnd_;
+            size_t i = static_cast<size_t>(x * invStep_);
+            if (i >= line_.size()) i = line_.size() - 1;
+            const Line& l = line_[i];
+#ifdef FP_FAST_FMA
+            return std::fma(l.slope_, x, l.intercept_);
+#else
+            return l.intercept_ + l.slope_ * x;
+#endif
+        }
+        size_t intervals() const { return line_.size(); }
+        double end() const { return end_; }
+        // Largest difference to the host table found by the check.
+        double error() const { return error_; }
+        // Hash of the sampled values: equal copies have equal stamps.
+        uint64 stamp() const { return stamp_; }
+
+    private:
+        struct Line {
+            double slope_;
+            double intercept_; // value at x = 0 of the line through the interval
+        };
+        // Largest difference to the host table \a index of \a s, at eight
+        // points in every interval; stops once it is past \a limit.
+        double errorTo(const State& s, void* index, double limit) const;
+
+        std::vector<Line> line_;
+        double            end_ = 0.0;
+        double            invStep_ = 0.0;
+        double            yEnd_ = 0.0;
+        double            error_ = 0.0;
+        void*             index_ = nullptr;
+        double            tolerance_ = 0.0;
+        uint64            stamp_ = 0;
+    };
+} // namespace jmodels
+
+// EOF
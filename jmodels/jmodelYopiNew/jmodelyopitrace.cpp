@@ -0,0 +1,504 @@
+#include "jmodelyopitrace.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace jmodels
+{
+    const char* yopiTraceColumnName(YopiTraceColumn c)
+    {
+        switch (c) {
+        case YopiTraceColumn::Un:         return "un";
+        case YopiTraceColumn::Us:         return "us";
+        case YopiTraceColumn::Fn:         return "fn";
+        case YopiTraceColumn::Fs:         return "fs";
+        case YopiTraceColumn::Dt:         return "dt";
+        case YopiTraceColumn::Ds:         return "ds";
+        case YopiTraceColumn::Dc:         return "dc";
+        case YopiTraceColumn::Dts:        return "d_ts";
+        case YopiTraceColumn::PeakNormal: return "peak_normal";
+        case YopiTraceColumn::ReloadFlag: return "reloadFlag";
+        case YopiTraceColumn::StateBits:  return "state";
+        case YopiTraceColumn::Count:      break;
+        }
+        return "?";
+    }
+
+    namespace
+    {
+        // Offsets of mapped views are multiples of this (the allocation
+        // granularity of Windows, a multiple of the page size elsewhere).
+        const uint64 granularity = 1 << 16;
+        const uint64 windowTarget = 32 << 20; // bytes a window is sized for
+        const uint64 maxWindows = 1 << 16;
+        const uint64 noSlot = ~0ull;
+
+        uint64 roundUp(uint64 v, uint64 g) { return (v + g - 1) / g * g; }
+
+        // The file and its mapped views.
+        class MappedFile {
+        public:
+            bool create(const string& path)
+            {
+#ifdef _WIN32
+                file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                                    CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+                return file_ != INVALID_HANDLE_VALUE;
+#else
+                fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                return fd_ >= 0;
+#endif
+            }
+            // Extends the file to \a size bytes and maps [offset, size). Null on failure.
+            char* map(uint64 offset, uint64 size)
+            {
+#ifdef _WIN32
+                const uint64 end = offset + size;
+                HANDLE m = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(end >> 32),
+                                              static_cast<DWORD>(end), nullptr);
+                if (!m) return nullptr;
+                void* p = MapViewOfFile(m, FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32),
+                                        static_cast<DWORD>(offset), static_cast<SIZE_T>(size));
+                CloseHandle(m); // the view keeps the mapping
+                return static_cast<char*>(p);
+#else
+                if (::ftruncate(fd_, static_cast<off_t>(offset + size))) return nullptr;
+                void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(offset));
+                if (p == MAP_FAILED) return nullptr;
+#ifdef MADV_POPULATE_WRITE
+                // Takes the page faults here, on the background thread, not in run().
+                ::madvise(p, size, MADV_POPULATE_WRITE);
+#endif
+                return static_cast<char*>(p);
+#endif
+            }
+            // Starts writing the view back; with \a wait, until it is on disk.
+            void flush(char* p, uint64 size, bool wait)
+            {
+#ifdef _WIN32
+                FlushViewOfFile(p, static_cast<SIZE_T>(size));
+                if (wait) FlushFileBuffers(file_);
+#else
+                ::msync(p, size, wait ? MS_SYNC : MS_ASYNC);
+#endif
+            }
+            void unmap(char* p, uint64 size)
+            {
+#ifdef _WIN32
+                (void)size;
+                UnmapViewOfFile(p);
+#else
+                ::munmap(p, size);
+#endif
+            }
+            void close()
+            {
+#ifdef _WIN32
+                if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+                file_ = INVALID_HANDLE_VALUE;
+#else
+                if (fd_ >= 0) ::close(fd_);
+                fd_ = -1;
+#endif
+            }
+
+        private:
+#ifdef _WIN32
+            HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+            int fd_ = -1;
+#endif
+        };
+
+        struct Session {
+            uint64           id_ = 0;
+            string           path_;
+            MappedFile       file_;
+            char*            head_ = nullptr; // [0, dataOffset_)
+            YopiTraceHeader* header_ = nullptr;
+            double*          tags_ = nullptr;
+            uint64*          counts_ = nullptr;
+            uint64           capacity_ = 0;
+            uint64           framesPerWindow_ = 0;
+            uint64           windowBytes_ = 0;
+            uint64           dataOffset_ = 0;
+            uint64           column_[kYopiTraceColumns] = {}; // offsets in a window
+
+            // Windows [0, requested_) are wanted. Each entry is null until
+            // the background thread has mapped the window.
+            std::unique_ptr<std::atomic<char*>[]> windows_{ new std::atomic<char*>[maxWindows] };
+            std::atomic<uint64>                   requested_{ 0 };
+            std::atomic<uint64>                   stalls_{ 0 };
+            std::atomic<uint64>                   dropped_{ 0 };
+            uint64                                slots_ = 0;   // under the registry mutex
+            uint64                                refused_ = 0; // under the registry mutex
+
+            // The background thread and what it shares with the writers.
+            std::mutex              mutex_;
+            std::condition_variable work_;  // more windows requested, or stop
+            std::condition_variable ready_; // a window was mapped
+            uint64                  mapped_ = 0;
+            uint64                  flushed_ = 0;
+            uint64                  flushes_ = 0;
+            bool                    failed_ = false;
+            bool                    stop_ = false;
+            std::thread             thread_;
+
+            Session()
+            {
+                for (uint64 w = 0; w < maxWindows; ++w) windows_[w].store(nullptr, std::memory_order_relaxed);
+            }
+
+            char* window(uint64 w) { return windows_[w].load(std::memory_order_acquire); }
+
+            // Asks the background thread for windows [0, n).
+            void request(uint64 n)
+            {
+                if (n > maxWindows) n = maxWindows;
+                uint64 r = requested_.load(std::memory_order_relaxed);
+                while (r < n)
+                    if (requested_.compare_exchange_weak(r, n, std::memory_order_relaxed)) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        work_.notify_one();
+                        return;
+                    }
+            }
+
+            // Window \a w, waiting for the thread to map it. Null if it failed.
+            char* await(uint64 w)
+            {
+                request(w + 1);
+                stalls_.fetch_add(1, std::memory_order_relaxed);
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [&] { return window(w) || failed_ || stop_; });
+                return window(w);
+            }
+
+            void run()
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                for (;;) {
+                    work_.wait(lock, [&] {
+                        return stop_ || (!failed_ && mapped_ < requested_.load(std::memory_order_relaxed));
+                    });
+                    if (stop_) return;
+                    while (!failed_ && mapped_ < requested_.load(std::memory_order_relaxed)) {
+                        char* p = file_.map(dataOffset_ + mapped_ * windowBytes_, windowBytes_);
+                        if (!p) failed_ = true;
+                        else windows_[mapped_++].store(p, std::memory_order_release);
+                        ready_.notify_all();
+                    }
+                    // The writers have left the windows two behind the newest:
+                    // start writing those back, so their pages can be evicted.
+                    for (; flushed_ + 2 < requested_.load(std::memory_order_relaxed) && flushed_ < mapped_;
+                         ++flushed_, ++flushes_)
+                        file_.flush(window(flushed_), windowBytes_, false);
+                }
+            }
+
+            // Writes the header, flushes and unmaps everything. Under mutex_.
+            void finish()
+            {
+                header_->slots_ = slots_;
+                header_->windows_ = mapped_;
+                for (uint64 w = 0; w < mapped_; ++w) {
+                    file_.flush(window(w), windowBytes_, false);
+                    file_.unmap(window(w), windowBytes_);
+                    windows_[w].store(nullptr, std::memory_order_relaxed);
+                }
+                header_->closed_ = 1;
+                file_.flush(head_, dataOffset_, true);
+                file_.unmap(head_, dataOffset_);
+                file_.close();
+                head_ = nullptr;
+            }
+        };
+
+        // Never freed: the plugin may be unloaded with a trace open.
+        struct Registry {
+            std::mutex            mutex_;
+            std::atomic<Session*> session_{ nullptr };
+            std::atomic<uint64>   generation_{ 1 }; // changes with every open and close
+            bool                  envTried_ = false;
+        };
+
+        Registry& registry()
+        {
+            static Registry* r = new Registry; // outlives every contact
+            return *r;
+        }
+
+        // Under the registry mutex.
+        void openLocked(Registry& g, const string& path, uint64 capacity)
+        {
+            if (!capacity) throw std::runtime_error("yopiTraceOpen: no slots.");
+            std::unique_ptr<Session> s(new Session);
+            s->path_ = path;
+            s->capacity_ = capacity;
+
+            const uint64 tagsOffset = roundUp(sizeof(YopiTraceHeader), 64);
+            const uint64 countsOffset = roundUp(tagsOffset + capacity * sizeof(double), 64);
+            s->dataOffset_ = roundUp(countsOffset + capacity * sizeof(uint64), granularity);
+            uint32 size[kYopiTraceColumns];
+            uint64 rowBytes = 0;
+            for (uint32 c = 0; c < kYopiTraceColumns; ++c) {
+                size[c] = c == static_cast<uint32>(YopiTraceColumn::StateBits) ? sizeof(uint32) : sizeof(double);
+                rowBytes += size[c];
+            }
+            s->framesPerWindow_ = std::max<uint64>(1, windowTarget / (rowBytes * capacity));
+            uint64 at = 0;
+            for (uint32 c = 0; c < kYopiTraceColumns; ++c) {
+                s->column_[c] = at;
+                at = roundUp(at + s->framesPerWindow_ * capacity * size[c], 64);
+            }
+            s->windowBytes_ = roundUp(at, granularity);
+
+            if (!s->file_.create(path)) throw std::runtime_error("yopiTraceOpen: unable to create " + path);
+            s->head_ = s->file_.map(0, s->dataOffset_);
+            if (!s->head_) {
+                s->file_.close();
+                throw std::runtime_error("yopiTraceOpen: unable to map " + path);
+            }
+            YopiTraceHeader* h = s->header_ = reinterpret_cast<YopiTraceHeader*>(s->head_);
+            std::memset(h, 0, sizeof(*h));
+            std::memcpy(h->magic_, "YOPITRC", 8);
+            h->version_ = YopiTraceHeader::version;
+            h->columns_ = kYopiTraceColumns;
+            h->capacity_ = capacity;
+            h->framesPerWindow_ = s->framesPerWindow_;
+            h->windowBytes_ = s->windowBytes_;
+            h->tagsOffset_ = tagsOffset;
+            h->countsOffset_ = countsOffset;
+            h->dataOffset_ = s->dataOffset_;
+            for (uint32 c = 0; c < kYopiTraceColumns; ++c) {
+                std::strncpy(h->column_[c].name_, yopiTraceColumnName(static_cast<YopiTraceColumn>(c)),
+                             sizeof(h->column_[c].name_) - 1);
+                h->column_[c].size_ = size[c];
+                h->column_[c].offset_ = s->column_[c];
+            }
+            s->tags_ = reinterpret_cast<double*>(s->head_ + tagsOffset);
+            s->counts_ = reinterpret_cast<uint64*>(s->head_ + countsOffset);
+
+            s->id_ = g.generation_.load(std::memory_order_relaxed) + 1;
+            s->request(2); // the first window, and the one after
+            Session* p = s.release();
+            p->thread_ = std::thread([p] { p->run(); });
+            g.session_.store(p, std::memory_order_relaxed);
+            g.generation_.store(p->id_, std::memory_order_release);
+        }
+
+        // Under the registry mutex. Without \a join (the plugin is unloaded),
+        // the thread is left to end on its own and the session is not freed;
+        // if it cannot be locked, the system writes the mapped pages back.
+        void closeLocked(Registry& g, bool join)
+        {
+            Session* s = g.session_.load(std::memory_order_relaxed);
+            if (!s) return;
+            g.session_.store(nullptr, std::memory_order_relaxed);
+            g.generation_.fetch_add(1, std::memory_order_release);
+            std::unique_lock<std::mutex> lock(s->mutex_, std::defer_lock);
+            if (join) lock.lock();
+            else if (!lock.try_lock()) return;
+            s->stop_ = true;
+            s->work_.notify_all();
+            s->ready_.notify_all();
+            if (!join) {
+                s->thread_.detach();
+                s->finish();
+                return;
+            }
+            lock.unlock();
+            s->thread_.join();
+            lock.lock();
+            s->finish();
+            lock.unlock();
+            delete s;
+        }
+
+        // Opens the trace of YOPI_TRACE once, when the first contact records.
+        void openFromEnvironment(Registry& g)
+        {
+            if (g.envTried_) return;
+            g.envTried_ = true;
+            const char* path = std::getenv("YOPI_TRACE");
+            if (!path || !*path) return;
+            uint64 capacity = 65536;
+            if (const char* n = std::getenv("YOPI_TRACE_CONTACTS"))
+                capacity = std::strtoull(n, nullptr, 10);
+            try {
+                openLocked(g, path, capacity);
+            }
+            catch (std::exception&) {
+                // no trace; run() goes on
+            }
+        }
+
+        struct ExitClose {
+            ~ExitClose()
+            {
+                Registry& g = registry();
+                std::unique_lock<std::mutex> lock(g.mutex_, std::try_to_lock);
+                if (lock.owns_lock()) closeLocked(g, false);
+            }
+        } exitClose;
+
+        // Takes a slot of the current session for \a t, if there is one free.
+        Session* attach(YopiTraceSlot& t)
+        {
+            Registry& g = registry();
+            std::lock_guard<std::mutex> lock(g.mutex_);
+            if (!g.session_.load(std::memory_order_relaxed)) openFromEnvironment(g);
+            Session* s = g.session_.load(std::memory_order_relaxed);
+            t.session_ = g.generation_.load(std::memory_order_relaxed);
+            t.slot_ = noSlot;
+            t.records_ = 0;
+            if (!s) return nullptr;
+            if (s->slots_ == s->capacity_) {
+                ++s->refused_;
+                return nullptr;
+            }
+            t.slot_ = s->slots_++;
+            s->tags_[t.slot_] = t.tag_;
+            s->counts_[t.slot_] = 0;
+            return s;
+        }
+    }
+
+    void yopiTraceOpen(const string& path, uint64 capacity)
+    {
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        closeLocked(g, true);
+        openLocked(g, path, capacity);
+    }
+
+    void yopiTraceClose()
+    {
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        closeLocked(g, true);
+    }
+
+    YopiTraceStats yopiTraceStats()
+    {
+        YopiTraceStats r;
+        Registry& g = registry();
+        std::lock_guard<std::mutex> lock(g.mutex_);
+        Session* s = g.session_.load(std::memory_order_relaxed);
+        if (!s) return r;
+        r.open_ = true;
+        r.path_ = s->path_;
+        r.capacity_ = s->capacity_;
+        r.slots_ = s->slots_;
+        r.refused_ = s->refused_;
+        for (uint64 j = 0; j < s->slots_; ++j) r.records_ += s->counts_[j];
+        r.dropped_ = s->dropped_.load(std::memory_order_relaxed);
+        r.stalls_ = s->stalls_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> wlock(s->mutex_);
+        r.windows_ = s->mapped_;
+        r.flushes_ = s->flushes_;
+        r.bytes_ = s->dataOffset_ + s->mapped_ * s->windowBytes_;
+        return r;
+    }
+
+    void yopiTraceAppend(YopiTraceSlot& t, const YopiTraceRecord& r)
+    {
+        Registry& g = registry();
+        Session* s = nullptr;
+        if (t.session_ != g.generation_.load(std::memory_order_acquire)) {
+            s = attach(t);
+            if (!s) return;
+        }
+        if (t.slot_ == noSlot) return;
+        if (!s) s = g.session_.load(std::memory_order_acquire); // that of t.session_: no close while contacts run
+        const uint64 frame = t.records_ % s->framesPerWindow_;
+        const uint64 w = t.records_ / s->framesPerWindow_;
+        if (w >= maxWindows) {
+            s->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        char* p = s->window(w);
+        if (!p && !(p = s->await(w))) {
+            s->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // The first record of a window asks for the one after it.
+        if (!frame) s->request(w + 2);
+        const uint64 cell = frame * s->capacity_ + t.slot_;
+        for (uint32 c = 0; c < kYopiTraceValues; ++c)
+            reinterpret_cast<double*>(p + s->column_[c])[cell] = r.value_[c];
+        reinterpret_cast<uint32*>(p + s->column_[kYopiTraceValues])[cell] = r.state_;
+        s->counts_[t.slot_] = ++t.records_;
+    }
+
+    YopiTraceFile::YopiTraceFile(const string& path) :
+        in_(path, std::ios::binary)
+    {
+        if (!in_.read(reinterpret_cast<char*>(&header_), sizeof(header_))
+            || std::memcmp(header_.magic_, "YOPITRC", 8) || header_.version_ != YopiTraceHeader::version
+            || header_.columns_ != kYopiTraceColumns)
+            throw std::runtime_error(path + " is not a Yopi trace file.");
+    }
+
+    double YopiTraceFile::tag(uint64 slot)
+    {
+        double v;
+        read(header_.tagsOffset_ + slot * sizeof(double), &v, sizeof(v));
+        return v;
+    }
+
+    uint64 YopiTraceFile::records(uint64 slot)
+    {
+        uint64 n;
+        read(header_.countsOffset_ + slot * sizeof(uint64), &n, sizeof(n));
+        return n;
+    }
+
+    double YopiTraceFile::value(uint64 slot, uint64 record, YopiTraceColumn c)
+    {
+        if (c == YopiTraceColumn::StateBits) return state(slot, record);
+        double v;
+        read(offset(slot, record, c), &v, sizeof(v));
+        return v;
+    }
+
+    uint32 YopiTraceFile::state(uint64 slot, uint64 record)
+    {
+        uint32 v;
+        read(offset(slot, record, YopiTraceColumn::StateBits), &v, sizeof(v));
+        return v;
+    }
+
+    uint64 YopiTraceFile::offset(uint64 slot, uint64 record, YopiTraceColumn c) const
+    {
+        const YopiTraceHeader::Column& col = header_.column_[static_cast<uint32>(c)];
+        return header_.dataOffset_ + record / header_.framesPerWindow_ * header_.windowBytes_ + col.offset_
+               + (record % header_.framesPerWindow_ * header_.capacity_ + slot) * col.size_;
+    }
+
+    void YopiTraceFile::read(uint64 offset, void* to, size_t size)
+    {
+        in_.clear();
+        in_.seekg(static_cast<std::streamoff>(offset));
+        if (!in_.read(static_cast<char*>(to), static_cast<std::streamsize>(size)))
+            throw std::runtime_error("YopiTraceFile: read past the end of the file.");
+    }
+} // namespace jmodels
+
+// EOF
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "jmodelbase.h"
+#include <fstream>
+
+// Time histories of selected contacts, recorded by the model itself into a
+// memory-mapped file. A contact is selected by setting its trace tag to any
+// nonzero number, typically the id of the contact in 3DEC (the model does not
+// know it), through the export yopiSetTraceTag() of jmodelyopi.h; every run()
+// of the contact then appends one record to the file, and 0 stops it. That replaces FISH callbacks and history commands when
+// thousands of contacts are watched: a record is a few stores into mapped
+// memory, no call into the host.
+//
+// The file is columnar. Each contact that starts recording takes the next free
+// slot; the records are kept in windows of framesPerWindow_ records of every
+// slot, and inside a window each column is an array [record][slot]. Contacts
+// cycled in order therefore write each column sequentially. The windows are
+// mapped ahead by a background thread: while the contacts fill one window, the
+// thread maps the next and flushes the one before to disk. A contact that gets
+// ahead of the thread waits for it (counted as a stall).
+//
+// Open a file with yopiTraceOpen(), or set the environment variable YOPI_TRACE
+// to a file name (YOPI_TRACE_CONTACTS slots, default 65536): it is then opened
+// when the first contact starts recording, and closed when the plugin is
+// unloaded. Open and close between cycles. Only run() records; runBatch() does
+// not. The tag is not a property: the host does not save it, restore() and
+// copy() leave it at 0, and a restored contact records only once its tag is
+// set again.
+
+namespace jmodels
+{
+    // The columns of a record, in file order.
+    enum class YopiTraceColumn : uint32 {
+        Un,          // normal displacement
+        Us,          // magnitude of the shear displacement
+        Fn,          // normal force
+        Fs,          // magnitude of the shear force
+        Dt,          // tensile damage
+        Ds,          // shear damage
+        Dc,          // compressive damage
+        Dts,         // combined tension-shear damage (d_ts)
+        PeakNormal,  // peak_normal
+        ReloadFlag,  // reloadFlag
+        StateBits,   // state bits (uint32); all others are doubles
+        Count
+    };
+    static const uint32 kYopiTraceColumns = static_cast<uint32>(YopiTraceColumn::Count);
+    static const uint32 kYopiTraceValues = kYopiTraceColumns - 1; // double columns
+
+    // Short name of \a c, as in the file header.
+    const char* yopiTraceColumnName(YopiTraceColumn c);
+
+    // The start of the file, in its first 64 KB. Offsets are in bytes from the
+    // start of the file, column offsets from the start of a window. Record r
+    // of slot j of column c is at
+    //   dataOffset_ + (r / framesPerWindow_) * windowBytes_ + column_[c].offset_
+    //   + ((r % framesPerWindow_) * capacity_ + j) * column_[c].size_
+    struct YopiTraceHeader {
+        static const uint32 version = 1;
+        struct Column {
+            char   name_[16];
+            uint32 size_;
+            uint32 reserved_;
+            uint64 offset_;
+        };
+        char   magic_[8];        // "YOPITRC"
+        uint32 version_;
+        uint32 columns_;         // kYopiTraceColumns
+        uint64 capacity_;        // slots
+        uint64 framesPerWindow_;
+        uint64 windowBytes_;
+        uint64 tagsOffset_;      // double[capacity_], the trace tag of each slot
+        uint64 countsOffset_;    // uint64[capacity_], records written by each slot
+        uint64 dataOffset_;      // the first window
+        uint64 slots_;           // slots taken, written when closed
+        uint64 windows_;         // windows in the file, written when closed
+        uint64 closed_;          // 1 once closed cleanly
+        Column column_[kYopiTraceColumns];
+    };
+
+    struct YopiTraceStats {
+        bool   open_ = false;
+        string path_;
+        uint64 capacity_ = 0;  // slots
+        uint64 slots_ = 0;     // slots taken
+        uint64 records_ = 0;   // records written
+        uint64 refused_ = 0;   // contacts that found every slot taken
+        uint64 dropped_ = 0;   // records lost at the window limit, or to a failed mapping
+        uint64 windows_ = 0;   // windows mapped
+        uint64 stalls_ = 0;    // records that waited for their window to be mapped
+        uint64 flushes_ = 0;   // windows flushed by the background thread
+        uint64 bytes_ = 0;     // file size
+    };
+
+    // Per contact: which slot of which trace session the contact writes.
+    struct YopiTraceSlot {
+        double tag_ = 0.0;      // the trace tag, 0 when not traced
+        uint64 session_ = 0;    // session the slot belongs to
+        uint64 slot_ = ~0ull;   // ~0 if none
+        uint64 records_ = 0;    // records written to it
+    };
+
+    // One record, as run() hands it over.
+    struct YopiTraceRecord {
+        double value_[kYopiTraceValues];
+        uint32 state_;
+    };
+
+    // Opens a trace file at \a path with room for \a capacity contacts, closing
+    // any trace open. Throws if the file cannot be created.
+    void           yopiTraceOpen(const string& path, uint64 capacity);
+    // Flushes and closes the trace, if one is open.
+    void           yopiTraceClose();
+    YopiTraceStats yopiTraceStats();
+    // Appends \a r to the trace of \a t, taking a slot on the first record of a
+    // session. Thread safe for distinct \a t.
+    void           yopiTraceAppend(YopiTraceSlot& t, const YopiTraceRecord& r);
+
+    // Reads a closed trace file back.
+    class YopiTraceFile {
+    public:
+        // Throws if \a path is not a trace file.
+        explicit YopiTraceFile(const string& path);
+        const YopiTraceHeader& header() const { return header_; }
+        uint64 slots() const { return header_.slots_; }
+        double tag(uint64 slot);
+        uint64 records(uint64 slot);
+        double value(uint64 slot, uint64 record, YopiTraceColumn c);
+        uint32 state(uint64 slot, uint64 record);
+
+    private:
+        uint64 offset(uint64 slot, uint64 record, YopiTraceColumn c) const;
+        void   read(uint64 offset, void* to, size_t size);
+        std::ifstream   in_;
+        YopiTraceHeader header_;
+    };
+} // namespace jmodels
+
+// EOF